@@ -1,8 +1,214 @@
 #include "6502.h"
+#include "mapper.h"
+#include "bus.h"
 
-void CPU::branchInstruction( bool takeBranch )
+CPU::CPU()
+    : cycles( 0 ), sliceEnd( 0 ), irq( 0 ), nmi( false ), ppu( *this ), apu( *this ), oamDmaStart( 0 ), oamDmaEnd( 0 )
 {
-    uint8_t byte = readByte();
+    mapFlat();
+}
+
+CPU::~CPU()
+{
+}
+
+uint8_t CPU::busRead( uint16_t addr )
+{
+    if ( addr >= 0x2000 && addr < 0x4000 ) {
+        return ppu.readRegister( addr & 0x7 );
+    }
+    if ( addr == 0x4015 ) {
+        return apu.readStatus();
+    }
+    return mem[addr];
+}
+
+void CPU::busWrite( uint16_t addr, uint8_t val )
+{
+    if ( mapper && addr >= 0x8000 ) {
+        ppu.sync();
+        mapper->writeRegister( addr, val );
+        return;
+    }
+    if ( addr >= 0x2000 && addr < 0x4000 ) {
+        // PPU registers, mirrored every 8 bytes. Mappers watch them to predict A12
+        ppu.writeRegister( addr & 0x7, val );
+        if ( mapper ) {
+            mapper->ppuWrite( addr & 0x7, val );
+        }
+        return;
+    }
+    mem[addr] = val;
+    if ( addr == 0x4014 ) {
+        oamDma( val );
+    } else if ( addr >= 0x4000 && addr < 0x4018 ) {
+        apu.writeRegister( addr, val );
+    }
+}
+
+void CPU::setIRQ( uint8_t source, bool asserted )
+{
+    if ( asserted ) {
+        irq |= source;
+        scheduler.schedule( EVENT_INTERRUPT, clock() );
+    } else {
+        irq &= ~source;
+    }
+}
+
+void CPU::serviceEvents()
+{
+    int kind;
+    while ( ( kind = scheduler.pop( clock() ) ) >= 0 ) {
+        switch ( kind ) {
+            case EVENT_PPU:
+                ppu.event( clock() );
+                break;
+            case EVENT_SPRITE0:
+                ppu.statusEvent( clock() );
+                break;
+            case EVENT_MAPPER:
+                mapper->event( clock() );
+                break;
+            case EVENT_APU:
+                apu.event( clock() );
+                break;
+            case EVENT_SAVE_FLUSH:
+                save.flush();
+                scheduler.schedule( EVENT_SAVE_FLUSH, clock() + SAVE_FLUSH_CYCLES );
+                break;
+            default:
+                // EVENT_INTERRUPT only gets us here
+                break;
+        }
+    }
+    // a masked IRQ is looked at again by CLI, PLP and RTI
+    if ( nmi ) {
+        nmi = false;
+        interrupt( 0xFFFA );
+    } else if ( irq && P.I == 0 ) {
+        interrupt( 0xFFFE );
+    }
+}
+
+void CPU::interrupt( uint16_t vector )
+{
+    mem[0x100 + S--] = (PC >> 8);
+    mem[0x100 + S--] = (PC & 0xFF);
+    mem[0x100 + S--] = getStatusByte() & ~0x10; // B is only pushed set by BRK and PHP
+    P.I = 1;
+    PC = ( read(vector) | (read(vector + 1) << 8));
+    cycles -= 7;
+}
+
+void CPU::oamDma( uint8_t page )
+{
+    uint16_t addr = page << 8;
+    const uint8_t *src = readMap[addr >> BUS_PAGE_SHIFT];
+    if ( src != NULL ) {
+        ppu.oamDma( src + (addr & (BUS_PAGE_SIZE - 1)) );
+    } else {
+        uint8_t data[OAM_SIZE];
+        for ( int i = 0; i < OAM_SIZE; i++ ) {
+            data[i] = busRead( addr + i );
+        }
+        ppu.oamDma( data );
+    }
+    // one halt cycle, an alignment cycle on odd cycles, then 256 read/write pairs
+    int stall = OAM_DMA_CYCLES + ( clock() & 1 );
+    oamDmaStart = clock();
+    oamDmaEnd = oamDmaStart + stall;
+    cycles -= stall;
+}
+
+uint8_t CPU::dmcRead( uint16_t addr, uint64_t time )
+{
+    // a fetch inside OAM DMA reuses its halt and only steals the read and a realign
+    if ( time >= oamDmaStart && time < oamDmaEnd ) {
+        oamDmaEnd += DMC_DMA_OAM_CYCLES;
+        cycles -= DMC_DMA_OAM_CYCLES;
+    } else {
+        cycles -= DMC_DMA_CYCLES;
+    }
+    return read( addr );
+}
+
+void CPU::mapFlat()
+{
+    ppu.finishFrame();
+    mapper.reset();
+    save.close();
+    executor = &CPU::run<FlatBus>;
+    for ( int i = 0; i < BUS_PAGES; i++ ) {
+        readMap[i] = &mem[i << BUS_PAGE_SHIFT];
+        writeMap[i] = &mem[i << BUS_PAGE_SHIFT];
+    }
+}
+
+void CPU::selectExecutor()
+{
+    if ( !mapper ) {
+        executor = &CPU::run<FlatBus>;
+        return;
+    }
+    switch ( header.mapper ) {
+        case 0:
+            executor = &CPU::run< CartBus<NROM> >;
+            break;
+        case 1:
+            executor = &CPU::run< CartBus<MMC1> >;
+            break;
+        case 2:
+            executor = &CPU::run< CartBus<UxROM> >;
+            break;
+        case 3:
+            executor = &CPU::run< CartBus<CNROM> >;
+            break;
+        case 4:
+            executor = &CPU::run< CartBus<MMC3> >;
+            break;
+        case 7:
+            executor = &CPU::run< CartBus<AxROM> >;
+            break;
+        default:
+            executor = &CPU::run<PagedBus>;
+            break;
+    }
+}
+
+void CPU::stepPaged()
+{
+    // run<PagedBus> starts its own slice, the clock carries over
+    uint64_t end = sliceEnd;
+    run<PagedBus>( 1 );
+    uint64_t now = clock();
+    sliceEnd = end;
+    cycles = end - now;
+}
+
+void CPU::mapCartridge()
+{
+    mapFlat();
+    // $0000-$1FFF, 2KB of RAM mirrored four times
+    for ( int i = 0; i < 0x2000 >> BUS_PAGE_SHIFT; i++ ) {
+        readMap[i] = &mem[0];
+        writeMap[i] = &mem[0];
+    }
+    // PPU and APU/IO registers go through busRead/busWrite
+    for ( int i = 0x2000 >> BUS_PAGE_SHIFT; i < 0x4800 >> BUS_PAGE_SHIFT; i++ ) {
+        readMap[i] = NULL;
+        writeMap[i] = NULL;
+    }
+    // PRG-ROM, reads are mapped by the mapper and writes go to its registers
+    for ( int i = 0x8000 >> BUS_PAGE_SHIFT; i < BUS_PAGES; i++ ) {
+        writeMap[i] = NULL;
+    }
+}
+
+template<class Bus>
+inline void CPU::branchInstruction( bool takeBranch )
+{
+    uint8_t byte = fetch<Bus>();
     int8_t position = byte;
     if ( takeBranch ) {
         cycles--;
@@ -28,42 +234,159 @@ uint8_t CPU::getStatusByte() {
     return (P.N << 7|P.V << 6|P.U << 5|P.B << 4|P.D << 3|P.I << 2|P.Z << 1|P.C << 0);
 };
 
+// read a raw or gzip'd .nes file, the header tells how much follows so the
+// image is decompressed straight into place
+static bool readNESFile( std::string file, std::vector<uint8_t> &image )
+{
+    // zlib reads uncompressed files transparently, so raw and gzip'd ROMs share this path
+    gzFile gz = gzopen( file.c_str(), "rb" );
+    if ( !gz ) {
+        return false;
+    }
+    gzbuffer( gz, 0x20000 );
+    INESHeader header;
+    image.resize( INES_HEADER_SIZE );
+    if ( gzread( gz, &image[0], INES_HEADER_SIZE ) != INES_HEADER_SIZE || parseINESHeader( &image[0], header ) == false ) {
+        gzclose( gz );
+        return false;
+    }
+    size_t size = header.chroffset + header.chrsize;
+    image.resize( size );
+    int read = gzread( gz, image.data() + INES_HEADER_SIZE, size - INES_HEADER_SIZE );
+    gzclose( gz );
+    return read == (int)( size - INES_HEADER_SIZE );
+}
+
+// read a whole, possibly gzip'd, file of unknown size
+static bool readFile( std::string file, std::vector<uint8_t> &data )
+{
+    gzFile gz = gzopen( file.c_str(), "rb" );
+    if ( !gz ) {
+        return false;
+    }
+    data.clear();
+    int read;
+    do {
+        size_t done = data.size();
+        data.resize( done + 0x10000 );
+        read = gzread( gz, &data[done], 0x10000 );
+        data.resize( done + ( read > 0 ? read : 0 ) );
+    } while ( read > 0 );
+    gzclose( gz );
+    return read == 0;
+}
+
 bool CPU::loadNESFile( std::string file )
 {
-    std::ifstream ifs(file, std::ios_base::in | std::ios_base::binary);
-    if ( ifs ) {
-        uint8_t header[16];
-        if (!ifs.read(reinterpret_cast<char*>(&header[0]),0x10)) {
-            printf("Error reading NES file\n");
-            exception = true;
-            return false;
-        }
-        uint8_t prgbanks = header[4];
-        uint8_t chrbanks = header[5];
-        uint8_t mapper = ((header[6] >> 4) & 0xF) | (header[7] & 0xF0);
-        if ( mapper != 0 ) {
-            printf("%s: Mapper %d not supported\n",file.c_str(),mapper);
-            exception = true;
-            return false;
-        }
-        int prgsize = 1024*16*prgbanks;
-        int chrsize = 1024*8*chrbanks;
-        uint8_t prgrom[prgsize];
-        uint8_t chrrom[chrsize];
-        (void)chrrom;
-        if (!ifs.read(reinterpret_cast<char*>(&prgrom[0]),prgsize)) {
-            printf("Error reading NES file\n");
-            exception = true;
-            return false;
-        }
-        if ( prgbanks == 1 ) {
-            memcpy(&mem[0x8000],&prgrom[0],prgsize);
-            memcpy(&mem[0xC000],&prgrom[0],prgsize);
-        } else if ( prgbanks == 2 ) {
-            memcpy(&mem[0x8000],&prgrom[0],prgsize);
-        }
+    // the running cartridge reads from romdata until the new one is in
+    std::vector<uint8_t> image;
+    if ( readNESFile( file, image ) == false ) {
+        fprintf(stderr,"Error reading NES file\n");
+        exception = true;
+        return false;
+    }
+    if ( loadNESImage( &image[0], image.size(), file ) == false ) {
+        return false;
+    }
+    // swapping keeps the buffer prgrom and chrrom point into
+    romdata.swap( image );
+    return true;
+}
 
+bool CPU::loadNESFile( std::string file, std::string patch )
+{
+    std::vector<uint8_t> base;
+    std::vector<uint8_t> patchdata;
+    if ( readNESFile( file, base ) == false || readFile( patch, patchdata ) == false ) {
+        fprintf(stderr,"Error reading NES file\n");
+        exception = true;
+        return false;
     }
+    // the running cartridge may read from patched until the new one is in
+    PatchedImage image = patchNESImage( base, patchdata );
+    if ( !image ) {
+        fprintf(stderr,"%s: Unable to apply %s\n",file.c_str(),patch.c_str());
+        exception = true;
+        return false;
+    }
+    if ( loadNESImage( image->data(), image->size(), file ) == false ) {
+        return false;
+    }
+    patched = image;
+    return true;
+}
+
+bool CPU::loadFromPack( const RomPack &pack, std::string name )
+{
+    const RomPackEntry *entry = pack.find( name );
+    if ( entry == NULL ) {
+        fprintf(stderr,"%s: Not found in ROM pack\n",name.c_str());
+        exception = true;
+        return false;
+    }
+    return loadNESImage( pack.image( entry ), entry->size, name );
+}
+
+bool CPU::loadFromPack( const RomPack &pack, uint32_t crc )
+{
+    const RomPackEntry *entry = pack.find( crc );
+    if ( entry == NULL ) {
+        fprintf(stderr,"%.8x: Not found in ROM pack\n",crc);
+        exception = true;
+        return false;
+    }
+    return loadNESImage( pack.image( entry ), entry->size, entry->name );
+}
+
+bool CPU::loadNESImage( const uint8_t *data, size_t size, std::string name )
+{
+    // the running cartridge keeps header, prgrom and chrrom until the new one is known to work
+    INESHeader h;
+    if ( size < INES_HEADER_SIZE || parseINESHeader( data, h ) == false ||
+            h.chroffset + h.chrsize > size ) {
+        fprintf(stderr,"Error reading NES file\n");
+        exception = true;
+        return false;
+    }
+
+    // identify the dump, a known ROM gets its header fixed from the database
+    uint8_t sha1[SHA1_DIGEST_SIZE];
+    SHA1 sha;
+    sha.update( data + h.prgoffset, h.prgsize + h.chrsize );
+    sha.final( sha1 );
+    uint32_t crc = crc32( data + h.prgoffset, h.prgsize + h.chrsize );
+    if ( romdb != NULL ) {
+        romdb->correctHeader( crc, sha1, h );
+    }
+    if ( Mapper::supported( h ) == false ) {
+        fprintf(stderr,"%s: Mapper %d not supported\n",name.c_str(),h.mapper);
+        exception = true;
+        return false;
+    }
+
+    // lines still being drawn read the old board's tiles
+    ppu.finishFrame();
+    header = h;
+    prgrom = data + header.prgoffset;
+    chrrom = data + header.chroffset;
+    romcrc = crc;
+    memcpy( romsha1, sha1, SHA1_DIGEST_SIZE );
+    Mapper *board = Mapper::create( *this );
+    mapCartridge();
+    if ( header.battery && save.open( SaveFile::path( name ) ) ) {
+        for ( int i = 0x6000 >> BUS_PAGE_SHIFT; i < 0x8000 >> BUS_PAGE_SHIFT; i++ ) {
+            readMap[i] = save.data + ( (i << BUS_PAGE_SHIFT) & (SAVE_PRG_RAM_SIZE - 1) );
+            writeMap[i] = save.data + ( (i << BUS_PAGE_SHIFT) & (SAVE_PRG_RAM_SIZE - 1) );
+        }
+        scheduler.schedule( EVENT_SAVE_FLUSH, clock() + SAVE_FLUSH_CYCLES );
+    }
+    mapper.reset( board );
+    mapper->reset();
+    ppu.reset();
+    ppu.start();
+    apu.reset();
+    apu.start();
+    selectExecutor();
     return true;
 }
 
@@ -71,7 +394,11 @@ void CPU::reset()
 {
     P.I = 1;
     S -= 3;
-    PC = ( mem[0xFFFC] | (mem[0xFFFD] << 8));
+    PC = ( read(0xFFFC) | (read(0xFFFD) << 8));
+    // reset silences the APU like a $4015 = 0 write
+    if ( mapper ) {
+        apu.writeRegister( 0x4015, 0x00 );
+    }
 }
 
 void CPU::powerOn( uint16_t PC_Addr )
@@ -94,18 +421,27 @@ void CPU::powerOn( uint16_t PC_Addr )
 
     // Hack for now, used for unit testing. Load PC_Addr into FFFC-FFFD if > 0
     if ( PC_Addr > 0  ) {
+        mapFlat();
         mem[0xFFFD] = (PC_Addr >> 8);
         mem[0xFFFC] = PC_Addr & 0xFF;
     }
 
     // load PC from reset vector
-    PC = ( mem[0xFFFC] | (mem[0xFFFD] << 8));
+    PC = ( read(0xFFFC) | (read(0xFFFD) << 8));
 
     // stack pointer
     S = 0xFD;
 
     // cycles, used for testing
     cycles = 0;
+    sliceEnd = 0;
+    oamDmaStart = 0;
+    oamDmaEnd = 0;
+    scheduler.clear();
+    ppu.reset();
+    apu.reset();
+    irq = 0;
+    nmi = false;
 
     // process status
     P = {0};
@@ -115,13 +451,22 @@ void CPU::powerOn( uint16_t PC_Addr )
 
     // exception, used for testing
     exception = false;
+
+    if ( mapper ) {
+        mapper->reset();
+        ppu.start();
+        apu.start();
+    }
+    if ( save.data != NULL ) {
+        scheduler.schedule( EVENT_SAVE_FLUSH, SAVE_FLUSH_CYCLES );
+    }
 };
 
 // read one byte from mem and increment program counter
 uint8_t CPU::readByte()
 {
     cycles--;
-    return mem[PC++];
+    return read(PC++);
 };
 
 // dump memory at address + 40 bytes
@@ -141,9 +486,9 @@ void CPU::dumpRegister()
 {
     for ( int i = PC-10; i <PC+10; i++) {
         if ( i == PC ) {
-            printf("0x%.4x: 0x%.2x <<<\n",i,mem[i]);
+            fprintf(stderr,"0x%.4x: 0x%.2x <<<\n",i,mem[i]);
         } else {
-            printf("0x%.4x: 0x%.2x\n",i,mem[i]);
+            fprintf(stderr,"0x%.4x: 0x%.2x\n",i,mem[i]);
         }
     }
 }
@@ -185,37 +530,46 @@ void CPU::M_status_flags( uint8_t M )
     P.N = ( M & 0x80 ) != 0;
 };
 
-void CPU::execute(int c)
+template<class Bus>
+void CPU::run( int c )
 {
+    sliceEnd = clock() + c;
     cycles = c;
     while ( cycles > 0 && exception == false ) {
-        uint8_t ins = readByte();
+        if ( clock() >= scheduler.next ) {
+            serviceEvents();
+        }
+        if ( !Bus::fetchable( PC ) ) {
+            stepPaged();
+            continue;
+        }
+        uint8_t ins = fetch<Bus>();
         // printf("Instruction: %x, AXY: %x,%x,%x, PC: %x\n",ins,A,X,Y,PC);
         switch ( ins ) {
             case INS::LDA_IM:
                 {
-                    uint8_t byte = readByte();
+                    uint8_t byte = fetch<Bus>();
                     A = byte;
                     A_status_flags();
                 }
                 break;
             case INS::LDX_IM:
                 {
-                    uint8_t byte = readByte();
+                    uint8_t byte = fetch<Bus>();
                     X = byte;
                     X_status_flags();
                 }
                 break;
             case INS::LDY_IM:
                 {
-                    uint8_t byte = readByte();
+                    uint8_t byte = fetch<Bus>();
                     Y = byte;
                     Y_status_flags();
                 }
                 break;
             case INS::LDA_ZP:
                 {
-                    uint8_t byte = readByte();
+                    uint8_t byte = fetch<Bus>();
                     A = mem[byte];
                     cycles--; // takes one cycle to load accumulator from ZeroPage
                     A_status_flags();
@@ -223,7 +577,7 @@ void CPU::execute(int c)
                 break;
             case INS::LDX_ZP:
                 {
-                    uint8_t byte = readByte();
+                    uint8_t byte = fetch<Bus>();
                     X = mem[byte];
                     cycles--; // takes one cycle to load accumulator from ZeroPage
                     X_status_flags();
@@ -231,7 +585,7 @@ void CPU::execute(int c)
                 break;
             case INS::LDY_ZP:
                 {
-                    uint8_t byte = readByte();
+                    uint8_t byte = fetch<Bus>();
                     Y = mem[byte];
                     cycles--; // takes one cycle to load accumulator from ZeroPage
                     Y_status_flags();
@@ -239,7 +593,7 @@ void CPU::execute(int c)
                 break;
             case INS::LDA_ZP_X:
                 {
-                    uint8_t byte = readByte();
+                    uint8_t byte = fetch<Bus>();
                     A = mem[byte+X];
                     cycles--; // takes one cycle to add X register
                     cycles--; // takes one cycle to load accumulator from ZeroPage
@@ -248,7 +602,7 @@ void CPU::execute(int c)
                 break;
             case INS::LDX_ZP_Y:
                 {
-                    uint8_t byte = readByte();
+                    uint8_t byte = fetch<Bus>();
                     X = mem[byte+Y];
                     cycles--; // takes one cycle to add X register
                     cycles--; // takes one cycle to load accumulator from ZeroPage
@@ -257,7 +611,7 @@ void CPU::execute(int c)
                 break;
             case INS::LDY_ZP_X:
                 {
-                    uint8_t byte = readByte();
+                    uint8_t byte = fetch<Bus>();
                     Y = mem[byte+X];
                     cycles--; // takes one cycle to add X register
                     cycles--; // takes one cycle to load accumulator from ZeroPage
@@ -266,37 +620,37 @@ void CPU::execute(int c)
                 break;
             case INS::LDA_ABS:
                 {
-                    uint8_t low = readByte();
-                    uint8_t high = readByte();
+                    uint8_t low = fetch<Bus>();
+                    uint8_t high = fetch<Bus>();
                     cycles--; // one cycle to bitshift
-                    A = mem[low | (high << 8)];
+                    A = Bus::read( *this, low | (high << 8));
                     A_status_flags();
                 }
                 break;
             case INS::LDX_ABS:
                 {
-                    uint8_t low = readByte();
-                    uint8_t high = readByte();
+                    uint8_t low = fetch<Bus>();
+                    uint8_t high = fetch<Bus>();
                     cycles--; // one cycle to bitshift
-                    X = mem[low | (high << 8)];
+                    X = Bus::read( *this, low | (high << 8));
                     X_status_flags();
                 }
                 break;
             case INS::LDY_ABS:
                 {
-                    uint8_t low = readByte();
-                    uint8_t high = readByte();
+                    uint8_t low = fetch<Bus>();
+                    uint8_t high = fetch<Bus>();
                     cycles--; // one cycle to bitshift
-                    Y = mem[low | (high << 8)];
+                    Y = Bus::read( *this, low | (high << 8));
                     Y_status_flags();
                 }
                 break;
             case INS::LDA_ABS_X:
                 {
-                    uint8_t low = readByte();
-                    uint8_t high = readByte();
+                    uint8_t low = fetch<Bus>();
+                    uint8_t high = fetch<Bus>();
                     cycles--; // one cycle to bitshift
-                    A = mem[(low | (high << 8))+X];
+                    A = Bus::read( *this, (low | (high << 8))+X);
                     if ( low + X > 0xFF ) {
                         cycles--;
                     }
@@ -305,10 +659,10 @@ void CPU::execute(int c)
                 break;
             case INS::LDX_ABS_Y:
                 {
-                    uint8_t low = readByte();
-                    uint8_t high = readByte();
+                    uint8_t low = fetch<Bus>();
+                    uint8_t high = fetch<Bus>();
                     cycles--; // one cycle to bitshift
-                    X = mem[(low | (high << 8))+Y];
+                    X = Bus::read( *this, (low | (high << 8))+Y);
                     if ( low + Y > 0xFF ) {
                         cycles--;
                     }
@@ -317,10 +671,10 @@ void CPU::execute(int c)
                 break;
             case INS::LDY_ABS_X:
                 {
-                    uint8_t low = readByte();
-                    uint8_t high = readByte();
+                    uint8_t low = fetch<Bus>();
+                    uint8_t high = fetch<Bus>();
                     cycles--; // one cycle to bitshift
-                    Y = mem[(low | (high << 8))+X];
+                    Y = Bus::read( *this, (low | (high << 8))+X);
                     if ( low + X > 0xFF ) {
                         cycles--;
                     }
@@ -329,10 +683,10 @@ void CPU::execute(int c)
                 break;
             case INS::LDA_ABS_Y:
                 {
-                    uint8_t low = readByte();
-                    uint8_t high = readByte();
+                    uint8_t low = fetch<Bus>();
+                    uint8_t high = fetch<Bus>();
                     cycles--; // one cycle to bitshift
-                    A = mem[(low | (high << 8))+Y];
+                    A = Bus::read( *this, (low | (high << 8))+Y);
                     if ( low + Y > 0xFF ) {
                         cycles--;
                     }
@@ -341,7 +695,7 @@ void CPU::execute(int c)
                 break;
             case INS::LDA_IND_X:
                 {
-                    uint8_t byte = readByte();
+                    uint8_t byte = fetch<Bus>();
                     cycles--; // read from address
                     // check if we need to handle ZP wrap
                     uint8_t offset = 0;
@@ -353,33 +707,33 @@ void CPU::execute(int c)
                     uint8_t high = mem[byte+X+1-offset];
                     cycles--; // one cycle to get high
                     // handling for ZP barrier
-                    A = mem[(low | (high << 8))];
+                    A = Bus::read( *this, (low | (high << 8)));
                     cycles--; // one cycle to bitshift
                     A_status_flags();
                 }
                 break;
             case INS::LDA_IND_Y:
                 {
-                    uint8_t byte = readByte();
+                    uint8_t byte = fetch<Bus>();
                     cycles--; // one cycle to get low
                     uint8_t low = mem[byte];
                     cycles--; // one cycle to get high
                     uint8_t high = mem[byte + 1];
                     cycles--; // read from addr
-                    A = mem[(low | (high << 8)) + Y];
+                    A = Bus::read( *this, (low | (high << 8)) + Y);
                     A_status_flags();
                 }
                 break;
             case INS::STA_ZP:
                 {
-                    uint8_t byte = readByte();
+                    uint8_t byte = fetch<Bus>();
                     cycles--; // write to memory
                     mem[byte] = A;
                 }
                 break;
             case INS::STA_ZP_X:
                 {
-                    uint8_t byte = readByte();
+                    uint8_t byte = fetch<Bus>();
                     cycles--; // read X
                     cycles--; // write to memory
                     mem[byte + X] = A;
@@ -387,33 +741,33 @@ void CPU::execute(int c)
                 break;
             case INS::STA_ABS:
                 {
-                    uint8_t low = readByte();
-                    uint8_t high = readByte();
+                    uint8_t low = fetch<Bus>();
+                    uint8_t high = fetch<Bus>();
                     cycles--; // set memory
-                    mem[( low | (high << 8))] = A;
+                    Bus::write( *this, ( low | (high << 8)), A);
                 }
                 break;
             case INS::STA_ABS_X:
                 {
-                    uint8_t low = readByte();
-                    uint8_t high = readByte();
+                    uint8_t low = fetch<Bus>();
+                    uint8_t high = fetch<Bus>();
                     cycles--; // read X
                     cycles--; // set memory
-                    mem[( low | (high << 8)) + X] = A;
+                    Bus::write( *this, ( low | (high << 8)) + X, A);
                 }
                 break;
             case INS::STA_ABS_Y:
                 {
-                    uint8_t low = readByte();
-                    uint8_t high = readByte();
+                    uint8_t low = fetch<Bus>();
+                    uint8_t high = fetch<Bus>();
                     cycles--; // read Y
                     cycles--; // set memory
-                    mem[( low | (high << 8)) + Y] = A;
+                    Bus::write( *this, ( low | (high << 8)) + Y, A);
                 }
                 break;
             case INS::STA_IND_X:
                 {
-                    uint8_t byte = readByte();
+                    uint8_t byte = fetch<Bus>();
                     // check if we need to handle ZP wrap
                     uint8_t offset = 0;
                     if ( byte+X+1 > 0xFF ) {
@@ -425,31 +779,31 @@ void CPU::execute(int c)
                     cycles--; // one cycle to get low
                     cycles--; // one cycle to get high
                     cycles--; // one cycle to bitshift
-                    mem[(low | (high << 8))] = A;
+                    Bus::write( *this, (low | (high << 8)), A);
                 }
                 break;
             case INS::STA_IND_Y:
                 {
-                    uint8_t byte = readByte();
+                    uint8_t byte = fetch<Bus>();
                     uint8_t low = mem[byte];
                     uint8_t high = mem[byte + 1];
                     cycles--; // one cycle to get low
                     cycles--; // one cycle to get high
                     cycles--; // read from addr
                     cycles--; // one cycle to bitshift
-                    mem[( low | (high << 8)) + Y] = A;
+                    Bus::write( *this, ( low | (high << 8)) + Y, A);
                 }
                 break;
             case INS::STX_ZP:
                 {
-                    uint8_t byte = readByte();
+                    uint8_t byte = fetch<Bus>();
                     cycles--; // write to memory
                     mem[byte] = X;
                 }
                 break;
             case INS::STX_ZP_Y:
                 {
-                    uint8_t byte = readByte();
+                    uint8_t byte = fetch<Bus>();
                     cycles--; // read Y
                     cycles--; // write to memory
                     mem[byte + Y] = X;
@@ -457,22 +811,22 @@ void CPU::execute(int c)
                 break;
             case INS::STX_ABS:
                 {
-                    uint8_t low = readByte();
-                    uint8_t high = readByte();
+                    uint8_t low = fetch<Bus>();
+                    uint8_t high = fetch<Bus>();
                     cycles--; // read X
-                    mem[( low | (high << 8))] = X;
+                    Bus::write( *this, ( low | (high << 8)), X);
                 }
                 break;
             case INS::STY_ZP:
                 {
-                    uint8_t byte = readByte();
+                    uint8_t byte = fetch<Bus>();
                     cycles--; // write to memory
                     mem[byte] = Y;
                 }
                 break;
             case INS::STY_ZP_X:
                 {
-                    uint8_t byte = readByte();
+                    uint8_t byte = fetch<Bus>();
                     cycles--; // read X
                     cycles--; // write to memory
                     mem[byte + X] = Y;
@@ -480,10 +834,10 @@ void CPU::execute(int c)
                 break;
             case INS::STY_ABS:
                 {
-                    uint8_t low = readByte();
-                    uint8_t high = readByte();
+                    uint8_t low = fetch<Bus>();
+                    uint8_t high = fetch<Bus>();
                     cycles--; // read Y
-                    mem[( low | (high << 8))] = Y;
+                    Bus::write( *this, ( low | (high << 8)), Y);
                 }
                 break;
             case INS::CLC_IM:
@@ -502,6 +856,9 @@ void CPU::execute(int c)
                 {
                     cycles--;
                     P.I = 0;
+                    if ( irq ) {
+                        scheduler.schedule( EVENT_INTERRUPT, clock() );
+                    }
                 }
                 break;
             case INS::CLV_IM:
@@ -547,7 +904,7 @@ void CPU::execute(int c)
             case INS::NOP_C2:
             case INS::NOP_E2:
                 {
-                    readByte();
+                    fetch<Bus>();
                 }
                 break;
                 // IGN a, 4 cycles
@@ -658,7 +1015,7 @@ void CPU::execute(int c)
                 break;
             case INS::DEC_ZP:
                 {
-                    uint8_t byte = readByte();
+                    uint8_t byte = fetch<Bus>();
                     cycles--; // get value from zero page
                     cycles--; // decrease value from zero page
                     cycles--; // set value to zero page
@@ -668,7 +1025,7 @@ void CPU::execute(int c)
                 break;
             case INS::DEC_ZP_X:
                 {
-                    uint8_t byte = readByte();
+                    uint8_t byte = fetch<Bus>();
                     cycles--; // add X to address
                     cycles--; // get value from zero page
                     cycles--; // decrease value from zero page
@@ -679,7 +1036,7 @@ void CPU::execute(int c)
                 break;
             case INS::INC_ZP:
                 {
-                    uint8_t byte = readByte();
+                    uint8_t byte = fetch<Bus>();
                     cycles--; // get value from zero page
                     cycles--; // increase value from zero page
                     cycles--; // set value to zero page
@@ -689,7 +1046,7 @@ void CPU::execute(int c)
                 break;
             case INS::INC_ZP_X:
                 {
-                    uint8_t byte = readByte();
+                    uint8_t byte = fetch<Bus>();
                     cycles--; // add X to address
                     cycles--; // get value from zero page
                     cycles--; // increase value from zero page
@@ -700,66 +1057,76 @@ void CPU::execute(int c)
                 break;
             case INS::DEC_ABS:
                 {
-                    uint8_t low = readByte();
-                    uint8_t high = readByte();
+                    uint8_t low = fetch<Bus>();
+                    uint8_t high = fetch<Bus>();
                     cycles--; // read value from low + high
                     cycles--; // increment value
                     cycles--; // set value to memory
-                    mem[( low | (high << 8))]--;
-                    M_status_flags(mem[( low | (high << 8))]);
+                    uint16_t addr = ( low | (high << 8));
+                    uint8_t M = Bus::read( *this, addr) - 1;
+                    Bus::write( *this, addr, M);
+                    M_status_flags(M);
                 }
                 break;
             case INS::DEC_ABS_X:
                 {
-                    uint8_t low = readByte();
-                    uint8_t high = readByte();
+                    uint8_t low = fetch<Bus>();
+                    uint8_t high = fetch<Bus>();
                     cycles--; // add X to addr
                     cycles--; // read value from low + high
                     cycles--; // decrease value
                     cycles--; // set value to memory
-                    A = mem[(low | (high << 8))+X]--;
-                    M_status_flags(mem[(low | (high << 8))+X]);
+                    uint16_t addr = (low | (high << 8))+X;
+                    uint8_t M = Bus::read( *this, addr);
+                    A = M--;
+                    Bus::write( *this, addr, M);
+                    M_status_flags(M);
                 }
                 break;
             case INS::INC_ABS:
                 {
-                    uint8_t low = readByte();
-                    uint8_t high = readByte();
+                    uint8_t low = fetch<Bus>();
+                    uint8_t high = fetch<Bus>();
                     cycles--; // read value from low + high
                     cycles--; // increment value
                     cycles--; // set value to memory
-                    mem[( low | (high << 8))]++;
-                    M_status_flags(mem[(low | (high << 8))]);
+                    uint16_t addr = ( low | (high << 8));
+                    uint8_t M = Bus::read( *this, addr) + 1;
+                    Bus::write( *this, addr, M);
+                    M_status_flags(M);
                 }
                 break;
             case INS::INC_ABS_X:
                 {
-                    uint8_t low = readByte();
-                    uint8_t high = readByte();
+                    uint8_t low = fetch<Bus>();
+                    uint8_t high = fetch<Bus>();
                     cycles--; // add X to addr
                     cycles--; // read value from low + high
                     cycles--; // increase value
                     cycles--; // set value to memory
-                    A = mem[(low | (high << 8))+X]++;
-                    M_status_flags(mem[(low | (high << 8))+X]);
+                    uint16_t addr = (low | (high << 8))+X;
+                    uint8_t M = Bus::read( *this, addr);
+                    A = M++;
+                    Bus::write( *this, addr, M);
+                    M_status_flags(M);
                 }
                 break;
             case INS::JMP_ABS:
                 {
-                    uint8_t low = readByte();
-                    uint8_t high = readByte();
+                    uint8_t low = fetch<Bus>();
+                    uint8_t high = fetch<Bus>();
                     PC = ( low | (high << 8));
                 }
                 break;
             case INS::JMP_IND:
                 {
-                    uint8_t low = readByte();
-                    uint8_t high = readByte();
-                    uint8_t low_real = mem[(low|(high << 8))];
+                    uint8_t low = fetch<Bus>();
+                    uint8_t high = fetch<Bus>();
+                    uint8_t low_real = Bus::read( *this, (low|(high << 8)));
                     if ( low == 0xFF ) { // fix for bug in original 6502, grab the xx00 high address if low is xxFF;
                         low = 0x0;
                     }
-                    uint8_t high_real = mem[(low|(high << 8))+1];
+                    uint8_t high_real = Bus::read( *this, (low|(high << 8))+1);
                     cycles--; // read byte from memory
                     cycles--; // read byte from memory
                     PC = ( low_real | (high_real << 8));
@@ -767,8 +1134,8 @@ void CPU::execute(int c)
                 break;
             case INS::JSR_ABS:
                 {
-                    uint8_t low = readByte();
-                    uint8_t high = readByte();
+                    uint8_t low = fetch<Bus>();
+                    uint8_t high = fetch<Bus>();
                     uint16_t last_addr = PC-1;
                     mem[0x100 + S--] = (last_addr >> 8);
                     mem[0x100 + S--] = (last_addr & 0xFF);
@@ -801,6 +1168,9 @@ void CPU::execute(int c)
                     uint8_t low = mem[0x100 + ++S];
                     uint8_t high = mem[0x100 + ++S];
                     PC = ( low | (high << 8));
+                    if ( irq ) {
+                        scheduler.schedule( EVENT_INTERRUPT, clock() );
+                    }
                 }
                 break;
             case INS::PHA_IMP:
@@ -832,46 +1202,49 @@ void CPU::execute(int c)
                     cycles--; // read from stack
                     cycles--; // set statusregister to value
                     setStatusBits(mem[0x100 + ++S]);
+                    if ( irq ) {
+                        scheduler.schedule( EVENT_INTERRUPT, clock() );
+                    }
                 }
                 break;
             case INS::BCC_REL: // Carry Clear
                 {
-                    branchInstruction( P.C == 0 );
+                    branchInstruction<Bus>( P.C == 0 );
                 }
                 break;
             case INS::BCS_REL: // Carry Set
                 {
-                    branchInstruction( P.C == 1 );
+                    branchInstruction<Bus>( P.C == 1 );
                 }
                 break;
             case INS::BEQ_REL: // Equal
                 {
-                    branchInstruction( P.Z == 1 );
+                    branchInstruction<Bus>( P.Z == 1 );
                 }
                 break;
             case INS::BMI_REL: // If minus
                 {
-                    branchInstruction( P.N == 1 );
+                    branchInstruction<Bus>( P.N == 1 );
                 }
                 break;
             case INS::BNE_REL: // Not equal
                 {
-                    branchInstruction( P.Z == 0 );
+                    branchInstruction<Bus>( P.Z == 0 );
                 }
                 break;
             case INS::BPL_REL: // If positive
                 {
-                    branchInstruction( P.N == 0 );
+                    branchInstruction<Bus>( P.N == 0 );
                 }
                 break;
             case INS::BVC_REL: // Overflow clear
                 {
-                    branchInstruction( P.V == 0 );
+                    branchInstruction<Bus>( P.V == 0 );
                 }
                 break;
             case INS::BVS_REL: // Overflow set
                 {
-                    branchInstruction( P.V == 1 );
+                    branchInstruction<Bus>( P.V == 1 );
                 }
                 break;
             case INS::BRK_IMP:
@@ -885,7 +1258,7 @@ void CPU::execute(int c)
                     cycles--; // 0xFFFE to PC
                     cycles--; // 0xFFFF to PC
                     cycles--; // Break flag to 1
-                    PC = ( mem[0xFFFE] | (mem[0xFFFF] << 8));
+                    PC = ( Bus::read( *this, 0xFFFE) | (Bus::read( *this, 0xFFFF) << 8));
                     P.B = 1;
                 }
                 break;
@@ -917,7 +1290,7 @@ void CPU::execute(int c)
             case INS::ROL_ZP:
             case INS::ROR_ZP:
                 {
-                    uint8_t byte = readByte();
+                    uint8_t byte = fetch<Bus>();
                     uint8_t oldC = P.C;
                     cycles--; // get value from zero page
                     cycles--; // bitshift left
@@ -943,7 +1316,7 @@ void CPU::execute(int c)
             case INS::ROL_ZP_X:
             case INS::ROR_ZP_X:
                 {
-                    uint8_t byte = readByte()+X;
+                    uint8_t byte = fetch<Bus>()+X;
                     uint8_t oldC = P.C;
                     cycles--; // add X to address
                     cycles--; // get value from memory
@@ -970,27 +1343,29 @@ void CPU::execute(int c)
             case INS::ROL_ABS:
             case INS::ROR_ABS:
                 {
-                    uint8_t low = readByte();
-                    uint8_t high = readByte();
+                    uint8_t low = fetch<Bus>();
+                    uint8_t high = fetch<Bus>();
                     uint16_t addr = (low|(high << 8));
+                    uint8_t M = Bus::read( *this, addr);
                     uint8_t oldC = P.C;
                     cycles--; // get value from memory
                     cycles--; // bitshift left
                     cycles--; // set value to memory
                     if ( ins == INS::ASL_ABS ) {
-                        P.C = ( mem[addr] & 0x80 ) != 0;
-                        mem[addr] = mem[addr] << 1;
+                        P.C = ( M & 0x80 ) != 0;
+                        M = M << 1;
                     } else if ( ins == INS::LSR_ABS ) {
-                        P.C = ( mem[addr] & 0x1 ) != 0;
-                        mem[addr] = mem[addr] >> 1;
+                        P.C = ( M & 0x1 ) != 0;
+                        M = M >> 1;
                     } else if ( ins == INS::ROL_ABS ) {
-                        P.C = ( mem[addr] & 0x80 ) != 0;
-                        mem[addr] = (mem[addr] << 1)|oldC;
+                        P.C = ( M & 0x80 ) != 0;
+                        M = (M << 1)|oldC;
                     } else if ( ins == INS::ROR_ABS ) {
-                        P.C = ( mem[addr] & 0x1 ) != 0;
-                        mem[addr] = (mem[addr] >> 1)|(oldC << 7);
+                        P.C = ( M & 0x1 ) != 0;
+                        M = (M >> 1)|(oldC << 7);
                     }
-                    M_status_flags(mem[addr]);
+                    Bus::write( *this, addr, M);
+                    M_status_flags(M);
                 }
                 break;
             case INS::ASL_ABS_X:
@@ -998,28 +1373,30 @@ void CPU::execute(int c)
             case INS::ROL_ABS_X:
             case INS::ROR_ABS_X:
                 {
-                    uint8_t low = readByte();
-                    uint8_t high = readByte();
+                    uint8_t low = fetch<Bus>();
+                    uint8_t high = fetch<Bus>();
                     uint16_t addr = (low|(high << 8))+X;
+                    uint8_t M = Bus::read( *this, addr);
                     uint8_t oldC = P.C;
                     cycles--; // add X to address
                     cycles--; // get value from memory
                     cycles--; // bitshift left
                     cycles--; // set value to memory
                     if ( ins == INS::ASL_ABS_X ) {
-                        P.C = ( mem[addr] & 0x80 ) != 0;
-                        mem[addr] = mem[addr] << 1;
+                        P.C = ( M & 0x80 ) != 0;
+                        M = M << 1;
                     } else if ( ins == INS::LSR_ABS_X ) {
-                        P.C = ( mem[addr] & 0x1 ) != 0;
-                        mem[addr] = mem[addr] >> 1;
+                        P.C = ( M & 0x1 ) != 0;
+                        M = M >> 1;
                     } else if ( ins == INS::ROL_ABS_X ) {
-                        P.C = ( mem[addr] & 0x80 ) != 0;
-                        mem[addr] = (mem[addr] << 1)|oldC;
+                        P.C = ( M & 0x80 ) != 0;
+                        M = (M << 1)|oldC;
                     } else if ( ins == INS::ROR_ABS_X ) {
-                        P.C = ( mem[addr] & 0x1 ) != 0;
-                        mem[addr] = (mem[addr] >> 1)|(oldC << 7);
+                        P.C = ( M & 0x1 ) != 0;
+                        M = (M >> 1)|(oldC << 7);
                     }
-                    M_status_flags(mem[addr]);
+                    Bus::write( *this, addr, M);
+                    M_status_flags(M);
                 }
                 break;
 
@@ -1029,7 +1406,7 @@ void CPU::execute(int c)
             case INS::ORA_IM:
             case INS::EOR_IM:
                 {
-                    uint8_t byte = readByte();
+                    uint8_t byte = fetch<Bus>();
                     uint8_t oldCarry = P.C;
                     uint8_t newA = 0x0;
                     if ( ins == INS::ADC_IM ) {
@@ -1055,7 +1432,7 @@ void CPU::execute(int c)
             case INS::ORA_ZP:
             case INS::EOR_ZP:
                 {
-                    uint8_t addr = readByte();
+                    uint8_t addr = fetch<Bus>();
                     uint8_t oldCarry = P.C;
                     uint8_t newA = 0x0;
                     if ( ins == INS::ADC_ZP ) {
@@ -1082,7 +1459,7 @@ void CPU::execute(int c)
             case INS::ORA_ZP_X:
             case INS::EOR_ZP_X:
                 {
-                    uint8_t addr = readByte()+X;
+                    uint8_t addr = fetch<Bus>()+X;
                     uint8_t oldCarry = P.C;
                     uint8_t newA = 0x0;
                     if ( ins == INS::ADC_ZP_X ) {
@@ -1110,23 +1487,24 @@ void CPU::execute(int c)
             case INS::ORA_ABS:
             case INS::EOR_ABS:
                 {
-                    uint8_t low = readByte();
-                    uint8_t high = readByte();
+                    uint8_t low = fetch<Bus>();
+                    uint8_t high = fetch<Bus>();
                     uint16_t addr = (low|high << 8);
+                    uint8_t M = Bus::read( *this, addr);
                     uint8_t oldCarry = P.C;
                     uint8_t newA = 0x0;
                     if ( ins == INS::ADC_ABS ) {
-                        P.C = ((A+mem[addr]+P.C) & 0x100) != 0;
-                        newA = A + mem[addr] + oldCarry;
+                        P.C = ((A+M+P.C) & 0x100) != 0;
+                        newA = A + M + oldCarry;
                     } else if ( ins == INS::SBC_ABS ) {
-                        newA = A - mem[addr] - (1-oldCarry);
+                        newA = A - M - (1-oldCarry);
                         P.C = (A >= newA);
                     } else if ( ins == INS::AND_ABS ) {
-                        newA = A & mem[addr];
+                        newA = A & M;
                     } else if ( ins == INS::ORA_ABS ) {
-                        newA = A | mem[addr];
+                        newA = A | M;
                     } else if ( ins == INS::EOR_ABS ) {
-                        newA = A ^ mem[addr];
+                        newA = A ^ M;
                     }
                     A = newA;
                     cycles--; // read from memory
@@ -1139,23 +1517,24 @@ void CPU::execute(int c)
             case INS::ORA_ABS_X:
             case INS::EOR_ABS_X:
                 {
-                    uint8_t low = readByte();
-                    uint8_t high = readByte();
+                    uint8_t low = fetch<Bus>();
+                    uint8_t high = fetch<Bus>();
                     uint16_t addr = (low|high << 8)+X;
+                    uint8_t M = Bus::read( *this, addr);
                     uint8_t oldCarry = P.C;
                     uint8_t newA = 0x0;
                     if ( ins == INS::ADC_ABS_X ) {
-                        P.C = ((A+mem[addr]+P.C) & 0x100) != 0;
-                        newA = A + mem[addr] + oldCarry;
+                        P.C = ((A+M+P.C) & 0x100) != 0;
+                        newA = A + M + oldCarry;
                     } else if ( ins == INS::SBC_ABS_X ) {
-                        newA = A - mem[addr] - (1-oldCarry);
+                        newA = A - M - (1-oldCarry);
                         P.C = (A >= newA);
                     } else if ( ins == INS::AND_ABS_X ) {
-                        newA = A & mem[addr];
+                        newA = A & M;
                     } else if ( ins == INS::ORA_ABS_X ) {
-                        newA = A | mem[addr];
+                        newA = A | M;
                     } else if ( ins == INS::EOR_ABS_X ) {
-                        newA = A ^ mem[addr];
+                        newA = A ^ M;
                     }
                     A = newA;
                     cycles--; // read from memory
@@ -1171,23 +1550,24 @@ void CPU::execute(int c)
             case INS::ORA_ABS_Y:
             case INS::EOR_ABS_Y:
                 {
-                    uint8_t low = readByte();
-                    uint8_t high = readByte();
+                    uint8_t low = fetch<Bus>();
+                    uint8_t high = fetch<Bus>();
                     uint16_t addr = (low|high << 8)+Y;
+                    uint8_t M = Bus::read( *this, addr);
                     uint8_t oldCarry = P.C;
                     uint8_t newA = 0x0;
                     if ( ins == INS::ADC_ABS_Y ) {
-                        P.C = ((A+mem[addr]+P.C) & 0x100) != 0;
-                        newA = A + mem[addr] + oldCarry;
+                        P.C = ((A+M+P.C) & 0x100) != 0;
+                        newA = A + M + oldCarry;
                     } else if ( ins == INS::SBC_ABS_Y ) {
-                        newA = A - mem[addr] - (1-oldCarry);
+                        newA = A - M - (1-oldCarry);
                         P.C = (A >= newA);
                     } else if ( ins == INS::AND_ABS_Y ) {
-                        newA = A & mem[addr];
+                        newA = A & M;
                     } else if ( ins == INS::ORA_ABS_Y ) {
-                        newA = A | mem[addr];
+                        newA = A | M;
                     } else if ( ins == INS::EOR_ABS_Y ) {
-                        newA = A ^ mem[addr];
+                        newA = A ^ M;
                     }
                     A = newA;
                     cycles--; // read from memory
@@ -1204,10 +1584,11 @@ void CPU::execute(int c)
             case INS::EOR_IND_X:
                 {
                     // Use this IND X for all others!
-                    uint8_t byte = readByte()+X;
+                    uint8_t byte = fetch<Bus>()+X;
                     uint8_t low = mem[byte];
                     uint8_t high = mem[uint8_t(byte+1)];
                     uint16_t addr = (low|high << 8);
+                    uint8_t M = Bus::read( *this, addr);
                     uint8_t oldCarry = P.C;
                     uint8_t newA = 0x0;
                     cycles--; // one cycle to get low
@@ -1215,17 +1596,17 @@ void CPU::execute(int c)
                     cycles--; // one cycle to bitshift
                     cycles--; // read from memory
                     if ( ins == INS::ADC_IND_X ) {
-                        P.C = ((A+mem[addr]+P.C) & 0x100) != 0;
-                        newA = A + mem[addr] + oldCarry;
+                        P.C = ((A+M+P.C) & 0x100) != 0;
+                        newA = A + M + oldCarry;
                     } else if ( ins == INS::SBC_IND_X ) {
-                        newA = A - mem[addr] - (1-oldCarry);
+                        newA = A - M - (1-oldCarry);
                         P.C = (A >= newA);
                     } else if ( ins == INS::AND_IND_X ) {
-                        newA = A & mem[addr];
+                        newA = A & M;
                     } else if ( ins == INS::ORA_IND_X ) {
-                        newA = A | mem[addr];
+                        newA = A | M;
                     } else if ( ins == INS::EOR_IND_X ) {
-                        newA = A ^ mem[addr];
+                        newA = A ^ M;
                     }
                     A = newA;
                     A_status_flags();
@@ -1237,10 +1618,11 @@ void CPU::execute(int c)
             case INS::ORA_IND_Y:
             case INS::EOR_IND_Y:
                 {
-                    uint8_t byte = readByte();
+                    uint8_t byte = fetch<Bus>();
                     uint8_t low = mem[byte];
                     uint8_t high = mem[uint8_t(byte+1)];
                     uint16_t addr = (low|high << 8)+Y;
+                    uint8_t M = Bus::read( *this, addr);
                     uint8_t oldCarry = P.C;
                     uint8_t newA = 0x0;
                     cycles--; // one cycle to get low
@@ -1250,17 +1632,17 @@ void CPU::execute(int c)
                         cycles--; // extra for page break
                     }
                     if ( ins == INS::ADC_IND_Y ) {
-                        P.C = ((A+mem[addr]+P.C) & 0x100) != 0;
-                        newA = A + mem[addr] + oldCarry;
+                        P.C = ((A+M+P.C) & 0x100) != 0;
+                        newA = A + M + oldCarry;
                     } else if ( ins == INS::SBC_IND_Y ) {
-                        newA = A - mem[addr] - (1-oldCarry);
+                        newA = A - M - (1-oldCarry);
                         P.C = (A >= newA);
                     } else if ( ins == INS::AND_IND_Y ) {
-                        newA = A & mem[addr];
+                        newA = A & M;
                     } else if ( ins == INS::ORA_IND_Y ) {
-                        newA = A | mem[addr];
+                        newA = A | M;
                     } else if ( ins == INS::EOR_IND_Y ) {
-                        newA = A ^ mem[addr];
+                        newA = A ^ M;
                     }
                     A = newA;
                     A_status_flags();
@@ -1269,14 +1651,14 @@ void CPU::execute(int c)
 
             case INS::CMP_IM:
                 {
-                    uint8_t byte = readByte();
+                    uint8_t byte = fetch<Bus>();
                     P.C = (A >= byte) ? 1 : 0;
                     P.Z = (A == byte) ? 1 : 0;
                 }
                 break;
             case INS::CMP_ZP:
                 {
-                    uint8_t addr = readByte();
+                    uint8_t addr = fetch<Bus>();
                     cycles--; // read from memory
                     P.C = (A >= mem[addr]) ? 1 : 0;
                     P.Z = (A == mem[addr]) ? 1 : 0;
@@ -1284,7 +1666,7 @@ void CPU::execute(int c)
                 break;
             case INS::CMP_ZP_X:
                 {
-                    uint8_t addr = readByte()+X;
+                    uint8_t addr = fetch<Bus>()+X;
                     cycles--; // read from memory
                     cycles--; // read from X
                     P.C = (A >= mem[addr]) ? 1 : 0;
@@ -1293,75 +1675,80 @@ void CPU::execute(int c)
                 break;
             case INS::CMP_ABS:
                 {
-                    uint8_t low = readByte();
-                    uint8_t high = readByte();
+                    uint8_t low = fetch<Bus>();
+                    uint8_t high = fetch<Bus>();
                     uint16_t addr = (low|high << 8);
+                    uint8_t M = Bus::read( *this, addr);
                     cycles--; // read from memory
-                    P.C = (A >= mem[addr]) ? 1 : 0;
-                    P.Z = (A == mem[addr]) ? 1 : 0;
+                    P.C = (A >= M) ? 1 : 0;
+                    P.Z = (A == M) ? 1 : 0;
                 }
                 break;
             case INS::CMP_ABS_X:
                 {
-                    uint8_t low = readByte();
-                    uint8_t high = readByte();
+                    uint8_t low = fetch<Bus>();
+                    uint8_t high = fetch<Bus>();
                     uint16_t addr = (low|high << 8)+X;
+                    uint8_t M = Bus::read( *this, addr);
                     cycles--; // read from memory
                     if ( (addr >> 8) != ((addr-X) >> 8) ) {
                         cycles--; // extra for page break
                     }
-                    P.C = (A >= mem[addr]) ? 1 : 0;
-                    P.Z = (A == mem[addr]) ? 1 : 0;
+                    P.C = (A >= M) ? 1 : 0;
+                    P.Z = (A == M) ? 1 : 0;
                 }
                 break;
             case INS::CMP_ABS_Y:
                 {
-                    uint8_t low = readByte();
-                    uint8_t high = readByte();
+                    uint8_t low = fetch<Bus>();
+                    uint8_t high = fetch<Bus>();
                     uint16_t addr = (low|high << 8)+Y;
+                    uint8_t M = Bus::read( *this, addr);
                     cycles--; // read from memory
                     if ( (addr >> 8) != ((addr-Y) >> 8) ) {
                         cycles--; // extra for page break
                     }
-                    P.C = (A >= mem[addr]) ? 1 : 0;
-                    P.Z = (A == mem[addr]) ? 1 : 0;
+                    P.C = (A >= M) ? 1 : 0;
+                    P.Z = (A == M) ? 1 : 0;
                 }
                 break;
             case INS::CMP_IND_X:
                 {
                     // Use this IND X for all others!
-                    uint8_t byte = readByte()+X;
+                    uint8_t byte = fetch<Bus>()+X;
                     uint8_t low = mem[byte];
                     uint8_t high = mem[uint8_t(byte+1)];
                     uint16_t addr = (low|high << 8);
+                    uint8_t M = Bus::read( *this, addr);
                     cycles--; // one cycle to get low
                     cycles--; // one cycle to get high
                     cycles--; // one cycle to bitshift
                     cycles--; // read from memory
-                    P.C = (A >= mem[addr]) ? 1 : 0;
-                    P.Z = (A == mem[addr]) ? 1 : 0;
+                    P.C = (A >= M) ? 1 : 0;
+                    P.Z = (A == M) ? 1 : 0;
                 }
                 break;
             case INS::CMP_IND_Y:
                 {
-                    uint8_t byte = readByte();
+                    uint8_t byte = fetch<Bus>();
                     uint8_t low = mem[byte];
                     uint8_t high = mem[uint8_t(byte+1)];
                     uint16_t addr = (low|high << 8)+Y;
+                    uint8_t M = Bus::read( *this, addr);
                     cycles--; // one cycle to get low
                     cycles--; // one cycle to get high
                     cycles--; // read from addr
                     if ( (addr >> 8) != ((addr-Y) >> 8) ) {
                         cycles--; // extra for page break
                     }
-                    P.C = (A >= mem[addr]) ? 1 : 0;
-                    P.Z = (A == mem[addr]) ? 1 : 0;
+                    P.C = (A >= M) ? 1 : 0;
+                    P.Z = (A == M) ? 1 : 0;
                 }
                 break;
             case INS::CPX_IM:
             case INS::CPY_IM:
                 {
-                    uint8_t byte = readByte();
+                    uint8_t byte = fetch<Bus>();
                     uint8_t val = 0x0;
                     if ( ins == INS::CPX_IM ) {
                         val = X;
@@ -1375,7 +1762,7 @@ void CPU::execute(int c)
             case INS::CPX_ZP:
             case INS::CPY_ZP:
                 {
-                    uint8_t addr = readByte();
+                    uint8_t addr = fetch<Bus>();
                     uint8_t val = 0x0;
                     if ( ins == INS::CPX_ZP ) {
                         val = X;
@@ -1390,9 +1777,10 @@ void CPU::execute(int c)
             case INS::CPX_ABS:
             case INS::CPY_ABS:
                 {
-                    uint8_t low = readByte();
-                    uint8_t high = readByte();
+                    uint8_t low = fetch<Bus>();
+                    uint8_t high = fetch<Bus>();
                     uint16_t addr = (low|high << 8);
+                    uint8_t M = Bus::read( *this, addr);
                     uint8_t val = 0x0;
                     if ( ins == INS::CPX_ABS ) {
                         val = X;
@@ -1400,13 +1788,13 @@ void CPU::execute(int c)
                         val = Y;
                     }
                     cycles--; // read from memory
-                    P.C = (val >= mem[addr]) ? 1 : 0;
-                    P.Z = (val == mem[addr]) ? 1 : 0;
+                    P.C = (val >= M) ? 1 : 0;
+                    P.Z = (val == M) ? 1 : 0;
                 }
                 break;
             case INS::BIT_ZP:
                 {
-                    uint8_t addr = readByte();
+                    uint8_t addr = fetch<Bus>();
                     uint8_t val = A & mem[addr];
                     P.Z = (val == 0);
                     P.V = ((mem[addr] >> 6) & 0x1);
@@ -1416,18 +1804,19 @@ void CPU::execute(int c)
                 break;
             case INS::BIT_ABS:
                 {
-                    uint8_t low = readByte();
-                    uint8_t high = readByte();
+                    uint8_t low = fetch<Bus>();
+                    uint8_t high = fetch<Bus>();
                     uint16_t addr = (low|high << 8);
-                    uint8_t val = A & mem[addr];
+                    uint8_t M = Bus::read( *this, addr);
+                    uint8_t val = A & M;
                     P.Z = (val == 0);
-                    P.V = (mem[addr] >> 6) & 0x1;
-                    P.N = (mem[addr] >> 7) & 0x1;
+                    P.V = (M >> 6) & 0x1;
+                    P.N = (M >> 7) & 0x1;
                     cycles--; // read from memory
                 }
                 break;
             default:
-                printf("Unhandled instruction: 0x%x\n", ins);
+                fprintf(stderr,"Unhandled instruction: 0x%x\n", ins);
                 exception = true;
                 dumpRegister();
                 break;
@@ -5,19 +5,80 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <fstream>
+#include <vector>
+#include <memory>
+#include <zlib.h>
+#include "ines.h"
+#include "hash.h"
+#include "romdb.h"
+#include "rompack.h"
+#include "patch.h"
+#include "scheduler.h"
+#include "savefile.h"
+#include "ppu.h"
+#include "apu.h"
 
 #define MEM_SIZE 0x10000
 
+// the CPU address space is mapped in 2KB pages, the size of internal RAM and its mirrors
+#define BUS_PAGE_SHIFT 11
+#define BUS_PAGE_SIZE (1 << BUS_PAGE_SHIFT)
+#define BUS_PAGES (MEM_SIZE >> BUS_PAGE_SHIFT)
+
+// bus accessors sit inside the big interpreter switch where gcc stops inlining on its own
+#define BUS_INLINE inline __attribute__((always_inline))
+
+// IRQ sources, the line is held while any is asserted
+#define IRQ_MAPPER 0x01
+#define IRQ_FRAME 0x02 // APU frame counter
+#define IRQ_DMC 0x04
+
+struct Mapper;
+
 struct CPU
 {
+    // with a cartridge $0000-$07FF is RAM and $8000-$FFFF a copy of the mapped PRG banks
     uint8_t mem[MEM_SIZE];
     uint16_t PC; // program counter
     uint8_t S; // stack pointer
 
     int cycles;
+    uint64_t sliceEnd; // clock() when cycles reaches 0
+
+    Scheduler scheduler;
+    uint8_t irq; // asserted IRQ sources
+    bool nmi;
+
+    PPU ppu;
+    APU apu;
+    uint64_t oamDmaStart; // clock() span of the last OAM DMA
+    uint64_t oamDmaEnd;
 
     bool exception; // flag only used for unit tests
 
+    // cartridge, header is corrected from romdb when the dump is known
+    INESHeader header;
+    const uint8_t *prgrom; // points into romdata or into a mapped RomPack
+    const uint8_t *chrrom;
+    std::vector<uint8_t> romdata; // image read by loadNESFile
+    PatchedImage patched; // image of the last patched load, shared with the patch cache
+    uint32_t romcrc; // CRC-32 of PRG+CHR
+    uint8_t romsha1[SHA1_DIGEST_SIZE];
+    RomDatabase *romdb = NULL;
+    SaveFile save; // PRG-RAM of battery backed cartridges
+
+    // bus, every page points at the memory backing it. A NULL page is handled by busRead/busWrite,
+    // without a cartridge all pages point straight into mem
+    const uint8_t *readMap[BUS_PAGES];
+    uint8_t *writeMap[BUS_PAGES];
+    std::unique_ptr<Mapper> mapper;
+
+    // interpreter loop instantiated for the current bus, see bus.h
+    void (CPU::*executor)( int );
+
+    CPU();
+    ~CPU();
+
     // Processor status bits
     struct {
         uint8_t N : 1; // negative, bit 7
@@ -35,19 +96,86 @@ struct CPU
     uint8_t Y; // Y register
 
 
-    void branchInstruction( bool takeBranch );
+    template<class Bus> void branchInstruction( bool takeBranch );
 
     void setStatusBits( uint8_t byte );
 
     uint8_t getStatusByte();
 
+    // file may be gzip compressed
     bool loadNESFile( std::string file );
+    // apply an IPS or BPS patch to file in memory and load the result
+    bool loadNESFile( std::string file, std::string patch );
+    // load an image by file name or PRG+CHR CRC-32 from an open pack, the pack must stay open
+    bool loadFromPack( const RomPack &pack, std::string name );
+    bool loadFromPack( const RomPack &pack, uint32_t crc );
+    bool loadNESImage( const uint8_t *data, size_t size, std::string name );
     void reset();
     void powerOn( uint16_t PC_Addr = 0x0 );
 
+    // CPU cycles since power on, valid inside and between execute calls
+    inline uint64_t clock() const
+    {
+        return sliceEnd - cycles;
+    }
+
+    void setIRQ( uint8_t source, bool asserted );
+
+    // run due events and take a pending interrupt, called between instructions
+    void serviceEvents();
+
+    // push PC and P and jump through vector
+    void interrupt( uint16_t vector );
+
+    // $4014 write, copy page to OAM and halt the CPU for the transfer
+    void oamDma( uint8_t page );
+
+    // DMC sample fetch at time, halts the CPU and returns the byte
+    uint8_t dmcRead( uint16_t addr, uint64_t time );
+
+    BUS_INLINE uint8_t read( uint16_t addr )
+    {
+        const uint8_t *page = readMap[addr >> BUS_PAGE_SHIFT];
+        if ( page != NULL ) {
+            return page[addr & (BUS_PAGE_SIZE - 1)];
+        }
+        return busRead( addr );
+    }
+
+    BUS_INLINE void write( uint16_t addr, uint8_t val )
+    {
+        uint8_t *page = writeMap[addr >> BUS_PAGE_SHIFT];
+        if ( page != NULL ) {
+            page[addr & (BUS_PAGE_SIZE - 1)] = val;
+            return;
+        }
+        busWrite( addr, val );
+    }
+
+    uint8_t busRead( uint16_t addr );
+    void busWrite( uint16_t addr, uint8_t val );
+
+    // map all pages straight into mem and drop the cartridge
+    void mapFlat();
+
+    // map RAM mirrors and let the mapper handle $8000-$FFFF
+    void mapCartridge();
+
+    // pick the interpreter loop matching mapper
+    void selectExecutor();
+
     // read one byte from mem and increment program counter
     uint8_t readByte();
 
+    template<class Bus> BUS_INLINE uint8_t fetch()
+    {
+        cycles--;
+        return Bus::fetch( *this, PC++ );
+    }
+
+    // one instruction through the page tables, for code Bus::fetch cannot read
+    void stepPaged();
+
     // dump memory at address + 20 bytes
     void dumpMemory( uint16_t addr, uint8_t length = 40 );
 
@@ -62,7 +190,12 @@ struct CPU
     void Y_status_flags();
     void M_status_flags( uint8_t M );
 
-    void execute(int c);
+    void execute(int c)
+    {
+        (this->*executor)( c );
+    }
+
+    template<class Bus> void run( int c );
 };
 
 enum INS
@@ -0,0 +1,755 @@
+#include "apu.h"
+#include "6502.h"
+#include <math.h>
+#include <string.h>
+#include <algorithm>
+
+// linear approximation of the 2A03 mixer, one output step of each channel.
+// Everything at full volume stays a little under the int16 range
+#define APU_PULSE_UNIT 246
+#define APU_TRIANGLE_UNIT 279
+#define APU_NOISE_UNIT 162
+#define APU_DMC_UNIT 110
+
+static const uint8_t lengthTable[32] = {
+    10, 254, 20, 2, 40, 4, 80, 6, 160, 8, 60, 10, 14, 12, 26, 14,
+    12, 16, 24, 18, 48, 20, 96, 22, 192, 24, 72, 26, 16, 28, 32, 30,
+};
+
+static const uint8_t dutyTable[4][8] = {
+    { 0, 1, 0, 0, 0, 0, 0, 0 },
+    { 0, 1, 1, 0, 0, 0, 0, 0 },
+    { 0, 1, 1, 1, 1, 0, 0, 0 },
+    { 1, 0, 0, 1, 1, 1, 1, 1 },
+};
+
+static const uint8_t triangleSequence[32] = {
+    15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0,
+    0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15,
+};
+
+// NTSC, in CPU cycles
+static const uint16_t noisePeriods[16] = {
+    4, 8, 16, 32, 64, 96, 128, 160, 202, 254, 380, 508, 762, 1016, 2034, 4068,
+};
+
+static const uint16_t dmcRates[16] = {
+    428, 380, 340, 320, 286, 254, 226, 214, 190, 160, 142, 128, 106, 84, 72, 54,
+};
+
+// frame sequencer steps in CPU cycles after the sequence started, 4 and 5 step mode
+static const uint32_t frameSteps[2][4] = {
+    { 7457, 14913, 22371, 29829 },
+    { 7457, 14913, 22371, 37281 },
+};
+static const uint32_t framePeriods[2] = { 29830, 37282 };
+
+// Band-limited impulse for each phase: a Blackman windowed sinc cut off a
+// little below half the sample rate, centred BLIP_TAPS / 2 samples late.
+// Every phase adds up to exactly 1 << BLIP_DELTA_BITS so steps do not drift.
+struct BlipKernel
+{
+    int16_t taps[BLIP_PHASES][BLIP_TAPS];
+
+    BlipKernel()
+    {
+        const double cutoff = 0.9; // of half the sample rate
+        for ( int p = 0; p < BLIP_PHASES; p++ ) {
+            double weights[BLIP_TAPS];
+            double sum = 0;
+            for ( int k = 0; k < BLIP_TAPS; k++ ) {
+                double x = k - BLIP_TAPS / 2 - (double)p / BLIP_PHASES;
+                double sinc = x == 0 ? 1.0 : sin( M_PI * cutoff * x ) / ( M_PI * cutoff * x );
+                double window = 0.42 + 0.5 * cos( M_PI * x / ( BLIP_TAPS / 2 ) ) + 0.08 * cos( 2 * M_PI * x / ( BLIP_TAPS / 2 ) );
+                weights[k] = fabs( x ) < BLIP_TAPS / 2 ? sinc * window : 0;
+                sum += weights[k];
+            }
+            int total = 0;
+            int largest = 0;
+            for ( int k = 0; k < BLIP_TAPS; k++ ) {
+                taps[p][k] = (int16_t)lround( weights[k] / sum * ( 1 << BLIP_DELTA_BITS ) );
+                total += taps[p][k];
+                if ( taps[p][k] > taps[p][largest] ) {
+                    largest = k;
+                }
+            }
+            taps[p][largest] += ( 1 << BLIP_DELTA_BITS ) - total;
+        }
+    }
+};
+
+static const BlipKernel kernel;
+
+BlipBuffer::BlipBuffer( int capacity )
+    : buffer( capacity + BLIP_TAPS )
+{
+    setRates( APU_CLOCK_RATE, APU_SAMPLE_RATE );
+}
+
+void BlipBuffer::setRates( double clockRate, double sampleRate )
+{
+    factor = (uint64_t)( sampleRate / clockRate * ( (uint64_t)1 << BLIP_TIME_BITS ) + 0.5 );
+    clear();
+}
+
+void BlipBuffer::clear()
+{
+    // half a sample in, so a clock lands on the sample it is nearest to
+    offset = factor / 2;
+    avail = 0;
+    integrator = 0;
+    std::fill( buffer.begin(), buffer.end(), 0 );
+}
+
+void BlipBuffer::addDelta( uint32_t time, int delta )
+{
+    uint64_t fixed = time * factor + offset;
+    int32_t *out = &buffer[fixed >> BLIP_TIME_BITS];
+    const int16_t *taps = kernel.taps[( fixed >> ( BLIP_TIME_BITS - BLIP_PHASE_BITS ) ) & ( BLIP_PHASES - 1 )];
+    for ( int k = 0; k < BLIP_TAPS; k++ ) {
+        out[k] += delta * taps[k];
+    }
+}
+
+void BlipBuffer::endFrame( uint32_t time )
+{
+    offset += time * factor;
+    avail = offset >> BLIP_TIME_BITS;
+}
+
+int BlipBuffer::readSamples( int16_t *out, int count )
+{
+    if ( count > avail ) {
+        count = avail;
+    }
+    int32_t sum = integrator;
+    for ( int i = 0; i < count; i++ ) {
+        int32_t sample = sum >> BLIP_DELTA_BITS;
+        sum += buffer[i];
+        if ( sample < -32768 ) {
+            sample = -32768;
+        } else if ( sample > 32767 ) {
+            sample = 32767;
+        }
+        if ( out != NULL ) {
+            out[i] = sample;
+        }
+        sum -= sample << ( BLIP_DELTA_BITS - BLIP_BASS_SHIFT );
+    }
+    integrator = sum;
+    // the samples still taking deltas move to the front
+    int left = avail - count + BLIP_TAPS;
+    memmove( &buffer[0], &buffer[count], left * sizeof( int32_t ) );
+    memset( &buffer[left], 0, count * sizeof( int32_t ) );
+    avail -= count;
+    offset -= (uint64_t)count << BLIP_TIME_BITS;
+    return count;
+}
+
+void Envelope::clock()
+{
+    if ( start ) {
+        start = false;
+        decay = 15;
+        divider = volume;
+    } else if ( divider > 0 ) {
+        divider--;
+    } else {
+        divider = volume;
+        if ( decay > 0 ) {
+            decay--;
+        } else if ( loop ) {
+            decay = 15;
+        }
+    }
+}
+
+int Pulse::sweepTarget( int channel ) const
+{
+    int change = timer >> sweepShift;
+    if ( sweepNegate ) {
+        return timer - change - ( channel == 0 ? 1 : 0 );
+    }
+    return timer + change;
+}
+
+bool Pulse::muted( int channel ) const
+{
+    return timer < 8 || sweepTarget( channel ) > 0x7FF;
+}
+
+APU::APU( CPU &cpu )
+    : cpu( cpu ), blip( APU_SAMPLE_BUFFER + (int64_t)APU_BLIP_CYCLES * APU_SAMPLE_RATE / APU_CLOCK_RATE + 1 )
+{
+    unit[0] = APU_PULSE_UNIT;
+    unit[1] = APU_PULSE_UNIT;
+    unit[2] = APU_TRIANGLE_UNIT;
+    unit[3] = APU_NOISE_UNIT;
+    unit[4] = APU_DMC_UNIT;
+    reset();
+}
+
+void APU::reset()
+{
+    time = cpu.clock();
+    memset( pulse, 0, sizeof( pulse ) );
+    memset( &triangle, 0, sizeof( triangle ) );
+    memset( &noise, 0, sizeof( noise ) );
+    memset( &dmc, 0, sizeof( dmc ) );
+    pulse[0].next = time;
+    pulse[1].next = time;
+    triangle.next = time;
+    noise.next = time;
+    noise.period = noisePeriods[0];
+    noise.lfsr = 1;
+    dmc.next = time;
+    dmc.rate = dmcRates[0];
+    dmc.bits = 8;
+    dmc.silence = true;
+    enabled = 0;
+    status = 0;
+    // power on acts like $4017 = 0
+    frameMode = 0;
+    frameStart = time;
+    frameStep = 0;
+    synthSkip = false;
+    blip.clear();
+    blipStart = time;
+    // output starts at 0 wherever the channels rest, the triangle rests at 15
+    memset( level, 0, sizeof( level ) );
+    level[2] = triangleLevel();
+    dropped = 0;
+}
+
+void APU::start()
+{
+    // samples are due every APU_BLIP_CYCLES, the CPU sees the frame IRQ and DMC fetches.
+    // Events land a cycle after their step so catchUp has run it
+    uint64_t next = synthSkip ? EVENT_NEVER : blipStart + APU_BLIP_CYCLES;
+    if ( frameMode == 0 && ( status & APUSTATUS_FRAME_IRQ ) == 0 ) {
+        uint64_t irq = frameStart + frameSteps[0][3] + 1;
+        if ( irq < next ) {
+            next = irq;
+        }
+    }
+    if ( dmc.bufferFull && dmc.remaining > 0 ) {
+        // the buffer empties into the shifter when the current byte is out
+        uint64_t fetch = dmc.next + ( dmc.bits - 1 ) * dmc.rate + 1;
+        if ( fetch < next ) {
+            next = fetch;
+        }
+    }
+    cpu.scheduler.schedule( EVENT_APU, next );
+}
+
+void APU::event( uint64_t time )
+{
+    catchUp( time );
+    start();
+}
+
+void APU::skipSynthesis( bool skip )
+{
+    if ( skip == synthSkip ) {
+        return;
+    }
+    sync();
+    synthSkip = skip;
+    if ( !skip ) {
+        // the waveforms pick up from now, the output from where the channels are
+        pulse[0].next = time;
+        pulse[1].next = time;
+        triangle.next = time;
+        noise.next = time;
+        blip.clear();
+        blipStart = time;
+        level[0] = pulseLevel( 0 );
+        level[1] = pulseLevel( 1 );
+        level[2] = triangleLevel();
+        level[3] = noiseLevel();
+        level[4] = dmc.level;
+    }
+    start();
+}
+
+void APU::catchUp( uint64_t target )
+{
+    while ( time < target ) {
+        uint64_t step = frameStepTime();
+        uint64_t blipEnd = synthSkip ? EVENT_NEVER : blipStart + APU_BLIP_CYCLES;
+        uint64_t end = target;
+        if ( step < end ) {
+            end = step;
+        }
+        if ( blipEnd < end ) {
+            end = blipEnd;
+        }
+        if ( !synthSkip ) {
+            runPulse( 0, end );
+            runPulse( 1, end );
+            runTriangle( end );
+            runNoise( end );
+        }
+        runDmc( end );
+        time = end;
+        if ( time == step ) {
+            clockFrame();
+        }
+        if ( time == blipEnd ) {
+            endFrame();
+        }
+    }
+}
+
+void APU::sync()
+{
+    catchUp( cpu.clock() );
+}
+
+uint8_t APU::readStatus()
+{
+    sync();
+    uint8_t value = status;
+    if ( pulse[0].length > 0 ) {
+        value |= 0x01;
+    }
+    if ( pulse[1].length > 0 ) {
+        value |= 0x02;
+    }
+    if ( triangle.length > 0 ) {
+        value |= 0x04;
+    }
+    if ( noise.length > 0 ) {
+        value |= 0x08;
+    }
+    if ( dmc.remaining > 0 ) {
+        value |= 0x10;
+    }
+    // reading acknowledges the frame IRQ, the next one needs its event again
+    if ( status & APUSTATUS_FRAME_IRQ ) {
+        status &= ~APUSTATUS_FRAME_IRQ;
+        cpu.setIRQ( IRQ_FRAME, false );
+        start();
+    }
+    return value;
+}
+
+void APU::writeRegister( uint16_t addr, uint8_t val )
+{
+    sync();
+    switch ( addr ) {
+        case 0x4000:
+        case 0x4004:
+            {
+                Pulse &p = pulse[( addr >> 2 ) & 1];
+                p.duty = val >> 6;
+                p.envelope.loop = val & 0x20;
+                p.envelope.constant = val & 0x10;
+                p.envelope.volume = val & 0x0F;
+            }
+            break;
+        case 0x4001:
+        case 0x4005:
+            {
+                Pulse &p = pulse[( addr >> 2 ) & 1];
+                p.sweepEnabled = val & 0x80;
+                p.sweepPeriod = ( val >> 4 ) & 0x7;
+                p.sweepNegate = val & 0x08;
+                p.sweepShift = val & 0x7;
+                p.sweepReload = true;
+            }
+            break;
+        case 0x4002:
+        case 0x4006:
+            {
+                Pulse &p = pulse[( addr >> 2 ) & 1];
+                p.timer = ( p.timer & 0x700 ) | val;
+            }
+            break;
+        case 0x4003:
+        case 0x4007:
+            {
+                int channel = ( addr >> 2 ) & 1;
+                Pulse &p = pulse[channel];
+                p.timer = ( p.timer & 0xFF ) | ( ( val & 0x7 ) << 8 );
+                if ( enabled & ( 1 << channel ) ) {
+                    p.length = lengthTable[val >> 3];
+                }
+                p.step = 0;
+                p.envelope.start = true;
+            }
+            break;
+        case 0x4008:
+            triangle.control = val & 0x80;
+            triangle.linearPeriod = val & 0x7F;
+            break;
+        case 0x400A:
+            triangle.timer = ( triangle.timer & 0x700 ) | val;
+            break;
+        case 0x400B:
+            triangle.timer = ( triangle.timer & 0xFF ) | ( ( val & 0x7 ) << 8 );
+            if ( enabled & 0x04 ) {
+                triangle.length = lengthTable[val >> 3];
+            }
+            triangle.linearReload = true;
+            break;
+        case 0x400C:
+            noise.envelope.loop = val & 0x20;
+            noise.envelope.constant = val & 0x10;
+            noise.envelope.volume = val & 0x0F;
+            break;
+        case 0x400E:
+            noise.mode = val & 0x80;
+            noise.period = noisePeriods[val & 0x0F];
+            break;
+        case 0x400F:
+            if ( enabled & 0x08 ) {
+                noise.length = lengthTable[val >> 3];
+            }
+            noise.envelope.start = true;
+            break;
+        case 0x4010:
+            dmc.irqEnabled = val & 0x80;
+            dmc.loop = val & 0x40;
+            dmc.rate = dmcRates[val & 0x0F];
+            if ( !dmc.irqEnabled ) {
+                status &= ~APUSTATUS_DMC_IRQ;
+                cpu.setIRQ( IRQ_DMC, false );
+            }
+            break;
+        case 0x4011:
+            dmc.level = val & 0x7F;
+            break;
+        case 0x4012:
+            dmc.start = 0xC000 + val * 64;
+            break;
+        case 0x4013:
+            dmc.length = val * 16 + 1;
+            break;
+        case 0x4015:
+            enabled = val & 0x1F;
+            if ( ( enabled & 0x01 ) == 0 ) {
+                pulse[0].length = 0;
+            }
+            if ( ( enabled & 0x02 ) == 0 ) {
+                pulse[1].length = 0;
+            }
+            if ( ( enabled & 0x04 ) == 0 ) {
+                triangle.length = 0;
+            }
+            if ( ( enabled & 0x08 ) == 0 ) {
+                noise.length = 0;
+            }
+            status &= ~APUSTATUS_DMC_IRQ;
+            cpu.setIRQ( IRQ_DMC, false );
+            if ( enabled & 0x10 ) {
+                if ( dmc.remaining == 0 ) {
+                    dmc.address = dmc.start;
+                    dmc.remaining = dmc.length;
+                }
+                if ( !dmc.bufferFull ) {
+                    dmcFetch( time );
+                }
+            } else {
+                dmc.remaining = 0;
+            }
+            break;
+        case 0x4017:
+            frameMode = val & ( APUFRAME_FIVE_STEP | APUFRAME_IRQ_INHIBIT );
+            if ( frameMode & APUFRAME_IRQ_INHIBIT ) {
+                status &= ~APUSTATUS_FRAME_IRQ;
+                cpu.setIRQ( IRQ_FRAME, false );
+            }
+            // the sequence restarts 3 or 4 cycles later, depending on the APU cycle the write hit
+            frameStart = time + ( ( time & 1 ) ? 4 : 3 );
+            frameStep = 0;
+            if ( frameMode & APUFRAME_FIVE_STEP ) {
+                quarterFrame();
+                halfFrame();
+            }
+            break;
+        default:
+            return;
+    }
+    updateLevels( time );
+    start();
+}
+
+int APU::readSamples( int16_t *out, int count )
+{
+    sync();
+    if ( synthSkip ) {
+        return 0;
+    }
+    endFrame();
+    return blip.readSamples( out, count );
+}
+
+int APU::samplesAvailable()
+{
+    sync();
+    if ( synthSkip ) {
+        return 0;
+    }
+    endFrame();
+    return blip.avail;
+}
+
+uint64_t APU::frameStepTime() const
+{
+    return frameStart + frameSteps[( frameMode & APUFRAME_FIVE_STEP ) ? 1 : 0][frameStep];
+}
+
+void APU::clockFrame()
+{
+    int mode = ( frameMode & APUFRAME_FIVE_STEP ) ? 1 : 0;
+    quarterFrame();
+    if ( frameStep & 1 ) {
+        halfFrame();
+    }
+    if ( frameStep == 3 ) {
+        if ( frameMode == 0 ) {
+            status |= APUSTATUS_FRAME_IRQ;
+            cpu.setIRQ( IRQ_FRAME, true );
+        }
+        frameStart += framePeriods[mode];
+        frameStep = 0;
+    } else {
+        frameStep++;
+    }
+    updateLevels( time );
+}
+
+void APU::quarterFrame()
+{
+    pulse[0].envelope.clock();
+    pulse[1].envelope.clock();
+    noise.envelope.clock();
+    if ( triangle.linearReload ) {
+        triangle.linear = triangle.linearPeriod;
+    } else if ( triangle.linear > 0 ) {
+        triangle.linear--;
+    }
+    if ( !triangle.control ) {
+        triangle.linearReload = false;
+    }
+}
+
+void APU::halfFrame()
+{
+    for ( int c = 0; c < 2; c++ ) {
+        Pulse &p = pulse[c];
+        if ( p.length > 0 && !p.envelope.loop ) {
+            p.length--;
+        }
+        if ( p.sweepDivider == 0 && p.sweepEnabled && p.sweepShift > 0 && !p.muted( c ) ) {
+            int target = p.sweepTarget( c );
+            p.timer = target < 0 ? 0 : target;
+        }
+        if ( p.sweepDivider == 0 || p.sweepReload ) {
+            p.sweepDivider = p.sweepPeriod;
+            p.sweepReload = false;
+        } else {
+            p.sweepDivider--;
+        }
+    }
+    if ( triangle.length > 0 && !triangle.control ) {
+        triangle.length--;
+    }
+    if ( noise.length > 0 && !noise.envelope.loop ) {
+        noise.length--;
+    }
+}
+
+void APU::runPulse( int channel, uint64_t to )
+{
+    Pulse &p = pulse[channel];
+    if ( p.next >= to ) {
+        return;
+    }
+    uint32_t period = ( p.timer + 1 ) * 2;
+    uint8_t volume = p.envelope.output();
+    if ( p.length == 0 || volume == 0 || p.muted( channel ) ) {
+        // silent whatever the step, only the position in the sequence matters
+        uint64_t steps = ( to - p.next + period - 1 ) / period;
+        p.step = ( p.step + steps ) & 0x7;
+        p.next += steps * period;
+        return;
+    }
+    const uint8_t *duty = dutyTable[p.duty];
+    for ( ; p.next < to; p.next += period ) {
+        p.step = ( p.step + 1 ) & 0x7;
+        setLevel( channel, duty[p.step] ? volume : 0, p.next );
+    }
+}
+
+void APU::runTriangle( uint64_t to )
+{
+    Triangle &t = triangle;
+    if ( t.next >= to ) {
+        return;
+    }
+    uint32_t period = t.timer + 1;
+    if ( t.length == 0 || t.linear == 0 || t.timer < 2 ) {
+        // the sequencer stops and the output holds, ultrasonic periods are frozen as well
+        t.next += ( to - t.next + period - 1 ) / period * period;
+        return;
+    }
+    for ( ; t.next < to; t.next += period ) {
+        t.step = ( t.step + 1 ) & 0x1F;
+        setLevel( 2, triangleSequence[t.step], t.next );
+    }
+}
+
+void APU::runNoise( uint64_t to )
+{
+    Noise &n = noise;
+    if ( n.next >= to ) {
+        return;
+    }
+    uint8_t volume = n.envelope.output();
+    if ( n.length == 0 || volume == 0 ) {
+        // nobody hears the shift register, it is left where it is
+        n.next += ( to - n.next + n.period - 1 ) / n.period * n.period;
+        return;
+    }
+    int tap = n.mode ? 6 : 1;
+    for ( ; n.next < to; n.next += n.period ) {
+        uint16_t feedback = ( n.lfsr ^ ( n.lfsr >> tap ) ) & 1;
+        n.lfsr = ( n.lfsr >> 1 ) | ( feedback << 14 );
+        setLevel( 3, ( n.lfsr & 1 ) ? 0 : volume, n.next );
+    }
+}
+
+void APU::runDmc( uint64_t to )
+{
+    DMC &d = dmc;
+    if ( d.next >= to ) {
+        return;
+    }
+    if ( d.silence && !d.bufferFull ) {
+        // nothing to play, only the bit counter moves
+        uint64_t steps = ( to - d.next + d.rate - 1 ) / d.rate;
+        d.bits = ( d.bits + 7 - steps % 8 ) % 8 + 1;
+        d.next += steps * d.rate;
+        return;
+    }
+    if ( synthSkip ) {
+        // the level is not heard, only the byte ends where the buffer empties and the next fetch starts
+        while ( d.next < to ) {
+            uint64_t byteEnd = d.next + ( d.bits - 1 ) * d.rate;
+            if ( byteEnd >= to ) {
+                uint64_t steps = ( to - d.next + d.rate - 1 ) / d.rate;
+                d.bits -= steps;
+                d.next += steps * d.rate;
+                break;
+            }
+            d.next = byteEnd + d.rate;
+            d.bits = 8;
+            d.silence = !d.bufferFull;
+            if ( d.bufferFull ) {
+                d.shift = d.buffer;
+                d.bufferFull = false;
+                if ( d.remaining > 0 ) {
+                    dmcFetch( byteEnd );
+                }
+            }
+        }
+        return;
+    }
+    for ( ; d.next < to; d.next += d.rate ) {
+        if ( !d.silence ) {
+            if ( d.shift & 1 ) {
+                if ( d.level <= 125 ) {
+                    d.level += 2;
+                }
+            } else if ( d.level >= 2 ) {
+                d.level -= 2;
+            }
+            setLevel( 4, d.level, d.next );
+        }
+        d.shift >>= 1;
+        if ( --d.bits == 0 ) {
+            d.bits = 8;
+            d.silence = !d.bufferFull;
+            if ( d.bufferFull ) {
+                d.shift = d.buffer;
+                d.bufferFull = false;
+                if ( d.remaining > 0 ) {
+                    dmcFetch( d.next );
+                }
+            }
+        }
+    }
+}
+
+void APU::dmcFetch( uint64_t when )
+{
+    if ( dmc.remaining == 0 ) {
+        return;
+    }
+    dmc.buffer = cpu.dmcRead( dmc.address, when );
+    dmc.bufferFull = true;
+    dmc.address = dmc.address == 0xFFFF ? 0x8000 : dmc.address + 1;
+    if ( --dmc.remaining == 0 ) {
+        if ( dmc.loop ) {
+            dmc.address = dmc.start;
+            dmc.remaining = dmc.length;
+        } else if ( dmc.irqEnabled ) {
+            status |= APUSTATUS_DMC_IRQ;
+            cpu.setIRQ( IRQ_DMC, true );
+        }
+    }
+}
+
+int APU::pulseLevel( int channel ) const
+{
+    const Pulse &p = pulse[channel];
+    if ( p.length == 0 || p.muted( channel ) || !dutyTable[p.duty][p.step] ) {
+        return 0;
+    }
+    return p.envelope.output();
+}
+
+int APU::triangleLevel() const
+{
+    return triangleSequence[triangle.step];
+}
+
+int APU::noiseLevel() const
+{
+    if ( noise.length == 0 || ( noise.lfsr & 1 ) ) {
+        return 0;
+    }
+    return noise.envelope.output();
+}
+
+void APU::setLevel( int channel, int value, uint64_t when )
+{
+    if ( synthSkip ) {
+        return;
+    }
+    int delta = value - level[channel];
+    if ( delta != 0 ) {
+        level[channel] = value;
+        blip.addDelta( when - blipStart, delta * unit[channel] );
+    }
+}
+
+void APU::updateLevels( uint64_t when )
+{
+    setLevel( 0, pulseLevel( 0 ), when );
+    setLevel( 1, pulseLevel( 1 ), when );
+    setLevel( 2, triangleLevel(), when );
+    setLevel( 3, noiseLevel(), when );
+    setLevel( 4, dmc.level, when );
+}
+
+void APU::endFrame()
+{
+    blip.endFrame( time - blipStart );
+    blipStart = time;
+    if ( blip.avail > APU_SAMPLE_BUFFER ) {
+        dropped += blip.readSamples( NULL, blip.avail - APU_SAMPLE_BUFFER );
+    }
+}
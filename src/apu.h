@@ -0,0 +1,212 @@
+#ifndef __APU_H__
+#define __APU_H__
+#include <stdint.h>
+#include <vector>
+
+#define APU_CLOCK_RATE 1789773 // NTSC CPU clock in Hz
+#define APU_SAMPLE_RATE 48000
+#define APU_BLIP_CYCLES 29780 // samples are made at least this often
+#define APU_SAMPLE_BUFFER 8192 // samples kept for readSamples, older ones are dropped
+
+// band-limited step, see BlipBuffer
+#define BLIP_TIME_BITS 32 // fraction bits of a sample position
+#define BLIP_PHASE_BITS 5
+#define BLIP_PHASES (1 << BLIP_PHASE_BITS)
+#define BLIP_TAPS 16
+#define BLIP_DELTA_BITS 15 // the taps of each phase add up to 1 << BLIP_DELTA_BITS
+#define BLIP_BASS_SHIFT 9 // high-pass that takes out DC
+
+// $4015
+#define APUSTATUS_FRAME_IRQ 0x40
+#define APUSTATUS_DMC_IRQ 0x80
+
+// $4017
+#define APUFRAME_FIVE_STEP 0x80
+#define APUFRAME_IRQ_INHIBIT 0x40
+
+struct CPU;
+
+// Band-limited synthesis in the style of blip_buf. A change of the output
+// level is added as a delta at its clock time, spread over a short windowed
+// sinc so nothing above half the sample rate is produced. Reading sums the
+// deltas back up into samples. Times are clocks since the last endFrame.
+struct BlipBuffer
+{
+    uint64_t factor; // samples per clock << BLIP_TIME_BITS
+    uint64_t offset; // sample position of clock 0 << BLIP_TIME_BITS
+    int avail; // finished samples
+    int32_t integrator;
+    std::vector<int32_t> buffer;
+
+    BlipBuffer( int capacity );
+    void setRates( double clockRate, double sampleRate );
+    void clear();
+
+    void addDelta( uint32_t time, int delta );
+    // clocks up to time are done, the samples they made become available
+    void endFrame( uint32_t time );
+    // up to count samples into out, NULL drops them, returns how many
+    int readSamples( int16_t *out, int count );
+};
+
+// Volume envelope of the pulse and noise channels
+struct Envelope
+{
+    bool start;
+    bool loop; // also halts the length counter
+    bool constant;
+    uint8_t volume; // constant volume or divider period
+    uint8_t divider;
+    uint8_t decay;
+
+    void clock();
+    uint8_t output() const
+    {
+        return constant ? volume : decay;
+    }
+};
+
+struct Pulse
+{
+    Envelope envelope;
+    uint8_t duty;
+    uint8_t step;
+    uint16_t timer;
+    uint8_t length;
+    bool sweepEnabled;
+    bool sweepNegate;
+    bool sweepReload;
+    uint8_t sweepPeriod;
+    uint8_t sweepShift;
+    uint8_t sweepDivider;
+    uint64_t next; // CPU clock of the next sequencer step
+
+    // period the sweep moves to, pulse 1 negates in ones' complement
+    int sweepTarget( int channel ) const;
+    bool muted( int channel ) const;
+};
+
+struct Triangle
+{
+    bool control; // also halts the length counter
+    bool linearReload;
+    uint8_t linearPeriod;
+    uint8_t linear;
+    uint8_t step;
+    uint16_t timer;
+    uint8_t length;
+    uint64_t next;
+};
+
+struct Noise
+{
+    Envelope envelope;
+    bool mode; // short sequence
+    uint16_t period; // CPU cycles
+    uint16_t lfsr;
+    uint8_t length;
+    uint64_t next;
+};
+
+struct DMC
+{
+    bool irqEnabled;
+    bool loop;
+    uint16_t rate; // CPU cycles per output bit
+    uint8_t level;
+    uint16_t start; // sample address and length from $4012/$4013
+    uint16_t length;
+    uint16_t address; // memory reader
+    uint16_t remaining;
+    uint8_t buffer;
+    bool bufferFull;
+    uint8_t shift; // output unit
+    uint8_t bits;
+    bool silence;
+    uint64_t next;
+};
+
+// 2A03 audio. Like the PPU the APU only runs when it has to: a register access
+// catches it up to the CPU, otherwise EVENT_APU does at the frame IRQ, at a DMC
+// fetch or when samples are due. A channel is not stepped every cycle, it runs
+// from one change of its output to the next and adds the change to the blip
+// buffer. Silent channels skip straight to the end.
+struct APU
+{
+    CPU &cpu;
+    Pulse pulse[2];
+    Triangle triangle;
+    Noise noise;
+    DMC dmc;
+    uint8_t enabled; // $4015 bits 0-4
+    uint8_t status; // APUSTATUS_FRAME_IRQ and APUSTATUS_DMC_IRQ
+
+    // frame sequencer
+    uint8_t frameMode; // $4017 bits 6-7
+    uint64_t frameStart; // CPU clock the sequence started at
+    int frameStep;
+
+    uint64_t time; // CPU clock the APU has run to
+
+    // timing only, see skipSynthesis
+    bool synthSkip;
+
+    // output
+    BlipBuffer blip;
+    uint64_t blipStart; // CPU clock of blip time 0
+    int level[5]; // last output of each channel, as sent to blip
+    int unit[5]; // amplitude of one output step of each channel
+    uint64_t dropped; // samples lost because nobody read them
+
+    APU( CPU &cpu );
+    void reset();
+
+    // schedule the next event, only a cartridge has an APU attached
+    void start();
+    // EVENT_APU fired, time is the CPU clock
+    void event( uint64_t time );
+
+    // Keep only what the CPU can see: the frame IRQ, lengths in $4015, DMC
+    // fetches and the DMC IRQ. The waveforms, the mixer and the blip buffer
+    // stop and readSamples gives nothing until synthesis is back on
+    void skipSynthesis( bool skip );
+
+    // run up to CPU clock target
+    void catchUp( uint64_t target );
+    // run up to the CPU clock
+    void sync();
+
+    // CPU access to $4000-$4013, $4015 and $4017
+    uint8_t readStatus();
+    void writeRegister( uint16_t addr, uint8_t val );
+
+    // make the samples up to now and hand out up to count of them
+    int readSamples( int16_t *out, int count );
+    int samplesAvailable();
+
+    // CPU clock of the next frame sequencer step
+    uint64_t frameStepTime() const;
+    void clockFrame();
+    void quarterFrame();
+    void halfFrame();
+
+    // channels from their next step up to, not including, CPU clock to
+    void runPulse( int channel, uint64_t to );
+    void runTriangle( uint64_t to );
+    void runNoise( uint64_t to );
+    void runDmc( uint64_t to );
+    void dmcFetch( uint64_t when );
+
+    // output of a channel from its current state
+    int pulseLevel( int channel ) const;
+    int triangleLevel() const;
+    int noiseLevel() const;
+    // channel output changed at CPU clock when
+    void setLevel( int channel, int value, uint64_t when );
+    void updateLevels( uint64_t when );
+
+    // the samples up to time become readable
+    void endFrame();
+};
+
+#endif
@@ -0,0 +1,63 @@
+#include "../6502.h"
+#include "bench.h"
+#include <chrono>
+
+#define BENCH_FRAMES 3000
+#define BENCH_FRAME_CYCLES 29781
+
+static CPU cpu;
+
+// register writes starting every channel, noise at its fastest period and
+// the DMC looping over the program
+static const uint16_t playing[][2] = {
+    { 0x4015, 0x1F },
+    { 0x4000, 0xBF }, { 0x4002, 0xFD }, { 0x4003, 0x08 },
+    { 0x4004, 0x7F }, { 0x4006, 0x7E }, { 0x4007, 0x08 },
+    { 0x4008, 0xFF }, { 0x400A, 0x7E }, { 0x400B, 0x08 },
+    { 0x400C, 0x3F }, { 0x400E, 0x00 }, { 0x400F, 0x08 },
+    { 0x4010, 0x4F }, { 0x4012, 0x00 }, { 0x4013, 0xFF }, { 0x4015, 0x1F },
+};
+
+// emulated frames per second with the APU idle, with all channels playing
+// and with the same channels timing only. The samples are read every frame
+// like a host would
+void apuBench()
+{
+    // $c000    4c 00 c0  JMP $c000
+    std::vector<uint8_t> image( INES_HEADER_SIZE, 0 );
+    memcpy( &image[0], "NES\x1A", 4 );
+    image[4] = 1;
+    image[5] = 1;
+    image.resize( INES_HEADER_SIZE + INES_PRG_BANK_SIZE + INES_CHR_BANK_SIZE, 0 );
+    uint8_t *prg = &image[INES_HEADER_SIZE];
+    prg[0] = 0x4c;
+    prg[1] = 0x00;
+    prg[2] = 0xc0;
+    prg[0x3FFC] = 0x00;
+    prg[0x3FFD] = 0xC0;
+    if ( cpu.loadNESImage( &image[0], image.size(), "apubench" ) == false ) {
+        return;
+    }
+    const char *modes[] = { "silent", "playing", "timing" };
+    int16_t samples[APU_SAMPLE_BUFFER];
+    for ( int mode = 0; mode < 3; mode++ ) {
+        cpu.powerOn();
+        cpu.ppu.skipRendering( true );
+        cpu.apu.skipSynthesis( mode == 2 );
+        cpu.write( 0x4017, APUFRAME_IRQ_INHIBIT );
+        if ( mode >= 1 ) {
+            for ( size_t i = 0; i < sizeof( playing ) / sizeof( playing[0] ); i++ ) {
+                cpu.write( playing[i][0], playing[i][1] );
+            }
+        }
+        uint64_t read = 0;
+        auto start = std::chrono::steady_clock::now();
+        for ( int i = 0; i < BENCH_FRAMES; i++ ) {
+            cpu.execute( BENCH_FRAME_CYCLES );
+            read += cpu.apu.readSamples( samples, APU_SAMPLE_BUFFER );
+        }
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        printf("%-8s %d frames %6.1f ms  %7.1f fps  %llu samples\n",modes[mode],BENCH_FRAMES,
+                elapsed.count() * 1000,BENCH_FRAMES / elapsed.count(),(unsigned long long)read);
+    }
+}
@@ -0,0 +1,19 @@
+#ifndef __BENCH_H__
+#define __BENCH_H__
+
+// interpreter speed per bus
+void cpuBench();
+
+// full frames per second
+void ppuBench();
+
+// background tile rows decoded per second, for each decoder built in
+void tileBench();
+
+// emulated frames per second with the APU idle, playing and timing only
+void apuBench();
+
+// framebuffer conversions per second for each pixel format
+void paletteBench();
+
+#endif
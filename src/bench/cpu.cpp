@@ -0,0 +1,100 @@
+#include "../6502.h"
+#include "../bus.h"
+#include "bench.h"
+#include <chrono>
+
+// Compare interpreter speed on flat memory against the mapper specialised
+// bus paths. A cartridge also runs the PPU and APU, "cart" is flat memory
+// with NROM loaded and is as fast as a bus can get. The same loop runs from
+// $C000 in every mode:
+//
+// $c000    a2 00     LDX #$00
+// $c002    bd 00 90  LDA $9000,X
+// $c005    7d 00 03  ADC $0300,X
+// $c008    9d 00 03  STA $0300,X
+// $c00b    e8        INX
+// $c00c    d0 f4     BNE $c002
+// $c00e    4c 00 c0  JMP $c000
+
+static const uint8_t program[] = {
+    0xa2, 0x00, 0xbd, 0x00, 0x90, 0x7d, 0x00, 0x03, 0x9d, 0x00, 0x03,
+    0xe8, 0xd0, 0xf4, 0x4c, 0x00, 0xc0
+};
+
+#define BENCH_CYCLES 200000000
+#define BENCH_SLICE 29781 // one NTSC frame
+
+static CPU cpu;
+
+static std::vector<uint8_t> makeImage( int mapper, int prgbanks )
+{
+    std::vector<uint8_t> image( INES_HEADER_SIZE, 0 );
+    memcpy( &image[0], "NES\x1A", 4 );
+    image[4] = prgbanks;
+    image[5] = 1;
+    image[6] = (mapper & 0xF) << 4;
+    image[7] = mapper & 0xF0;
+    image.resize( INES_HEADER_SIZE + prgbanks * INES_PRG_BANK_SIZE + INES_CHR_BANK_SIZE, 0 );
+
+    // program and vectors in the last 16KB bank, mapped at $C000 on every board
+    uint8_t *last = &image[INES_HEADER_SIZE + ( prgbanks - 1 ) * INES_PRG_BANK_SIZE];
+    memcpy( last, program, sizeof( program ) );
+    last[0x3FFC] = 0x00;
+    last[0x3FFD] = 0xC0;
+    return image;
+}
+
+// best of BENCH_RUNS, the first run also warms the caches
+#define BENCH_RUNS 3
+
+static double flat;
+
+static void run( const char *name )
+{
+    double best = 0;
+    for ( int i = 0; i < BENCH_RUNS; i++ ) {
+        cpu.powerOn();
+        auto start = std::chrono::steady_clock::now();
+        for ( int done = 0; done < BENCH_CYCLES; done += BENCH_SLICE ) {
+            cpu.execute( BENCH_SLICE );
+        }
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        if ( best == 0 || elapsed.count() < best ) {
+            best = elapsed.count();
+        }
+    }
+    if ( cpu.exception ) {
+        printf("%-8s exception\n",name);
+        return;
+    }
+    if ( flat == 0 ) {
+        flat = best;
+    }
+    printf("%-8s %6.1f ms  %6.1f MHz  %5.2fx flat\n",name,best * 1000,BENCH_CYCLES / best / 1e6,best / flat);
+}
+
+void cpuBench()
+{
+    cpu.powerOn( 0xC000 );
+    memcpy( &cpu.mem[0xC000], program, sizeof( program ) );
+    run( "flat" );
+
+    const int boards[][2] = { { 0, 2 }, { 1, 8 }, { 2, 8 }, { 4, 8 } };
+    const char *names[] = { "NROM", "MMC1", "UxROM", "MMC3" };
+    for ( int i = 0; i < 4; i++ ) {
+        std::vector<uint8_t> image = makeImage( boards[i][0], boards[i][1] );
+        if ( cpu.loadNESImage( &image[0], image.size(), names[i] ) == false ) {
+            return;
+        }
+        run( names[i] );
+        if ( i == 0 ) {
+            // the loop only touches RAM and PRG, which mem holds
+            cpu.executor = &CPU::run<FlatBus>;
+            run( "cart" );
+        }
+
+        // same board through the generic page table path
+        cpu.executor = &CPU::run<PagedBus>;
+        run( "paged" );
+    }
+}
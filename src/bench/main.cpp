@@ -0,0 +1,29 @@
+#include <stdio.h>
+#include <string.h>
+#include "bench.h"
+
+// run all benchmarks, or only the ones named on the command line
+int main( int argc, char *argv[] )
+{
+    struct {
+        const char *name;
+        void (*run)();
+    } benches[] = {
+        { "cpu", cpuBench },
+        { "ppu", ppuBench },
+        { "apu", apuBench },
+        { "tile", tileBench },
+        { "palette", paletteBench },
+    };
+    for ( size_t i = 0; i < sizeof( benches ) / sizeof( benches[0] ); i++ ) {
+        bool selected = argc < 2;
+        for ( int j = 1; j < argc; j++ ) {
+            selected |= strcmp( argv[j], benches[i].name ) == 0;
+        }
+        if ( selected ) {
+            printf("== %s\n",benches[i].name);
+            benches[i].run();
+        }
+    }
+    return 0;
+}
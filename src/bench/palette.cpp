@@ -0,0 +1,41 @@
+#include "../palette.h"
+#include "../ppu.h"
+#include "bench.h"
+#include <stdio.h>
+#include <vector>
+#include <chrono>
+
+// Convert a frame of random indices to every format, table lookup against
+// the dispatched path that uses SSSE3 when the CPU has it.
+
+#define BENCH_FRAMES 2000
+
+typedef void (*Converter)( const uint8_t *indices, int count, uint8_t emphasis, PixelFormat format, void *out );
+
+static void run( const char *name, Converter convert, PixelFormat format, const uint8_t *frame )
+{
+    std::vector<uint8_t> out( PPU_WIDTH * PPU_HEIGHT * 4 );
+    auto start = std::chrono::steady_clock::now();
+    for ( int i = 0; i < BENCH_FRAMES; i++ ) {
+        convert( frame, PPU_WIDTH * PPU_HEIGHT, i & 0x7, format, &out[0] );
+    }
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    printf("%-8s %-8s %6.1f ms  %7.1f frames/s\n",name,format == PIXEL_RGBA8888 ? "rgba" : "rgb565",
+            elapsed.count() * 1000,BENCH_FRAMES / elapsed.count());
+}
+
+void paletteBench()
+{
+    std::vector<uint8_t> frame( PPU_WIDTH * PPU_HEIGHT );
+    uint32_t seed = 0x12345678;
+    for ( size_t i = 0; i < frame.size(); i++ ) {
+        seed ^= seed << 13;
+        seed ^= seed >> 17;
+        seed ^= seed << 5;
+        frame[i] = seed & 0x3F;
+    }
+    run( "scalar", convertPixelsScalar, PIXEL_RGBA8888, &frame[0] );
+    run( "best", convertPixels, PIXEL_RGBA8888, &frame[0] );
+    run( "scalar", convertPixelsScalar, PIXEL_RGB565, &frame[0] );
+    run( "best", convertPixels, PIXEL_RGB565, &frame[0] );
+}
@@ -0,0 +1,125 @@
+#include "../6502.h"
+#include "../observation.h"
+#include "bench.h"
+#include <chrono>
+#include <thread>
+
+// Busy NROM scene: random CHR, a full nametable, 64 sprites moved by
+// OAM DMA and the scroll reset from the NMI handler every frame.
+//
+// $c000    78        SEI
+// $c001    a9 00     LDA #$00
+// $c003    8d 00 20  STA $2000
+// $c006    8d 01 20  STA $2001
+// $c009    a9 20     LDA #$20
+// $c00b    8d 06 20  STA $2006
+// $c00e    a9 00     LDA #$00
+// $c010    8d 06 20  STA $2006
+// $c013    a0 04     LDY #$04
+// $c015    a2 00     LDX #$00
+// $c017    8e 07 20  STX $2007
+// $c01a    e8        INX
+// $c01b    d0 fa     BNE $c017
+// $c01d    88        DEY
+// $c01e    d0 f7     BNE $c017
+// $c020    a9 3f     LDA #$3f
+// $c022    8d 06 20  STA $2006
+// $c025    a9 00     LDA #$00
+// $c027    8d 06 20  STA $2006
+// $c02a    a2 00     LDX #$00
+// $c02c    8e 07 20  STX $2007
+// $c02f    e8        INX
+// $c030    e0 20     CPX #$20
+// $c032    d0 f8     BNE $c02c
+// $c034    a2 00     LDX #$00
+// $c036    8a        TXA
+// $c037    9d 00 02  STA $0200,X
+// $c03a    e8        INX
+// $c03b    d0 f9     BNE $c036
+// $c03d    a9 88     LDA #$88
+// $c03f    8d 00 20  STA $2000
+// $c042    a9 1e     LDA #$1e
+// $c044    8d 01 20  STA $2001
+// $c047    4c 47 c0  JMP $c047
+// nmi:
+// $c050    a9 02     LDA #$02
+// $c052    8d 14 40  STA $4014
+// $c055    a9 00     LDA #$00
+// $c057    8d 05 20  STA $2005
+// $c05a    8d 05 20  STA $2005
+// $c05d    40        RTI
+static const uint8_t program[] = {
+    0x78, 0xa9, 0x00, 0x8d, 0x00, 0x20, 0x8d, 0x01, 0x20, 0xa9, 0x20, 0x8d,
+    0x06, 0x20, 0xa9, 0x00, 0x8d, 0x06, 0x20, 0xa0, 0x04, 0xa2, 0x00, 0x8e,
+    0x07, 0x20, 0xe8, 0xd0, 0xfa, 0x88, 0xd0, 0xf7, 0xa9, 0x3f, 0x8d, 0x06,
+    0x20, 0xa9, 0x00, 0x8d, 0x06, 0x20, 0xa2, 0x00, 0x8e, 0x07, 0x20, 0xe8,
+    0xe0, 0x20, 0xd0, 0xf8, 0xa2, 0x00, 0x8a, 0x9d, 0x00, 0x02, 0xe8, 0xd0,
+    0xf9, 0xa9, 0x88, 0x8d, 0x00, 0x20, 0xa9, 0x1e, 0x8d, 0x01, 0x20, 0x4c,
+    0x47, 0xc0
+};
+static const uint8_t nmi[] = {
+    0xa9, 0x02, 0x8d, 0x14, 0x40, 0xa9, 0x00, 0x8d, 0x05, 0x20, 0x8d, 0x05,
+    0x20, 0x40
+};
+
+#define BENCH_FRAMES 600
+#define BENCH_FRAME_CYCLES 29781
+
+static CPU cpu;
+
+void ppuBench()
+{
+    std::vector<uint8_t> image( INES_HEADER_SIZE, 0 );
+    memcpy( &image[0], "NES\x1A", 4 );
+    image[4] = 1;
+    image[5] = 1;
+    image.resize( INES_HEADER_SIZE + INES_PRG_BANK_SIZE + INES_CHR_BANK_SIZE, 0 );
+    uint8_t *prg = &image[INES_HEADER_SIZE];
+    memcpy( prg, program, sizeof( program ) );
+    memcpy( prg + 0x50, nmi, sizeof( nmi ) );
+    prg[0x3FFA] = 0x50;
+    prg[0x3FFB] = 0xC0;
+    prg[0x3FFC] = 0x00;
+    prg[0x3FFD] = 0xC0;
+    uint32_t seed = 0x12345678;
+    for ( int i = 0; i < INES_CHR_BANK_SIZE; i++ ) {
+        seed ^= seed << 13;
+        seed ^= seed >> 17;
+        seed ^= seed << 5;
+        image[INES_HEADER_SIZE + INES_PRG_BANK_SIZE + i] = seed;
+    }
+    if ( cpu.loadNESImage( &image[0], image.size(), "ppubench" ) == false ) {
+        return;
+    }
+    // the same frames drawn, drawn without background reuse, the same in bands
+    // on every core and skipped
+    int cores = std::thread::hardware_concurrency();
+    const char *modes[] = { "drawn", "no reuse", "bands", "skipped" };
+    for ( int mode = 0; mode < 4; mode++ ) {
+        cpu.powerOn();
+        cpu.ppu.reuseBackground = mode == 0;
+        cpu.ppu.renderThreads( mode == 2 ? ( cores > 2 ? cores : 2 ) : 1 );
+        cpu.ppu.skipRendering( mode == 3 );
+        auto start = std::chrono::steady_clock::now();
+        for ( int i = 0; i < BENCH_FRAMES && cpu.exception == false; i++ ) {
+            cpu.execute( BENCH_FRAME_CYCLES );
+        }
+        cpu.ppu.finishFrame();
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        uint64_t pixels = cpu.ppu.backgroundPixels + cpu.ppu.backgroundReused;
+        printf("%-8s %d frames %6.1f ms  %6.1f fps  %5.1f%% background reused\n",modes[mode],(int)cpu.ppu.frame,
+                elapsed.count() * 1000,cpu.ppu.frame / elapsed.count(),pixels ? 100.0 * cpu.ppu.backgroundReused / pixels : 0.0);
+    }
+    cpu.ppu.renderThreads( 1 );
+    cpu.ppu.reuseBackground = true;
+
+    // the last frame as an 84x84 observation
+    Observation observation;
+    uint8_t out[OBSERVATION_SIZE * OBSERVATION_SIZE];
+    auto start = std::chrono::steady_clock::now();
+    for ( int i = 0; i < BENCH_FRAMES; i++ ) {
+        observation.render( cpu.ppu, out );
+    }
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    printf("%-8s %d frames %6.1f ms  %6.1f fps\n","observe",BENCH_FRAMES,elapsed.count() * 1000,BENCH_FRAMES / elapsed.count());
+}
@@ -0,0 +1,46 @@
+#include "../tile.h"
+#include "bench.h"
+#include <stdio.h>
+#include <chrono>
+
+// Decode a 16KB pattern table's worth of tile rows over and over with every
+// decoder the build has, the checksum keeps the output alive and must agree.
+
+#define BENCH_TILES 20000000
+
+typedef void (*TileDecoder)( uint8_t lo, uint8_t hi, uint8_t palette, uint8_t *out );
+
+static uint8_t chr[0x4000];
+
+static void run( const char *name, TileDecoder decode )
+{
+    uint8_t out[8];
+    uint64_t sum = 0;
+    auto start = std::chrono::steady_clock::now();
+    for ( int i = 0; i < BENCH_TILES; i++ ) {
+        int row = ( i * 16 + (i >> 10) ) & 0x3FF7;
+        decode( chr[row], chr[row + 8], i & 0x3, out );
+        sum += out[i & 0x7];
+    }
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    printf("%-8s %6.1f ms  %7.1f Mtiles/s  sum %llu\n",name,elapsed.count() * 1000,
+            BENCH_TILES / elapsed.count() / 1e6,(unsigned long long)sum);
+}
+
+void tileBench()
+{
+    uint32_t seed = 0x12345678;
+    for ( int i = 0; i < (int)sizeof( chr ); i++ ) {
+        seed ^= seed << 13;
+        seed ^= seed >> 17;
+        seed ^= seed << 5;
+        chr[i] = seed;
+    }
+    run( "scalar", decodeTileRowScalar );
+#ifdef __SSE2__
+    run( "sse2", decodeTileRowSSE2 );
+#endif
+#ifdef __BMI2__
+    run( "bmi2", decodeTileRowBMI2 );
+#endif
+}
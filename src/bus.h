@@ -0,0 +1,106 @@
+#ifndef __BUS_H__
+#define __BUS_H__
+#include "6502.h"
+#include "mapper.h"
+
+// Bus policies for CPU::run, each is its own copy of the interpreter loop.
+// Every supported mapper gets one. Mapper::mapPrg keeps a copy of the mapped
+// PRG banks in mem, so instruction fetches read mem like FlatBus and data
+// reads only test the address, and M::writeRegister is called without going
+// through the vtable. fetchable tells whether a whole instruction at pc can
+// be fetched that way, the rest runs one at a time on PagedBus.
+
+// no cartridge, the whole address space is mem
+struct FlatBus
+{
+    static BUS_INLINE bool fetchable( uint16_t pc )
+    {
+        (void)pc;
+        return true;
+    }
+
+    static BUS_INLINE uint8_t fetch( CPU &cpu, uint16_t addr )
+    {
+        return cpu.mem[addr];
+    }
+
+    static BUS_INLINE uint8_t read( CPU &cpu, uint16_t addr )
+    {
+        return cpu.mem[addr];
+    }
+
+    static BUS_INLINE void write( CPU &cpu, uint16_t addr, uint8_t val )
+    {
+        cpu.mem[addr] = val;
+    }
+};
+
+// any mapper through the page tables
+struct PagedBus
+{
+    static BUS_INLINE bool fetchable( uint16_t pc )
+    {
+        (void)pc;
+        return true;
+    }
+
+    static BUS_INLINE uint8_t fetch( CPU &cpu, uint16_t addr )
+    {
+        return cpu.read( addr );
+    }
+
+    static BUS_INLINE uint8_t read( CPU &cpu, uint16_t addr )
+    {
+        return cpu.read( addr );
+    }
+
+    static BUS_INLINE void write( CPU &cpu, uint16_t addr, uint8_t val )
+    {
+        cpu.write( addr, val );
+    }
+};
+
+// a cartridge with mapper M, $2000-$7FFF goes through the page tables
+template<class M>
+struct CartBus
+{
+    // mem holds RAM at $0000-$07FF and PRG at $8000-$FFFF, an instruction
+    // starting there stays there unless its operand runs into the RAM mirrors
+    static BUS_INLINE bool fetchable( uint16_t pc )
+    {
+        return ( pc & 0x8000 ) || pc < 0x07FE;
+    }
+
+    static BUS_INLINE uint8_t fetch( CPU &cpu, uint16_t addr )
+    {
+        return cpu.mem[addr];
+    }
+
+    static BUS_INLINE uint8_t read( CPU &cpu, uint16_t addr )
+    {
+        if ( addr & 0x8000 ) {
+            return cpu.mem[addr];
+        }
+        if ( addr < 0x2000 ) {
+            return cpu.mem[addr & 0x7FF];
+        }
+        return cpu.read( addr );
+    }
+
+    static BUS_INLINE void write( CPU &cpu, uint16_t addr, uint8_t val )
+    {
+        if ( addr & 0x8000 ) {
+            // bank switches may change what the rest of the frame shows
+            cpu.ppu.sync();
+            static_cast<M*>( cpu.mapper.get() )->M::writeRegister( addr, val );
+            return;
+        }
+        if ( addr < 0x2000 ) {
+            cpu.mem[addr & 0x7FF] = val;
+            return;
+        }
+        cpu.write( addr, val );
+    }
+};
+
+#endif
@@ -0,0 +1,105 @@
+#include "framecheck.h"
+#include "6502.h"
+#include <fstream>
+#include <vector>
+#include <inttypes.h>
+
+FrameCheck::FrameCheck()
+    : dumpPrefix( "frame" ),
+      checked( 0 ),
+      mismatches( 0 )
+{
+}
+
+bool FrameCheck::load( std::string file )
+{
+    std::ifstream ifs( file );
+    if ( !ifs ) {
+        fprintf(stderr,"%s: Unable to open\n",file.c_str());
+        return false;
+    }
+    std::string line;
+    int lineno = 0;
+    while ( std::getline( ifs, line ) ) {
+        lineno++;
+        size_t comment = line.find( '#' );
+        if ( comment != std::string::npos ) {
+            line.erase( comment );
+        }
+        if ( line.find_first_not_of( " \t\r" ) == std::string::npos ) {
+            continue;
+        }
+        uint64_t frame, hash;
+        if ( sscanf( line.c_str(), "%" SCNu64 " %" SCNx64, &frame, &hash ) != 2 ) {
+            fprintf(stderr,"%s:%d: Invalid frame hash\n",file.c_str(),lineno);
+            return false;
+        }
+        golden[frame] = hash;
+    }
+    return true;
+}
+
+bool FrameCheck::save( std::string file ) const
+{
+    FILE *f = fopen( file.c_str(), "w" );
+    if ( f == NULL ) {
+        fprintf(stderr,"%s: Unable to open\n",file.c_str());
+        return false;
+    }
+    for ( auto &frame : seen ) {
+        fprintf( f, "%" PRIu64 " %016" PRIx64 "\n", frame.first, frame.second );
+    }
+    return fclose( f ) == 0;
+}
+
+bool FrameCheck::check( PPU &ppu )
+{
+    if ( ppu.frameHashed == 0 || seen.count( ppu.frameHashed ) ) {
+        return true;
+    }
+    seen[ppu.frameHashed] = ppu.frameHash;
+    auto expected = golden.find( ppu.frameHashed );
+    if ( expected == golden.end() ) {
+        return true;
+    }
+    checked++;
+    if ( expected->second == ppu.frameHash ) {
+        return true;
+    }
+    mismatches++;
+    std::string file = dumpPrefix + std::to_string( ppu.frameHashed ) + ".ppm";
+    fprintf(stderr,"Frame %" PRIu64 ": hash %016" PRIx64 ", expected %016" PRIx64 ", written to %s\n",
+            ppu.frameHashed,ppu.frameHash,expected->second,file.c_str());
+    dump( ppu, file );
+    return false;
+}
+
+bool FrameCheck::run( CPU &cpu, uint64_t frames )
+{
+    bool ok = true;
+    cpu.ppu.hashFrames = true;
+    uint64_t last = cpu.ppu.frame + frames;
+    while ( cpu.ppu.frame < last && cpu.exception == false ) {
+        cpu.execute( PPU_FRAME_STEP );
+        ok &= check( cpu.ppu );
+    }
+    return ok;
+}
+
+bool FrameCheck::dump( PPU &ppu, std::string file )
+{
+    std::vector<uint8_t> rgba( PPU_WIDTH * PPU_HEIGHT * 4 );
+    ppu.convert( PIXEL_RGBA8888, &rgba[0], PPU_WIDTH * 4 );
+    std::vector<uint8_t> rgb( PPU_WIDTH * PPU_HEIGHT * 3 );
+    for ( int i = 0; i < PPU_WIDTH * PPU_HEIGHT; i++ ) {
+        memcpy( &rgb[i * 3], &rgba[i * 4], 3 );
+    }
+    std::ofstream ofs( file, std::ios_base::out | std::ios_base::binary | std::ios_base::trunc );
+    ofs << "P6\n" << PPU_WIDTH << " " << PPU_HEIGHT << "\n255\n";
+    ofs.write( reinterpret_cast<const char*>( &rgb[0] ), rgb.size() );
+    if ( !ofs ) {
+        fprintf(stderr,"%s: Error writing image\n",file.c_str());
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,37 @@
+#ifndef __FRAMECHECK_H__
+#define __FRAMECHECK_H__
+#include <stdint.h>
+#include <map>
+#include <string>
+
+struct CPU;
+struct PPU;
+
+// Regression check of rendered frames against a golden list of hashes instead
+// of reference images. The list has one "frame hash" line per checked frame,
+// the hash as 16 hex digits, and # starts a comment. Only a mismatching frame
+// is written out, as <dumpPrefix><frame>.ppm.
+struct FrameCheck
+{
+    std::map<uint64_t, uint64_t> golden; // frame number to expected hash
+    std::map<uint64_t, uint64_t> seen; // every frame checked, for writing a new list
+    std::string dumpPrefix;
+    int checked;
+    int mismatches;
+
+    FrameCheck();
+
+    bool load( std::string file );
+    bool save( std::string file ) const;
+
+    // compare the last hashed frame if the list has it, false on a mismatch
+    bool check( PPU &ppu );
+
+    // run frames frames with hashing on, checking each one, false on any mismatch
+    bool run( CPU &cpu, uint64_t frames );
+
+    // framebuffer as a binary PPM
+    static bool dump( PPU &ppu, std::string file );
+};
+
+#endif
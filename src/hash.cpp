@@ -0,0 +1,292 @@
+#include "hash.h"
+#include <string.h>
+#include <stdio.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_PCLMUL_CRC
+#endif
+
+struct CrcTable
+{
+    uint32_t entry[256];
+
+    CrcTable()
+    {
+        for ( uint32_t i = 0; i < 256; i++ ) {
+            uint32_t c = i;
+            for ( int k = 0; k < 8; k++ ) {
+                c = ( c & 1 ) ? ( 0xEDB88320 ^ (c >> 1) ) : ( c >> 1 );
+            }
+            entry[i] = c;
+        }
+    }
+};
+
+static const CrcTable crcTable;
+
+// crc is the raw (inverted) register
+static inline uint32_t crc32Table( uint32_t crc, const uint8_t *data, size_t length )
+{
+    for ( size_t i = 0; i < length; i++ ) {
+        crc = crcTable.entry[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+    }
+    return crc;
+}
+
+#ifdef HAVE_PCLMUL_CRC
+__attribute__((target("pclmul,sse2")))
+static inline __m128i crcFold( __m128i x, __m128i k, __m128i next )
+{
+    __m128i lo = _mm_clmulepi64_si128( x, k, 0x00 );
+    __m128i hi = _mm_clmulepi64_si128( x, k, 0x11 );
+    return _mm_xor_si128( _mm_xor_si128( lo, hi ), next );
+}
+
+// fold length bytes (multiple of 16, at least 64) into 128 bits with carry-less multiplication,
+// the folded remainder has the same crc as the input and is finished with the table
+__attribute__((target("pclmul,sse2")))
+static uint32_t crc32Pclmul( uint32_t crc, const uint8_t *data, size_t length )
+{
+    // x^(512+64) and x^512 mod P for folding four lanes, x^(128+64) and x^128 for a single lane
+    const __m128i k1k2 = _mm_set_epi64x( 0x1c6e41596, 0x154442bd4 );
+    const __m128i k3k4 = _mm_set_epi64x( 0x0ccaa009e, 0x1751997d0 );
+    const __m128i *p = reinterpret_cast<const __m128i*>( data );
+
+    __m128i x0 = _mm_xor_si128( _mm_loadu_si128( p ), _mm_cvtsi32_si128( crc ) );
+    __m128i x1 = _mm_loadu_si128( p + 1 );
+    __m128i x2 = _mm_loadu_si128( p + 2 );
+    __m128i x3 = _mm_loadu_si128( p + 3 );
+    p += 4;
+    length -= 64;
+    while ( length >= 64 ) {
+        x0 = crcFold( x0, k1k2, _mm_loadu_si128( p ) );
+        x1 = crcFold( x1, k1k2, _mm_loadu_si128( p + 1 ) );
+        x2 = crcFold( x2, k1k2, _mm_loadu_si128( p + 2 ) );
+        x3 = crcFold( x3, k1k2, _mm_loadu_si128( p + 3 ) );
+        p += 4;
+        length -= 64;
+    }
+    x0 = crcFold( x0, k3k4, x1 );
+    x0 = crcFold( x0, k3k4, x2 );
+    x0 = crcFold( x0, k3k4, x3 );
+    while ( length >= 16 ) {
+        x0 = crcFold( x0, k3k4, _mm_loadu_si128( p ) );
+        p++;
+        length -= 16;
+    }
+    uint8_t rest[16];
+    _mm_storeu_si128( reinterpret_cast<__m128i*>( rest ), x0 );
+    return crc32Table( 0, rest, 16 );
+}
+
+static const bool hasPclmul = __builtin_cpu_supports( "pclmul" ) && __builtin_cpu_supports( "sse2" );
+#endif
+
+uint32_t crc32( const uint8_t *data, size_t length, uint32_t crc )
+{
+    crc = ~crc;
+#ifdef HAVE_PCLMUL_CRC
+    if ( length >= 64 && hasPclmul ) {
+        size_t folded = length & ~size_t(15);
+        crc = crc32Pclmul( crc, data, folded );
+        data += folded;
+        length -= folded;
+    }
+#endif
+    return ~crc32Table( crc, data, length );
+}
+
+// XXH64, little endian loads regardless of host order
+static const uint64_t xxPrime1 = 0x9E3779B185EBCA87ULL;
+static const uint64_t xxPrime2 = 0xC2B2AE3D27D4EB4FULL;
+static const uint64_t xxPrime3 = 0x165667B19E3779F9ULL;
+static const uint64_t xxPrime4 = 0x85EBCA77C2B2AE63ULL;
+static const uint64_t xxPrime5 = 0x27D4EB2F165667C5ULL;
+
+static inline uint64_t rol64( uint64_t x, int n )
+{
+    return ( x << n ) | ( x >> (64 - n) );
+}
+
+static inline uint64_t load64( const uint8_t *p )
+{
+    uint64_t x = 0;
+    for ( int i = 7; i >= 0; i-- ) {
+        x = ( x << 8 ) | p[i];
+    }
+    return x;
+}
+
+static inline uint32_t load32( const uint8_t *p )
+{
+    return p[0] | ( p[1] << 8 ) | ( p[2] << 16 ) | ( (uint32_t)p[3] << 24 );
+}
+
+static inline uint64_t xxRound( uint64_t acc, uint64_t input )
+{
+    return rol64( acc + input * xxPrime2, 31 ) * xxPrime1;
+}
+
+static inline uint64_t xxMerge( uint64_t acc, uint64_t lane )
+{
+    return ( acc ^ xxRound( 0, lane ) ) * xxPrime1 + xxPrime4;
+}
+
+uint64_t xxh64( const uint8_t *data, size_t length, uint64_t seed )
+{
+    const uint8_t *end = data + length;
+    uint64_t h;
+    if ( length >= 32 ) {
+        // four independent lanes over 32 byte stripes
+        uint64_t v1 = seed + xxPrime1 + xxPrime2;
+        uint64_t v2 = seed + xxPrime2;
+        uint64_t v3 = seed;
+        uint64_t v4 = seed - xxPrime1;
+        do {
+            v1 = xxRound( v1, load64( data ) );
+            v2 = xxRound( v2, load64( data + 8 ) );
+            v3 = xxRound( v3, load64( data + 16 ) );
+            v4 = xxRound( v4, load64( data + 24 ) );
+            data += 32;
+        } while ( data + 32 <= end );
+        h = rol64( v1, 1 ) + rol64( v2, 7 ) + rol64( v3, 12 ) + rol64( v4, 18 );
+        h = xxMerge( h, v1 );
+        h = xxMerge( h, v2 );
+        h = xxMerge( h, v3 );
+        h = xxMerge( h, v4 );
+    } else {
+        h = seed + xxPrime5;
+    }
+    h += length;
+    for ( ; data + 8 <= end; data += 8 ) {
+        h = rol64( h ^ xxRound( 0, load64( data ) ), 27 ) * xxPrime1 + xxPrime4;
+    }
+    if ( data + 4 <= end ) {
+        h = rol64( h ^ ( load32( data ) * xxPrime1 ), 23 ) * xxPrime2 + xxPrime3;
+        data += 4;
+    }
+    for ( ; data < end; data++ ) {
+        h = rol64( h ^ ( *data * xxPrime5 ), 11 ) * xxPrime1;
+    }
+    h ^= h >> 33;
+    h *= xxPrime2;
+    h ^= h >> 29;
+    h *= xxPrime3;
+    h ^= h >> 32;
+    return h;
+}
+
+static inline uint32_t rol( uint32_t x, int n )
+{
+    return ( x << n ) | ( x >> (32 - n) );
+}
+
+SHA1::SHA1()
+{
+    h[0] = 0x67452301;
+    h[1] = 0xEFCDAB89;
+    h[2] = 0x98BADCFE;
+    h[3] = 0x10325476;
+    h[4] = 0xC3D2E1F0;
+    length = 0;
+    used = 0;
+}
+
+void SHA1::transform( const uint8_t *chunk )
+{
+    uint32_t w[80];
+    for ( int i = 0; i < 16; i++ ) {
+        w[i] = (chunk[i*4] << 24) | (chunk[i*4+1] << 16) | (chunk[i*4+2] << 8) | chunk[i*4+3];
+    }
+    for ( int i = 16; i < 80; i++ ) {
+        w[i] = rol( w[i-3] ^ w[i-8] ^ w[i-14] ^ w[i-16], 1 );
+    }
+    uint32_t a = h[0], b = h[1], c = h[2], d = h[3], e = h[4];
+    for ( int i = 0; i < 80; i++ ) {
+        uint32_t f, k;
+        if ( i < 20 ) {
+            f = (b & c) | (~b & d);
+            k = 0x5A827999;
+        } else if ( i < 40 ) {
+            f = b ^ c ^ d;
+            k = 0x6ED9EBA1;
+        } else if ( i < 60 ) {
+            f = (b & c) | (b & d) | (c & d);
+            k = 0x8F1BBCDC;
+        } else {
+            f = b ^ c ^ d;
+            k = 0xCA62C1D6;
+        }
+        uint32_t t = rol( a, 5 ) + f + e + k + w[i];
+        e = d;
+        d = c;
+        c = rol( b, 30 );
+        b = a;
+        a = t;
+    }
+    h[0] += a;
+    h[1] += b;
+    h[2] += c;
+    h[3] += d;
+    h[4] += e;
+}
+
+void SHA1::update( const uint8_t *data, size_t len )
+{
+    length += len;
+    if ( used > 0 ) {
+        size_t n = 64 - used < len ? 64 - used : len;
+        memcpy( &block[used], data, n );
+        used += n;
+        data += n;
+        len -= n;
+        if ( used < 64 ) {
+            return;
+        }
+        transform( block );
+        used = 0;
+    }
+    while ( len >= 64 ) {
+        transform( data );
+        data += 64;
+        len -= 64;
+    }
+    memcpy( block, data, len );
+    used = len;
+}
+
+void SHA1::final( uint8_t digest[SHA1_DIGEST_SIZE] )
+{
+    uint64_t bits = length * 8;
+    uint8_t pad[72] = { 0x80 };
+    size_t padlen = ( used < 56 ) ? 56 - used : 120 - used;
+    for ( int i = 0; i < 8; i++ ) {
+        pad[padlen + i] = bits >> (56 - i*8);
+    }
+    update( pad, padlen + 8 );
+    for ( int i = 0; i < 5; i++ ) {
+        digest[i*4] = h[i] >> 24;
+        digest[i*4+1] = h[i] >> 16;
+        digest[i*4+2] = h[i] >> 8;
+        digest[i*4+3] = h[i];
+    }
+}
+
+void sha1ToString( const uint8_t digest[SHA1_DIGEST_SIZE], char *out )
+{
+    for ( int i = 0; i < SHA1_DIGEST_SIZE; i++ ) {
+        sprintf( out + i*2, "%.2x", digest[i] );
+    }
+}
+
+bool sha1FromString( const char *str, uint8_t digest[SHA1_DIGEST_SIZE] )
+{
+    for ( int i = 0; i < SHA1_DIGEST_SIZE; i++ ) {
+        unsigned int byte;
+        if ( sscanf( str + i*2, "%2x", &byte ) != 1 ) {
+            return false;
+        }
+        digest[i] = byte;
+    }
+    return true;
+}
@@ -0,0 +1,36 @@
+#ifndef __HASH_H__
+#define __HASH_H__
+#include <stdint.h>
+#include <stddef.h>
+
+#define SHA1_DIGEST_SIZE 20
+
+// CRC-32 (IEEE 802.3, same as zlib), pass the previous result as crc to continue a checksum
+// uses PCLMULQDQ folding when the cpu supports it
+uint32_t crc32( const uint8_t *data, size_t length, uint32_t crc = 0 );
+
+// XXH64 of data, fast and not cryptographic, for telling frames and other
+// large buffers apart
+uint64_t xxh64( const uint8_t *data, size_t length, uint64_t seed = 0 );
+
+struct SHA1
+{
+    uint32_t h[5];
+    uint64_t length; // total bytes hashed
+    uint8_t block[64];
+    uint32_t used; // bytes waiting in block
+
+    SHA1();
+    void update( const uint8_t *data, size_t length );
+    void final( uint8_t digest[SHA1_DIGEST_SIZE] );
+
+    void transform( const uint8_t *chunk );
+};
+
+// print digest as 40 lowercase hex characters into out (41 bytes with terminator)
+void sha1ToString( const uint8_t digest[SHA1_DIGEST_SIZE], char *out );
+
+// parse 40 hex characters, returns false on bad input
+bool sha1FromString( const char *str, uint8_t digest[SHA1_DIGEST_SIZE] );
+
+#endif
@@ -0,0 +1,38 @@
+#include "ines.h"
+#include <string.h>
+
+bool parseINESHeader( const uint8_t *data, INESHeader &header )
+{
+    if ( memcmp( data, "NES\x1A", 4 ) != 0 ) {
+        return false;
+    }
+    memset( &header, 0, sizeof( header ) );
+    header.nes2 = ( data[7] & 0x0C ) == 0x08;
+    header.prgbanks = data[4];
+    header.chrbanks = data[5];
+    header.mapper = ( (data[6] >> 4) & 0xF ) | ( data[7] & 0xF0 );
+    if ( header.nes2 ) {
+        header.mapper |= ( data[8] & 0xF ) << 8;
+        header.prgbanks |= ( data[9] & 0xF ) << 8;
+        header.chrbanks |= ( data[9] & 0xF0 ) << 4;
+        header.region = data[12] & 0x3;
+        if ( header.region == 3 ) { // Dendy, runs PAL timing
+            header.region = 1;
+        }
+    } else if ( data[12] != 0 || data[13] != 0 || data[14] != 0 || data[15] != 0 ) {
+        // old dumping tools wrote garbage ("DiskDude!") into byte 7-15, ignore the upper mapper nibble
+        header.mapper &= 0xF;
+    } else {
+        header.region = data[9] & 0x1;
+    }
+    header.mirroring = data[6] & 0x1;
+    header.battery = ( data[6] & 0x2 ) != 0;
+    header.trainer = ( data[6] & 0x4 ) != 0;
+    header.fourscreen = ( data[6] & 0x8 ) != 0;
+
+    header.prgoffset = INES_HEADER_SIZE + ( header.trainer ? INES_TRAINER_SIZE : 0 );
+    header.prgsize = INES_PRG_BANK_SIZE * header.prgbanks;
+    header.chroffset = header.prgoffset + header.prgsize;
+    header.chrsize = INES_CHR_BANK_SIZE * header.chrbanks;
+    return true;
+}
@@ -0,0 +1,33 @@
+#ifndef __INES_H__
+#define __INES_H__
+#include <stdint.h>
+#include <stddef.h>
+
+#define INES_HEADER_SIZE 0x10
+#define INES_TRAINER_SIZE 0x200
+#define INES_PRG_BANK_SIZE (1024*16)
+#define INES_CHR_BANK_SIZE (1024*8)
+
+struct INESHeader
+{
+    uint16_t prgbanks; // number of 16KB PRG-ROM banks
+    uint16_t chrbanks; // number of 8KB CHR-ROM banks, 0 means CHR-RAM
+    uint16_t mapper;
+    uint8_t mirroring; // 0 horizontal, 1 vertical
+    uint8_t region; // 0 NTSC, 1 PAL, 2 dual
+    bool fourscreen;
+    bool battery; // battery backed PRG-RAM at $6000-$7FFF
+    bool trainer; // 512 byte trainer before PRG-ROM
+    bool nes2; // NES 2.0 header
+
+    // offsets and sizes in the file, derived from the fields above
+    uint32_t prgoffset;
+    uint32_t prgsize;
+    uint32_t chroffset;
+    uint32_t chrsize;
+};
+
+// parse the 16 byte iNES header at data, returns false if it is not a NES file
+bool parseINESHeader( const uint8_t *data, INESHeader &header );
+
+#endif
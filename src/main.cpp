@@ -1,6 +1,9 @@
 #include "6502.h"
+#include "video.h"
 #include "gtest/gtest.h"
 #include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
 
 struct CPU cpu;
 
@@ -84,6 +87,8 @@ TEST(CPU_6502, BLARGG_registers) {
         cpu.execute(4000000);
         if ( cpu.mem[0x6001] == 0xDE && cpu.mem[0x6002] == 0xB0 && cpu.mem[0x6003] == 0x61 ) {
             if ( cpu.mem[0x6000] == 0x81 ) {
+                // reset no sooner than 100 msec after $81 was written
+                cpu.execute(200000);
                 cpu.reset();
             }
             if ( cpu.mem[0x6000] < 0x80 ) {
@@ -106,6 +111,8 @@ TEST(CPU_6502, BLARGG_ram_after_reset) {
         cpu.execute(4000000);
         if ( cpu.mem[0x6001] == 0xDE && cpu.mem[0x6002] == 0xB0 && cpu.mem[0x6003] == 0x61 ) {
             if ( cpu.mem[0x6000] == 0x81 ) {
+                // reset no sooner than 100 msec after $81 was written
+                cpu.execute(200000);
                 cpu.reset();
             }
             if ( cpu.mem[0x6000] < 0x80 ) {
@@ -182,6 +189,8 @@ TEST(CPU_6502, BLARGG_01_BASICS_NES) {
         cpu.execute(4000000);
         if ( cpu.mem[0x6001] == 0xDE && cpu.mem[0x6002] == 0xB0 && cpu.mem[0x6003] == 0x61 ) {
             if ( cpu.mem[0x6000] == 0x81 ) {
+                // reset no sooner than 100 msec after $81 was written
+                cpu.execute(200000);
                 cpu.reset();
             }
             if ( cpu.mem[0x6000] < 0x80 ) {
@@ -204,6 +213,8 @@ TEST(CPU_6502, BLARGG_02_IMPLIED_NES) {
         cpu.execute(4000000);
         if ( cpu.mem[0x6001] == 0xDE && cpu.mem[0x6002] == 0xB0 && cpu.mem[0x6003] == 0x61 ) {
             if ( cpu.mem[0x6000] == 0x81 ) {
+                // reset no sooner than 100 msec after $81 was written
+                cpu.execute(200000);
                 cpu.reset();
             }
             if ( cpu.mem[0x6000] < 0x80 ) {
@@ -226,6 +237,8 @@ TEST(CPU_6502, BLARGG_03_IMMEDIATE_NES) {
         cpu.execute(4000000);
         if ( cpu.mem[0x6001] == 0xDE && cpu.mem[0x6002] == 0xB0 && cpu.mem[0x6003] == 0x61 ) {
             if ( cpu.mem[0x6000] == 0x81 ) {
+                // reset no sooner than 100 msec after $81 was written
+                cpu.execute(200000);
                 cpu.reset();
             }
             if ( cpu.mem[0x6000] < 0x80 ) {
@@ -248,6 +261,8 @@ TEST(CPU_6502, BLARGG_04_ZERO_PAGE_NES) {
         cpu.execute(4000000);
         if ( cpu.mem[0x6001] == 0xDE && cpu.mem[0x6002] == 0xB0 && cpu.mem[0x6003] == 0x61 ) {
             if ( cpu.mem[0x6000] == 0x81 ) {
+                // reset no sooner than 100 msec after $81 was written
+                cpu.execute(200000);
                 cpu.reset();
             }
             if ( cpu.mem[0x6000] < 0x80 ) {
@@ -270,6 +285,8 @@ TEST(CPU_6502, BLARGG_05_ZP_XY_NES) {
         cpu.execute(4000000);
         if ( cpu.mem[0x6001] == 0xDE && cpu.mem[0x6002] == 0xB0 && cpu.mem[0x6003] == 0x61 ) {
             if ( cpu.mem[0x6000] == 0x81 ) {
+                // reset no sooner than 100 msec after $81 was written
+                cpu.execute(200000);
                 cpu.reset();
             }
             if ( cpu.mem[0x6000] < 0x80 ) {
@@ -292,6 +309,8 @@ TEST(CPU_6502, BLARGG_06_ABSOLUTE_NES) {
         cpu.execute(4000000);
         if ( cpu.mem[0x6001] == 0xDE && cpu.mem[0x6002] == 0xB0 && cpu.mem[0x6003] == 0x61 ) {
             if ( cpu.mem[0x6000] == 0x81 ) {
+                // reset no sooner than 100 msec after $81 was written
+                cpu.execute(200000);
                 cpu.reset();
             }
             if ( cpu.mem[0x6000] < 0x80 ) {
@@ -314,6 +333,8 @@ TEST(CPU_6502, BLARGG_07_ABS_XY_NES) {
         cpu.execute(4000000);
         if ( cpu.mem[0x6001] == 0xDE && cpu.mem[0x6002] == 0xB0 && cpu.mem[0x6003] == 0x61 ) {
             if ( cpu.mem[0x6000] == 0x81 ) {
+                // reset no sooner than 100 msec after $81 was written
+                cpu.execute(200000);
                 cpu.reset();
             }
             if ( cpu.mem[0x6000] < 0x80 ) {
@@ -336,6 +357,8 @@ TEST(CPU_6502, BLARGG_08_IND_X_NES) {
         cpu.execute(4000000);
         if ( cpu.mem[0x6001] == 0xDE && cpu.mem[0x6002] == 0xB0 && cpu.mem[0x6003] == 0x61 ) {
             if ( cpu.mem[0x6000] == 0x81 ) {
+                // reset no sooner than 100 msec after $81 was written
+                cpu.execute(200000);
                 cpu.reset();
             }
             if ( cpu.mem[0x6000] < 0x80 ) {
@@ -358,6 +381,8 @@ TEST(CPU_6502, BLARGG_09_IND_Y_NES) {
         cpu.execute(4000000);
         if ( cpu.mem[0x6001] == 0xDE && cpu.mem[0x6002] == 0xB0 && cpu.mem[0x6003] == 0x61 ) {
             if ( cpu.mem[0x6000] == 0x81 ) {
+                // reset no sooner than 100 msec after $81 was written
+                cpu.execute(200000);
                 cpu.reset();
             }
             if ( cpu.mem[0x6000] < 0x80 ) {
@@ -380,6 +405,8 @@ TEST(CPU_6502, BLARGG_10_BRANCHES_NES) {
         cpu.execute(4000000);
         if ( cpu.mem[0x6001] == 0xDE && cpu.mem[0x6002] == 0xB0 && cpu.mem[0x6003] == 0x61 ) {
             if ( cpu.mem[0x6000] == 0x81 ) {
+                // reset no sooner than 100 msec after $81 was written
+                cpu.execute(200000);
                 cpu.reset();
             }
             if ( cpu.mem[0x6000] < 0x80 ) {
@@ -402,6 +429,8 @@ TEST(CPU_6502, BLARGG_11_STACK_NES) {
         cpu.execute(4000000);
         if ( cpu.mem[0x6001] == 0xDE && cpu.mem[0x6002] == 0xB0 && cpu.mem[0x6003] == 0x61 ) {
             if ( cpu.mem[0x6000] == 0x81 ) {
+                // reset no sooner than 100 msec after $81 was written
+                cpu.execute(200000);
                 cpu.reset();
             }
             if ( cpu.mem[0x6000] < 0x80 ) {
@@ -424,6 +453,8 @@ TEST(CPU_6502, BLARGG_12_JMP_JSR_NES) {
         cpu.execute(4000000);
         if ( cpu.mem[0x6001] == 0xDE && cpu.mem[0x6002] == 0xB0 && cpu.mem[0x6003] == 0x61 ) {
             if ( cpu.mem[0x6000] == 0x81 ) {
+                // reset no sooner than 100 msec after $81 was written
+                cpu.execute(200000);
                 cpu.reset();
             }
             if ( cpu.mem[0x6000] < 0x80 ) {
@@ -446,6 +477,8 @@ TEST(CPU_6502, BLARGG_13_RTS_NES) {
         cpu.execute(4000000);
         if ( cpu.mem[0x6001] == 0xDE && cpu.mem[0x6002] == 0xB0 && cpu.mem[0x6003] == 0x61 ) {
             if ( cpu.mem[0x6000] == 0x81 ) {
+                // reset no sooner than 100 msec after $81 was written
+                cpu.execute(200000);
                 cpu.reset();
             }
             if ( cpu.mem[0x6000] < 0x80 ) {
@@ -468,6 +501,8 @@ TEST(CPU_6502, BLARGG_14_RTI_NES) {
         cpu.execute(4000000);
         if ( cpu.mem[0x6001] == 0xDE && cpu.mem[0x6002] == 0xB0 && cpu.mem[0x6003] == 0x61 ) {
             if ( cpu.mem[0x6000] == 0x81 ) {
+                // reset no sooner than 100 msec after $81 was written
+                cpu.execute(200000);
                 cpu.reset();
             }
             if ( cpu.mem[0x6000] < 0x80 ) {
@@ -490,6 +525,8 @@ TEST(CPU_6502, BLARGG_15_BRK_NES) {
         cpu.execute(4000000);
         if ( cpu.mem[0x6001] == 0xDE && cpu.mem[0x6002] == 0xB0 && cpu.mem[0x6003] == 0x61 ) {
             if ( cpu.mem[0x6000] == 0x81 ) {
+                // reset no sooner than 100 msec after $81 was written
+                cpu.execute(200000);
                 cpu.reset();
             }
             if ( cpu.mem[0x6000] < 0x80 ) {
@@ -514,6 +551,8 @@ TEST(CPU_6502, BLARGG_16_SPECIAL_NES) {
         cpu.execute(4000000);
         if ( cpu.mem[0x6001] == 0xDE && cpu.mem[0x6002] == 0xB0 && cpu.mem[0x6003] == 0x61 ) {
             if ( cpu.mem[0x6000] == 0x81 ) {
+                // reset no sooner than 100 msec after $81 was written
+                cpu.execute(200000);
                 cpu.reset();
             }
             if ( cpu.mem[0x6000] < 0x80 ) {
@@ -540,6 +579,8 @@ TEST(CPU_6502, BLARGG_OFFICIAL_ONLY_NES) {
         cpu.execute(4000000);
         if ( cpu.mem[0x6001] == 0xDE && cpu.mem[0x6002] == 0xB0 && cpu.mem[0x6003] == 0x61 ) {
             if ( cpu.mem[0x6000] == 0x81 ) {
+                // reset no sooner than 100 msec after $81 was written
+                cpu.execute(200000);
                 cpu.reset();
             }
             if ( cpu.mem[0x6000] < 0x80 ) {
@@ -553,10 +594,74 @@ TEST(CPU_6502, BLARGG_OFFICIAL_ONLY_NES) {
     }
 }
 
+static void usage()
+{
+    fprintf(stderr,"Usage: nes6502 [gtest options]\n");
+    fprintf(stderr,"       nes6502 -r rom [-n frames] [-f rgb24|y4m] [-o file]\n");
+}
+
+// run rom headless and write its frames for an encoder, to stdout without -o
+static int recordVideo( int argc, char* argv[] )
+{
+    const char *rom = NULL;
+    const char *output = "-";
+    uint64_t frames = 600;
+    VideoFormat format = VIDEO_Y4M;
+    int opt;
+    while ( ( opt = getopt( argc, argv, "r:n:f:o:" ) ) != -1 ) {
+        switch ( opt ) {
+            case 'r':
+                rom = optarg;
+                break;
+            case 'n':
+                frames = strtoull( optarg, NULL, 10 );
+                break;
+            case 'f':
+                if ( strcmp( optarg, "rgb24" ) == 0 ) {
+                    format = VIDEO_RGB24;
+                } else if ( strcmp( optarg, "y4m" ) == 0 ) {
+                    format = VIDEO_Y4M;
+                } else {
+                    usage();
+                    return 1;
+                }
+                break;
+            case 'o':
+                output = optarg;
+                break;
+            default:
+                usage();
+                return 1;
+        }
+    }
+    if ( rom == NULL || optind != argc ) {
+        usage();
+        return 1;
+    }
+    if ( cpu.loadNESFile( rom ) == false ) {
+        return 1;
+    }
+    cpu.powerOn();
+    // nobody listens, the APU only keeps the timing games depend on
+    cpu.apu.skipSynthesis( true );
+    VideoWriter video;
+    if ( video.open( output, format ) == false ) {
+        return 1;
+    }
+    bool ok = video.record( cpu, frames );
+    ok &= video.close();
+    fprintf(stderr,"%llu frames, waited for the writer %llu times\n",(unsigned long long)video.frames,(unsigned long long)video.stalls);
+    return ok ? 0 : 1;
+}
+
 int main( int argc, char* argv[])
 {
 
     ::testing::InitGoogleTest(&argc, argv);
+    // whatever gtest did not take is for the video recorder
+    if ( argc > 1 ) {
+        return recordVideo( argc, argv );
+    }
     return RUN_ALL_TESTS();
 }
 
@@ -0,0 +1,425 @@
+#include "mapper.h"
+#include "tile.h"
+#include <string.h>
+
+Mapper::Mapper( CPU &cpu )
+    : cpu( cpu )
+{
+    const INESHeader &header = cpu.header;
+    prg = cpu.prgrom;
+    prgsize = header.prgsize;
+    if ( header.chrsize > 0 ) {
+        // CHR-ROM is never written, chrwritable guards the PPU side
+        chr = const_cast<uint8_t*>( cpu.chrrom );
+        chrsize = header.chrsize;
+        chrwritable = false;
+    } else {
+        chrram.assign( INES_CHR_BANK_SIZE, 0 );
+        chr = &chrram[0];
+        chrsize = chrram.size();
+        chrwritable = true;
+    }
+    mirroring = header.fourscreen ? MIRROR_FOUR : header.mirroring;
+
+    uint32_t tiles = chrsize / CHR_TILE_SIZE;
+    chrDecoded.resize( tiles * CHR_DECODED_SIZE );
+    chrDirty.assign( ( tiles + 63 ) / 64, 0 );
+    for ( uint32_t i = 0; i < tiles; i++ ) {
+        decodeTile( i );
+    }
+}
+
+void Mapper::decodeTile( uint32_t tile )
+{
+    const uint8_t *planes = chr + tile * CHR_TILE_SIZE;
+    uint8_t *out = &chrDecoded[tile * CHR_DECODED_SIZE];
+    for ( int row = 0; row < 8; row++ ) {
+        uint64_t bits;
+        decodeTileRow( planes[row], planes[row + 8], 0, out + row * 8 );
+        memcpy( &bits, out + row * 8, 8 );
+        bits = __builtin_bswap64( bits );
+        memcpy( out + 64 + row * 8, &bits, 8 );
+    }
+    chrDirty[tile >> 6] &= ~( 1ULL << (tile & 63) );
+}
+
+void Mapper::decodeDirtyTiles()
+{
+    for ( size_t word = 0; word < chrDirty.size(); word++ ) {
+        while ( chrDirty[word] ) {
+            decodeTile( word * 64 + __builtin_ctzll( chrDirty[word] ) );
+        }
+    }
+}
+
+void Mapper::reset()
+{
+    mapPrg( 0, 0, 0x4000 );
+    mapPrg( 1, -1, 0x4000 );
+    mapChr( 0, 0, 0x2000 );
+}
+
+void Mapper::mapPrg( int slot, int bank, uint32_t size )
+{
+    int count = prgsize > size ? prgsize / size : 1;
+    if ( bank < 0 ) {
+        bank += count;
+    }
+    uint32_t offset = ( bank % count ) * size;
+    uint32_t addr = 0x8000 + slot * size;
+    for ( uint32_t i = 0; i < size; i += BUS_PAGE_SIZE ) {
+        const uint8_t *page = prg + ( offset + i ) % prgsize;
+        int index = (addr + i) >> BUS_PAGE_SHIFT;
+        // CartBus reads the copy in mem, only pages that really moved are copied
+        if ( cpu.readMap[index] != page ) {
+            cpu.readMap[index] = page;
+            memcpy( &cpu.mem[addr + i], page, BUS_PAGE_SIZE );
+        }
+    }
+}
+
+void Mapper::mapChr( int slot, int bank, uint32_t size )
+{
+    int count = chrsize > size ? chrsize / size : 1;
+    if ( bank < 0 ) {
+        bank += count;
+    }
+    uint32_t offset = ( bank % count ) * size;
+    uint32_t addr = slot * size;
+    for ( uint32_t i = 0; i < size; i += CHR_PAGE_SIZE ) {
+        chrMap[(addr + i) >> CHR_PAGE_SHIFT] = chr + ( offset + i ) % chrsize;
+    }
+}
+
+bool Mapper::supported( const INESHeader &header )
+{
+    if ( header.prgsize == 0 ) {
+        return false;
+    }
+    switch ( header.mapper ) {
+        case 0:
+        case 1:
+        case 2:
+        case 3:
+        case 4:
+        case 7:
+            return true;
+        default:
+            return false;
+    }
+}
+
+Mapper *Mapper::create( CPU &cpu )
+{
+    if ( supported( cpu.header ) == false ) {
+        return NULL;
+    }
+    switch ( cpu.header.mapper ) {
+        case 0:
+            return new NROM( cpu );
+        case 1:
+            return new MMC1( cpu );
+        case 2:
+            return new UxROM( cpu );
+        case 3:
+            return new CNROM( cpu );
+        case 4:
+            return new MMC3( cpu );
+        case 7:
+            return new AxROM( cpu );
+        default:
+            return NULL;
+    }
+}
+
+void MMC1::reset()
+{
+    shift = 0x10;
+    control = 0x0C; // PRG mode 3, last bank fixed at $C000
+    chrbank0 = 0;
+    chrbank1 = 0;
+    prgbank = 0;
+    updateBanks();
+}
+
+void MMC1::writeRegister( uint16_t addr, uint8_t val )
+{
+    if ( val & 0x80 ) {
+        shift = 0x10;
+        control |= 0x0C;
+        updateBanks();
+        return;
+    }
+    bool full = shift & 0x1;
+    shift = ( shift >> 1 ) | ( (val & 0x1) << 4 );
+    if ( full == false ) {
+        return;
+    }
+    switch ( (addr >> 13) & 0x3 ) {
+        case 0:
+            control = shift;
+            break;
+        case 1:
+            chrbank0 = shift;
+            break;
+        case 2:
+            chrbank1 = shift;
+            break;
+        case 3:
+            prgbank = shift;
+            break;
+    }
+    shift = 0x10;
+    updateBanks();
+}
+
+void MMC1::updateBanks()
+{
+    static const uint8_t mirrors[4] = { MIRROR_SINGLE_LOW, MIRROR_SINGLE_HIGH, MIRROR_VERTICAL, MIRROR_HORIZONTAL };
+    mirroring = mirrors[control & 0x3];
+
+    // SUROM and friends use CHR bank bit 4 to select the 256KB PRG half
+    int outer = ( prgsize > 0x40000 ) ? ( chrbank0 & 0x10 ) : 0;
+    int bank = outer | ( prgbank & 0xF );
+    switch ( (control >> 2) & 0x3 ) {
+        case 0:
+        case 1:
+            mapPrg( 0, bank >> 1, 0x8000 );
+            break;
+        case 2:
+            mapPrg( 0, outer, 0x4000 );
+            mapPrg( 1, bank, 0x4000 );
+            break;
+        case 3:
+            mapPrg( 0, bank, 0x4000 );
+            mapPrg( 1, outer | 0xF, 0x4000 );
+            break;
+    }
+
+    if ( control & 0x10 ) {
+        mapChr( 0, chrbank0, 0x1000 );
+        mapChr( 1, chrbank1, 0x1000 );
+    } else {
+        mapChr( 0, chrbank0 >> 1, 0x2000 );
+    }
+}
+
+void UxROM::writeRegister( uint16_t addr, uint8_t val )
+{
+    (void)addr;
+    mapPrg( 0, val, 0x4000 );
+}
+
+void CNROM::writeRegister( uint16_t addr, uint8_t val )
+{
+    (void)addr;
+    mapChr( 0, val & 0x3, 0x2000 );
+}
+
+void MMC3::reset()
+{
+    bankselect = 0;
+    banks[0] = 0;
+    banks[1] = 2;
+    banks[2] = 4;
+    banks[3] = 5;
+    banks[4] = 6;
+    banks[5] = 7;
+    banks[6] = 0;
+    banks[7] = 1;
+    irqlatch = 0;
+    irqcounter = 0;
+    irqreload = false;
+    irqenabled = false;
+    ppuctrl = 0;
+    ppumask = 0;
+    synced = cpu.clock();
+    cpu.scheduler.cancel( EVENT_MAPPER );
+    updateBanks();
+}
+
+void MMC3::writeRegister( uint16_t addr, uint8_t val )
+{
+    bool odd = addr & 0x1;
+    switch ( addr & 0xE000 ) {
+        case 0x8000:
+            if ( odd ) {
+                banks[bankselect & 0x7] = val;
+            } else {
+                bankselect = val;
+            }
+            updateBanks();
+            break;
+        case 0xA000:
+            // odd is PRG-RAM protect, PRG-RAM is always enabled
+            if ( odd == false && mirroring != MIRROR_FOUR ) {
+                mirroring = ( val & 0x1 ) ? MIRROR_HORIZONTAL : MIRROR_VERTICAL;
+            }
+            break;
+        case 0xC000:
+            sync( cpu.clock() );
+            if ( odd ) {
+                irqcounter = 0;
+                irqreload = true;
+            } else {
+                irqlatch = val;
+            }
+            reschedule();
+            break;
+        case 0xE000:
+            sync( cpu.clock() );
+            irqenabled = odd;
+            if ( odd == false ) {
+                cpu.setIRQ( IRQ_MAPPER, false );
+            }
+            reschedule();
+            break;
+    }
+}
+
+void MMC3::ppuWrite( uint16_t reg, uint8_t val )
+{
+    if ( reg > 1 ) {
+        return;
+    }
+    sync( cpu.clock() );
+    if ( reg == 0 ) {
+        ppuctrl = val;
+    } else {
+        ppumask = val;
+    }
+    reschedule();
+}
+
+void MMC3::event( uint64_t time )
+{
+    sync( time );
+    reschedule();
+}
+
+// Lines 0-239 and the pre-render line fetch from both pattern tables. With sprites
+// at $1000 A12 rises once at the sprite fetches, with the background at $1000 the
+// edge that survives the M2 filter is the fetch of the next line's first tiles.
+#define MMC3_RISES_PER_FRAME 241
+
+int MMC3::a12Dot() const
+{
+    if ( ( ppumask & 0x18 ) == 0 ) {
+        return -1;
+    }
+    if ( ppuctrl & 0x10 ) {
+        return 324;
+    }
+    // 8x16 sprites are assumed to use $1000
+    if ( ppuctrl & 0x28 ) {
+        return 260;
+    }
+    return -1;
+}
+
+uint64_t MMC3::risesBefore( uint64_t dot ) const
+{
+    int a12 = a12Dot();
+    uint64_t count = ( dot / PPU_DOTS_PER_FRAME ) * MMC3_RISES_PER_FRAME;
+    int64_t rem = dot % PPU_DOTS_PER_FRAME;
+    if ( rem > a12 ) {
+        int64_t lines = ( rem - a12 - 1 ) / PPU_DOTS_PER_LINE + 1;
+        count += lines < 240 ? lines : 240;
+    }
+    if ( rem > ( PPU_LINES_PER_FRAME - 1 ) * PPU_DOTS_PER_LINE + a12 ) {
+        count++;
+    }
+    return count;
+}
+
+uint64_t MMC3::riseDot( uint64_t index ) const
+{
+    uint64_t frame = index / MMC3_RISES_PER_FRAME;
+    uint64_t line = index % MMC3_RISES_PER_FRAME;
+    if ( line == 240 ) {
+        line = PPU_LINES_PER_FRAME - 1;
+    }
+    return frame * PPU_DOTS_PER_FRAME + line * PPU_DOTS_PER_LINE + a12Dot();
+}
+
+void MMC3::clockCounter( uint64_t clocks )
+{
+    while ( clocks > 0 ) {
+        if ( irqcounter == 0 || irqreload ) {
+            irqcounter = irqlatch;
+            irqreload = false;
+            clocks--;
+        } else {
+            uint64_t step = clocks < irqcounter ? clocks : irqcounter;
+            irqcounter -= step;
+            clocks -= step;
+        }
+        if ( irqcounter == 0 ) {
+            if ( irqenabled ) {
+                cpu.setIRQ( IRQ_MAPPER, true );
+            }
+            if ( irqlatch == 0 ) {
+                break;
+            }
+        }
+    }
+}
+
+void MMC3::sync( uint64_t time )
+{
+    if ( time > synced && a12Dot() >= 0 ) {
+        // rises in (synced, time], the edge at a CPU cycle counts once that cycle is reached
+        uint64_t from = synced * PPU_DOTS_PER_CPU_CYCLE + 1;
+        uint64_t to = time * PPU_DOTS_PER_CPU_CYCLE + 1;
+        clockCounter( risesBefore( to ) - risesBefore( from ) );
+    }
+    synced = time;
+}
+
+void MMC3::reschedule()
+{
+    if ( irqenabled == false || a12Dot() < 0 ) {
+        cpu.scheduler.cancel( EVENT_MAPPER );
+        return;
+    }
+    uint64_t clocks = ( irqreload || irqcounter == 0 ) ? irqlatch + 1 : irqcounter;
+    uint64_t dot = riseDot( risesBefore( synced * PPU_DOTS_PER_CPU_CYCLE + 1 ) + clocks - 1 );
+    cpu.scheduler.schedule( EVENT_MAPPER, ( dot + PPU_DOTS_PER_CPU_CYCLE - 1 ) / PPU_DOTS_PER_CPU_CYCLE );
+}
+
+void MMC3::updateBanks()
+{
+    // bit 6 swaps $8000 and $C000, bit 7 swaps the 2KB and 1KB CHR halves
+    if ( bankselect & 0x40 ) {
+        mapPrg( 0, -2, 0x2000 );
+        mapPrg( 2, banks[6] & 0x3F, 0x2000 );
+    } else {
+        mapPrg( 0, banks[6] & 0x3F, 0x2000 );
+        mapPrg( 2, -2, 0x2000 );
+    }
+    mapPrg( 1, banks[7] & 0x3F, 0x2000 );
+    mapPrg( 3, -1, 0x2000 );
+
+    int invert = ( bankselect & 0x80 ) ? 4 : 0;
+    mapChr( 0 ^ invert, banks[0] & 0xFE, 0x400 );
+    mapChr( 1 ^ invert, banks[0] | 0x01, 0x400 );
+    mapChr( 2 ^ invert, banks[1] & 0xFE, 0x400 );
+    mapChr( 3 ^ invert, banks[1] | 0x01, 0x400 );
+    mapChr( 4 ^ invert, banks[2], 0x400 );
+    mapChr( 5 ^ invert, banks[3], 0x400 );
+    mapChr( 6 ^ invert, banks[4], 0x400 );
+    mapChr( 7 ^ invert, banks[5], 0x400 );
+}
+
+void AxROM::reset()
+{
+    writeRegister( 0x8000, 0 );
+    mapChr( 0, 0, 0x2000 );
+}
+
+void AxROM::writeRegister( uint16_t addr, uint8_t val )
+{
+    (void)addr;
+    mapPrg( 0, val & 0x7, 0x8000 );
+    mirroring = ( val & 0x10 ) ? MIRROR_SINGLE_HIGH : MIRROR_SINGLE_LOW;
+}
@@ -0,0 +1,178 @@
+#ifndef __MAPPER_H__
+#define __MAPPER_H__
+#include <stdint.h>
+#include <vector>
+#include "6502.h"
+
+#define CHR_PAGE_SHIFT 10 // pattern tables are mapped in 1KB pages
+#define CHR_PAGE_SIZE (1 << CHR_PAGE_SHIFT)
+#define CHR_PAGES 8
+#define CHR_TILE_SIZE 16 // two 8 byte bit planes
+#define CHR_DECODED_SIZE 128 // 8x8 pattern bits, then the same flipped horizontally
+
+enum Mirroring
+{
+    MIRROR_HORIZONTAL = 0, // same values as the iNES header bit
+    MIRROR_VERTICAL = 1,
+    MIRROR_SINGLE_LOW,
+    MIRROR_SINGLE_HIGH,
+    MIRROR_FOUR,
+};
+
+// Cartridge board. Banks are switched by pointing the CPU bus pages ($8000-$FFFF)
+// and the CHR pages at the selected bank inside the ROM image, bank data is never copied.
+struct Mapper
+{
+    CPU &cpu;
+    const uint8_t *prg;
+    uint32_t prgsize;
+    uint8_t *chr; // CHR-ROM from the image or chrram
+    uint32_t chrsize;
+    bool chrwritable;
+    std::vector<uint8_t> chrram; // 8KB when the cartridge has no CHR-ROM
+    uint8_t *chrMap[CHR_PAGES]; // PPU $0000-$1FFF
+    uint8_t mirroring;
+
+    // Every tile of chr decoded to one byte per pixel. CHR-ROM is decoded once
+    // when the image is loaded, CHR-RAM tiles are decoded again when first
+    // used after a write.
+    std::vector<uint8_t> chrDecoded;
+    std::vector<uint64_t> chrDirty; // one bit per tile, CHR-RAM only
+
+    Mapper( CPU &cpu );
+    virtual ~Mapper() {}
+
+    // power on bank layout
+    virtual void reset();
+
+    // CPU write to $8000-$FFFF
+    virtual void writeRegister( uint16_t addr, uint8_t val ) { (void)addr; (void)val; }
+
+    // CPU write to a PPU register, reg is 0-7
+    virtual void ppuWrite( uint16_t reg, uint8_t val ) { (void)reg; (void)val; }
+
+    // EVENT_MAPPER fired, time is the CPU clock
+    virtual void event( uint64_t time ) { (void)time; }
+
+    // map PRG bank of size bytes at $8000 + slot * size, negative banks count from the last bank.
+    // Pages that change are also copied into cpu.mem
+    void mapPrg( int slot, int bank, uint32_t size );
+
+    // map CHR bank of size bytes at PPU slot * size
+    void mapChr( int slot, int bank, uint32_t size );
+
+    // PPU write to $0000-$1FFF, ignored for CHR-ROM
+    void chrWrite( uint16_t addr, uint8_t val )
+    {
+        if ( chrwritable ) {
+            uint8_t *p = &chrMap[(addr >> CHR_PAGE_SHIFT) & (CHR_PAGES - 1)][addr & (CHR_PAGE_SIZE - 1)];
+            *p = val;
+            uint32_t tile = ( p - chr ) / CHR_TILE_SIZE;
+            chrDirty[tile >> 6] |= 1ULL << ( tile & 63 );
+        }
+    }
+
+    // 8 pattern bits 0-3 of the tile row at PPU address addr, flip gives it mirrored
+    const uint8_t *tileRow( uint16_t addr, bool flip )
+    {
+        return tileRow( chrMap, addr, flip );
+    }
+    // the same through a copy of chrMap
+    const uint8_t *tileRow( const uint8_t *const *map, uint16_t addr, bool flip )
+    {
+        const uint8_t *page = map[(addr >> CHR_PAGE_SHIFT) & (CHR_PAGES - 1)];
+        uint32_t tile = ( page - chr + (addr & (CHR_PAGE_SIZE - CHR_TILE_SIZE)) ) / CHR_TILE_SIZE;
+        if ( chrwritable && ( chrDirty[tile >> 6] >> (tile & 63) & 1 ) ) {
+            decodeTile( tile );
+        }
+        return &chrDecoded[tile * CHR_DECODED_SIZE + ( flip ? 64 : 0 ) + ( addr & 0x7 ) * 8];
+    }
+    void decodeTile( uint32_t tile );
+    // decode every CHR-RAM tile written since its last use, tileRow then only reads
+    void decodeDirtyTiles();
+
+    // whether create has a board for header
+    static bool supported( const INESHeader &header );
+    // board for cpu.header, NULL if the mapper is not supported
+    static Mapper *create( CPU &cpu );
+};
+
+// mapper 0
+struct NROM final : Mapper
+{
+    NROM( CPU &cpu ) : Mapper( cpu ) {}
+};
+
+// mapper 1
+struct MMC1 final : Mapper
+{
+    uint8_t shift; // serial load register, bit 4 set marks a full register
+    uint8_t control;
+    uint8_t chrbank0;
+    uint8_t chrbank1;
+    uint8_t prgbank;
+
+    MMC1( CPU &cpu ) : Mapper( cpu ) {}
+    void reset();
+    void writeRegister( uint16_t addr, uint8_t val );
+    void updateBanks();
+};
+
+// mapper 2
+struct UxROM final : Mapper
+{
+    UxROM( CPU &cpu ) : Mapper( cpu ) {}
+    void writeRegister( uint16_t addr, uint8_t val );
+};
+
+// mapper 3
+struct CNROM final : Mapper
+{
+    CNROM( CPU &cpu ) : Mapper( cpu ) {}
+    void writeRegister( uint16_t addr, uint8_t val );
+};
+
+// mapper 4
+struct MMC3 final : Mapper
+{
+    uint8_t bankselect;
+    uint8_t banks[8]; // R0-R7
+    uint8_t irqlatch;
+    uint8_t irqcounter;
+    bool irqreload;
+    bool irqenabled;
+
+    // The counter is clocked by rising edges on PPU A12. Rather than watching every
+    // dot the edges are computed from the snooped PPUCTRL/PPUMASK, the counter is
+    // brought up to date lazily and the IRQ is scheduled for the predicted edge.
+    uint8_t ppuctrl;
+    uint8_t ppumask;
+    uint64_t synced; // CPU clock the counter is up to date with
+
+    MMC3( CPU &cpu ) : Mapper( cpu ) {}
+    void reset();
+    void writeRegister( uint16_t addr, uint8_t val );
+    void ppuWrite( uint16_t reg, uint8_t val );
+    void event( uint64_t time );
+    void updateBanks();
+
+    // dot within a rendered line where A12 rises, -1 while it does not
+    int a12Dot() const;
+    // number of A12 rises before PPU dot
+    uint64_t risesBefore( uint64_t dot ) const;
+    // PPU dot of rise number index counted from power on
+    uint64_t riseDot( uint64_t index ) const;
+    void clockCounter( uint64_t clocks );
+    void sync( uint64_t time );
+    void reschedule();
+};
+
+// mapper 7
+struct AxROM final : Mapper
+{
+    AxROM( CPU &cpu ) : Mapper( cpu ) {}
+    void reset();
+    void writeRegister( uint16_t addr, uint8_t val );
+};
+
+#endif
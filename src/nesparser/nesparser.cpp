@@ -2,15 +2,88 @@
 #include <fstream>
 #include <vector>
 #include <iostream>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "scanner.h"
+#include "../hash.h"
+#include "../romdb.h"
+#include "../rompack.h"
+
+static void usage()
+{
+    printf("Usage: nesparser [-d database] [file]\n");
+    printf("       nesparser -s [-f csv|jsonl] [-j threads] [directory]\n");
+    printf("       nesparser -b [csv] [database]\n");
+    printf("       nesparser -p [pack] [files or directories]\n");
+}
 
 int main( int argc, char* argv[] )
 {
-    if ( argc != 2 ) {
-        printf("Usage: nesparser [file]\n");
+    bool scan = false;
+    bool build = false;
+    const char *pack = NULL;
+    const char *database = NULL;
+    ScanFormat format = SCAN_CSV;
+    unsigned int threads = 0;
+    int opt;
+    while ( ( opt = getopt( argc, argv, "sbf:j:d:p:" ) ) != -1 ) {
+        switch ( opt ) {
+            case 's':
+                scan = true;
+                break;
+            case 'b':
+                build = true;
+                break;
+            case 'p':
+                pack = optarg;
+                break;
+            case 'd':
+                database = optarg;
+                break;
+            case 'f':
+                if ( strcmp( optarg, "csv" ) == 0 ) {
+                    format = SCAN_CSV;
+                } else if ( strcmp( optarg, "jsonl" ) == 0 ) {
+                    format = SCAN_JSONL;
+                } else {
+                    usage();
+                    return 1;
+                }
+                break;
+            case 'j':
+                threads = atoi( optarg );
+                break;
+            default:
+                usage();
+                return 1;
+        }
+    }
+    if ( scan ) {
+        return scanDirectory( optind < argc ? argv[optind] : ".", format, threads );
+    }
+    if ( pack != NULL ) {
+        std::vector<std::string> files;
+        for ( int i = optind; i < argc; i++ ) {
+            if ( collectNESFiles( argv[i], files ) == false ) {
+                return 1;
+            }
+        }
+        return RomPack::build( files, pack ) ? 0 : 1;
+    }
+    if ( build ) {
+        if ( optind != argc - 2 ) {
+            usage();
+            return 1;
+        }
+        return RomDatabase::build( argv[optind], argv[optind+1] ) ? 0 : 1;
+    }
+    if ( optind != argc - 1 ) {
+        usage();
         return 1;
     }
-    std::ifstream ifs(argv[1], std::ios_base::in |std::ios_base::binary);
-    // FILE *fp = fopen(argv[1], "rb");
+    std::ifstream ifs(argv[optind], std::ios_base::in |std::ios_base::binary);
+    // FILE *fp = fopen(argv[optind], "rb");
     if ( ifs ) {
         // uint8_t header[16];
         std::vector<uint8_t> header;
@@ -40,6 +113,29 @@ int main( int argc, char* argv[] )
         std::cout << "Name Table Mirroring: " << +tablemirror << std::endl;
         std::cout << "Mapper #: " << +mapper << std::endl;
 
+        // hash the headerless PRG+CHR data the same way the scanner does, the trainer is not part of it
+        uint32_t crc = 0;
+        uint8_t sha[SHA1_DIGEST_SIZE] = { 0 };
+        char shastr[SHA1_DIGEST_SIZE*2+1];
+        if ( hashNESFile( argv[optind], crc, sha ) == false ) {
+            printf("Error reading header\n");
+        }
+        sha1ToString( sha, shastr );
+        printf("CRC32: %.8x\n",crc);
+        printf("SHA-1: %s\n",shastr);
+        if ( database != NULL ) {
+            RomDatabase db;
+            if ( db.open( database ) == false ) {
+                return 1;
+            }
+            const RomDBEntry *entry = db.lookup( crc, sha );
+            if ( entry != NULL ) {
+                printf("Database: mapper %d, mirroring %d, region %d, battery %d\n",entry->mapper,entry->mirroring,entry->region,entry->battery);
+            } else {
+                printf("Database: unknown ROM\n");
+            }
+        }
+
         // fclose(fp);
     } else {
         return 1;
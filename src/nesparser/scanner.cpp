@@ -0,0 +1,232 @@
+#include "scanner.h"
+#include "../ines.h"
+#include "../hash.h"
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <atomic>
+#include <filesystem>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+struct ScanRecord
+{
+    bool valid;
+    INESHeader header;
+    uint64_t filesize;
+    uint32_t prgcrc;
+    uint32_t chrcrc;
+    uint32_t romcrc; // PRG + CHR without header and trainer
+    uint8_t romsha1[SHA1_DIGEST_SIZE];
+};
+
+static bool isNESFile( const std::filesystem::path &path )
+{
+    std::string ext = path.extension().string();
+    std::transform( ext.begin(), ext.end(), ext.begin(), ::tolower );
+    return ext == ".nes";
+}
+
+// read the whole file into buffer, buffer is reused between files by each worker
+static bool readFile( const std::string &path, std::vector<uint8_t> &buffer )
+{
+    int fd = open( path.c_str(), O_RDONLY );
+    if ( fd < 0 ) {
+        return false;
+    }
+    struct stat st;
+    if ( fstat( fd, &st ) != 0 ) {
+        close( fd );
+        return false;
+    }
+    posix_fadvise( fd, 0, 0, POSIX_FADV_SEQUENTIAL );
+    buffer.resize( st.st_size );
+    size_t done = 0;
+    while ( done < buffer.size() ) {
+        ssize_t n = read( fd, &buffer[done], buffer.size() - done );
+        if ( n <= 0 ) {
+            break;
+        }
+        done += n;
+    }
+    close( fd );
+    buffer.resize( done );
+    return true;
+}
+
+// false when there is no valid header, the record then only has the file size
+static bool scanFile( const std::vector<uint8_t> &data, ScanRecord &record )
+{
+    memset( &record, 0, sizeof( record ) );
+    record.filesize = data.size();
+    if ( data.size() < INES_HEADER_SIZE || parseINESHeader( &data[0], record.header ) == false ) {
+        return false;
+    }
+    const INESHeader &h = record.header;
+    // truncated dumps are still reported, hashes cover whatever data is present
+    uint64_t prgend = std::min<uint64_t>( h.prgoffset + h.prgsize, data.size() );
+    uint64_t chrend = std::min<uint64_t>( h.chroffset + h.chrsize, data.size() );
+    uint64_t prglen = prgend > h.prgoffset ? prgend - h.prgoffset : 0;
+    uint64_t chrlen = chrend > h.chroffset ? chrend - h.chroffset : 0;
+    record.valid = ( prglen == h.prgsize && chrlen == h.chrsize );
+    record.prgcrc = crc32( &data[0] + h.prgoffset, prglen );
+    record.chrcrc = crc32( &data[0] + h.chroffset, chrlen );
+    record.romcrc = crc32( &data[0] + h.chroffset, chrlen, record.prgcrc );
+    SHA1 sha;
+    sha.update( &data[0] + h.prgoffset, prglen );
+    sha.update( &data[0] + h.chroffset, chrlen );
+    sha.final( record.romsha1 );
+    return true;
+}
+
+bool hashNESFile( const std::string &path, uint32_t &romcrc, uint8_t *romsha1 )
+{
+    std::vector<uint8_t> data;
+    ScanRecord record;
+    if ( readFile( path, data ) == false || scanFile( data, record ) == false ) {
+        return false;
+    }
+    romcrc = record.romcrc;
+    memcpy( romsha1, record.romsha1, SHA1_DIGEST_SIZE );
+    return true;
+}
+
+static void jsonEscape( const std::string &in, std::string &out )
+{
+    for ( size_t i = 0; i < in.size(); i++ ) {
+        unsigned char c = in[i];
+        if ( c == '"' || c == '\\' ) {
+            out += '\\';
+            out += c;
+        } else if ( c < 0x20 ) {
+            char buf[8];
+            snprintf( buf, sizeof( buf ), "\\u%.4x", c );
+            out += buf;
+        } else {
+            out += c;
+        }
+    }
+}
+
+static void csvEscape( const std::string &in, std::string &out )
+{
+    if ( in.find_first_of( ",\"\n" ) == std::string::npos ) {
+        out += in;
+        return;
+    }
+    out += '"';
+    for ( size_t i = 0; i < in.size(); i++ ) {
+        if ( in[i] == '"' ) {
+            out += '"';
+        }
+        out += in[i];
+    }
+    out += '"';
+}
+
+static void formatRecord( const std::string &path, const ScanRecord &r, ScanFormat format, std::string &out )
+{
+    char buf[320];
+    char sha[SHA1_DIGEST_SIZE*2+1];
+    const INESHeader &h = r.header;
+    sha1ToString( r.romsha1, sha );
+    if ( format == SCAN_JSONL ) {
+        out += "{\"path\":\"";
+        jsonEscape( path, out );
+        snprintf( buf, sizeof( buf ),
+                "\",\"size\":%llu,\"valid\":%s,\"prgbanks\":%d,\"chrbanks\":%d,\"mapper\":%d,"
+                "\"mirroring\":%d,\"region\":%d,\"fourscreen\":%s,\"battery\":%s,\"trainer\":%s,\"nes2\":%s,"
+                "\"prg_crc32\":\"%.8x\",\"chr_crc32\":\"%.8x\",\"rom_crc32\":\"%.8x\",\"rom_sha1\":\"%s\"}\n",
+                (unsigned long long)r.filesize, r.valid ? "true" : "false", h.prgbanks, h.chrbanks, h.mapper,
+                h.mirroring, h.region, h.fourscreen ? "true" : "false", h.battery ? "true" : "false",
+                h.trainer ? "true" : "false", h.nes2 ? "true" : "false", r.prgcrc, r.chrcrc, r.romcrc, sha );
+    } else {
+        csvEscape( path, out );
+        snprintf( buf, sizeof( buf ), ",%llu,%d,%d,%d,%d,%d,%d,%d,%d,%d,%d,%.8x,%.8x,%.8x,%s\n",
+                (unsigned long long)r.filesize, r.valid, h.prgbanks, h.chrbanks, h.mapper,
+                h.mirroring, h.region, h.fourscreen, h.battery, h.trainer, h.nes2, r.prgcrc, r.chrcrc, r.romcrc, sha );
+    }
+    out += buf;
+}
+
+bool collectNESFiles( const std::string &path, std::vector<std::string> &files )
+{
+    std::error_code ec;
+    if ( std::filesystem::is_regular_file( path, ec ) ) {
+        files.push_back( path );
+        return true;
+    }
+    std::filesystem::recursive_directory_iterator it( path, std::filesystem::directory_options::skip_permission_denied, ec );
+    if ( ec ) {
+        fprintf( stderr, "Error opening %s: %s\n", path.c_str(), ec.message().c_str() );
+        return false;
+    }
+    for ( ; it != std::filesystem::recursive_directory_iterator(); it.increment( ec ) ) {
+        // a partial list would silently leave files out of the catalogue
+        if ( ec ) {
+            fprintf( stderr, "Error reading %s: %s\n", path.c_str(), ec.message().c_str() );
+            return false;
+        }
+        if ( it->is_regular_file( ec ) && isNESFile( it->path() ) ) {
+            files.push_back( it->path().string() );
+        }
+    }
+    return true;
+}
+
+int scanDirectory( const std::string &directory, ScanFormat format, unsigned int threads, FILE *output )
+{
+    std::vector<std::string> files;
+    if ( collectNESFiles( directory, files ) == false ) {
+        return 1;
+    }
+
+    if ( threads == 0 ) {
+        threads = std::max( 1u, std::thread::hardware_concurrency() );
+    }
+    threads = std::min<unsigned int>( threads, std::max<size_t>( files.size(), 1 ) );
+
+    if ( format == SCAN_CSV ) {
+        fprintf( output, "path,size,valid,prgbanks,chrbanks,mapper,mirroring,region,fourscreen,battery,trainer,nes2,prg_crc32,chr_crc32,rom_crc32,rom_sha1\n" );
+    }
+    fflush( output );
+
+    // workers grab files by index and flush their output in large chunks,
+    // records are written in completion order, not in directory order
+    std::atomic<size_t> next( 0 );
+    std::mutex outputLock;
+    std::vector<std::thread> workers;
+    for ( unsigned int t = 0; t < threads; t++ ) {
+        workers.push_back( std::thread( [&]() {
+            std::vector<uint8_t> buffer;
+            std::string out;
+            ScanRecord record;
+            size_t i;
+            while ( ( i = next++ ) < files.size() ) {
+                if ( readFile( files[i], buffer ) == false ) {
+                    fprintf( stderr, "Error reading %s\n", files[i].c_str() );
+                    continue;
+                }
+                scanFile( buffer, record );
+                formatRecord( files[i], record, format, out );
+                if ( out.size() > 0x10000 ) {
+                    std::lock_guard<std::mutex> lock( outputLock );
+                    fwrite( out.data(), 1, out.size(), output );
+                    out.clear();
+                }
+            }
+            std::lock_guard<std::mutex> lock( outputLock );
+            fwrite( out.data(), 1, out.size(), output );
+        } ) );
+    }
+    for ( size_t t = 0; t < workers.size(); t++ ) {
+        workers[t].join();
+    }
+    fflush( output );
+    return 0;
+}
@@ -0,0 +1,25 @@
+#ifndef __SCANNER_H__
+#define __SCANNER_H__
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+enum ScanFormat
+{
+    SCAN_CSV,
+    SCAN_JSONL,
+};
+
+// add path to files if it is a .nes file, or every .nes file below it if it is a directory
+bool collectNESFiles( const std::string &path, std::vector<std::string> &files );
+
+// walk directory recursively and write one record per .nes file to output,
+// headers are parsed and hashed on threads workers (0 = one per core)
+int scanDirectory( const std::string &directory, ScanFormat format, unsigned int threads, FILE *output = stdout );
+
+// CRC-32 and SHA-1 of PRG+CHR of one file, exactly as scanDirectory reports them.
+// False when the file cannot be read or has no valid header
+bool hashNESFile( const std::string &path, uint32_t &romcrc, uint8_t *romsha1 );
+
+#endif
@@ -0,0 +1,153 @@
+#include "observation.h"
+#include "ppu.h"
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// overlaps of source cells [i * count, (i + 1) * count) with output cells [j * size, (j + 1) * size),
+// grouped by source cell or by output cell
+static void overlaps( int size, int count, bool bySource, std::vector<Observation::Tap> &taps, std::vector<int> &start )
+{
+    int groups = bySource ? size : count;
+    std::vector< std::vector<Observation::Tap> > grouped( groups );
+    for ( int i = 0; i < size; i++ ) {
+        int first = i * count / size;
+        int last = ( (i + 1) * count - 1 ) / size;
+        for ( int j = first; j <= last; j++ ) {
+            int from = i * count > j * size ? i * count : j * size;
+            int to = (i + 1) * count < (j + 1) * size ? (i + 1) * count : (j + 1) * size;
+            if ( to > from ) {
+                Observation::Tap tap = { (uint16_t)( bySource ? j : i ), (uint16_t)( to - from ) };
+                grouped[bySource ? i : j].push_back( tap );
+            }
+        }
+    }
+    taps.clear();
+    start.assign( 1, 0 );
+    for ( int g = 0; g < groups; g++ ) {
+        taps.insert( taps.end(), grouped[g].begin(), grouped[g].end() );
+        start.push_back( taps.size() );
+    }
+}
+
+Observation::Observation()
+{
+    configure( OBSERVATION_SIZE, OBSERVATION_SIZE );
+}
+
+bool Observation::configure( int width, int height, int cropTop, int cropBottom, int cropLeft, int cropRight )
+{
+    int sourceWidth = PPU_WIDTH - cropLeft - cropRight;
+    int sourceHeight = PPU_HEIGHT - cropTop - cropBottom;
+    if ( width <= 0 || height <= 0 || cropTop < 0 || cropBottom < 0 || cropLeft < 0 || cropRight < 0 ||
+            sourceWidth <= 0 || sourceHeight <= 0 ) {
+        fprintf(stderr,"Invalid observation %dx%d cropped %d,%d,%d,%d\n",width,height,cropTop,cropBottom,cropLeft,cropRight);
+        return false;
+    }
+    this->width = width;
+    this->height = height;
+    this->cropTop = cropTop;
+    this->cropBottom = cropBottom;
+    this->cropLeft = cropLeft;
+    this->cropRight = cropRight;
+    stride = ( width + 7 ) & ~7;
+
+    // the source columns of an output column are contiguous, lay them out from the first
+    std::vector<Tap> columns;
+    std::vector<int> columnStart;
+    overlaps( sourceWidth, width, false, columns, columnStart );
+    int most = 0;
+    for ( int x = 0; x < width; x++ ) {
+        most = std::max( most, columnStart[x + 1] - columnStart[x] );
+    }
+    columnTaps = ( most + 7 ) & ~7;
+    columnFirst.assign( width, 0 );
+    columnWeights.assign( width * columnTaps, 0 );
+    for ( int x = 0; x < width; x++ ) {
+        columnFirst[x] = columns[columnStart[x]].index;
+        for ( int t = columnStart[x]; t < columnStart[x + 1]; t++ ) {
+            columnWeights[x * columnTaps + columns[t].index - columnFirst[x]] = columns[t].weight;
+        }
+    }
+    overlaps( sourceHeight, height, true, rows, rowStart );
+
+    luma.assign( sourceWidth + columnTaps, 0 );
+    line.assign( stride, 0 );
+    sums.assign( stride * height, 0 );
+    return true;
+}
+
+// luma averaged into line, taps weights per column from first[x] on
+static void sumColumns( const uint8_t *luma, const uint16_t *first, const int16_t *weights, int taps, int width, uint16_t *line )
+{
+#ifdef __SSE2__
+    const __m128i zero = _mm_setzero_si128();
+    for ( int x = 0; x < width; x++ ) {
+        const uint8_t *source = luma + first[x];
+        const int16_t *weight = weights + x * taps;
+        __m128i sum = zero;
+        for ( int t = 0; t < taps; t += 8 ) {
+            __m128i pixels = _mm_unpacklo_epi8( _mm_loadl_epi64( reinterpret_cast<const __m128i*>( source + t ) ), zero );
+            sum = _mm_add_epi32( sum, _mm_madd_epi16( pixels, _mm_loadu_si128( reinterpret_cast<const __m128i*>( weight + t ) ) ) );
+        }
+        sum = _mm_add_epi32( sum, _mm_shuffle_epi32( sum, 0x4E ) );
+        sum = _mm_add_epi32( sum, _mm_shuffle_epi32( sum, 0xB1 ) );
+        line[x] = _mm_cvtsi128_si32( sum );
+    }
+#else
+    for ( int x = 0; x < width; x++ ) {
+        const uint8_t *source = luma + first[x];
+        const int16_t *weight = weights + x * taps;
+        uint32_t sum = 0;
+        for ( int t = 0; t < taps; t++ ) {
+            sum += source[t] * weight[t];
+        }
+        line[x] = sum;
+    }
+#endif
+}
+
+// line times weight added into row, count is a multiple of 8
+static void addRow( const uint16_t *line, uint16_t weight, int count, uint32_t *row )
+{
+#ifdef __SSE2__
+    const __m128i w = _mm_set1_epi16( weight );
+    for ( int x = 0; x < count; x += 8 ) {
+        __m128i pixels = _mm_loadu_si128( reinterpret_cast<const __m128i*>( line + x ) );
+        __m128i low = _mm_mullo_epi16( pixels, w );
+        __m128i high = _mm_mulhi_epu16( pixels, w );
+        __m128i *out = reinterpret_cast<__m128i*>( row + x );
+        _mm_storeu_si128( out, _mm_add_epi32( _mm_loadu_si128( out ), _mm_unpacklo_epi16( low, high ) ) );
+        _mm_storeu_si128( out + 1, _mm_add_epi32( _mm_loadu_si128( out + 1 ), _mm_unpackhi_epi16( low, high ) ) );
+    }
+#else
+    for ( int x = 0; x < count; x++ ) {
+        row[x] += line[x] * weight;
+    }
+#endif
+}
+
+void Observation::render( PPU &ppu, uint8_t *out )
+{
+    ppu.finishFrame();
+    int sourceWidth = PPU_WIDTH - cropLeft - cropRight;
+    int sourceHeight = PPU_HEIGHT - cropTop - cropBottom;
+    std::fill( sums.begin(), sums.end(), 0 );
+    for ( int y = 0; y < sourceHeight; y++ ) {
+        int source = y + cropTop;
+        convertPixels( &ppu.framebuffer[source * PPU_WIDTH + cropLeft], sourceWidth, ppu.emphasis[source], PIXEL_GRAY8, &luma[0] );
+        sumColumns( &luma[0], &columnFirst[0], &columnWeights[0], columnTaps, width, &line[0] );
+        for ( int t = rowStart[y]; t < rowStart[y + 1]; t++ ) {
+            addRow( &line[0], rows[t].weight, stride, &sums[rows[t].index * stride] );
+        }
+    }
+    uint32_t total = sourceWidth * sourceHeight;
+    for ( int y = 0; y < height; y++ ) {
+        for ( int x = 0; x < width; x++ ) {
+            out[y * width + x] = ( sums[y * stride + x] + total / 2 ) / total;
+        }
+    }
+}
@@ -0,0 +1,60 @@
+#ifndef __OBSERVATION_H__
+#define __OBSERVATION_H__
+#include <stdint.h>
+#include <vector>
+
+struct PPU;
+
+#define OBSERVATION_SIZE 84
+
+// Grayscale frame shrunk by area averaging, the usual input of a reinforcement
+// learning agent. The crop is taken off the 256x240 picture first and what is
+// left is averaged down to width x height, a source pixel straddling two
+// output pixels is split between them by the overlap.
+//
+// Each line goes through the palette as luminance, then every output column
+// takes a fixed number of source pixels from its first one, zero weights pad
+// the columns that need fewer. That makes a column 8 source pixels at a time
+// one pmaddwd, and adding a line into its output rows 8 columns at a time.
+// Without SSE2 the same loops run scalar.
+struct Observation
+{
+    int width;
+    int height;
+    int cropTop;
+    int cropBottom;
+    int cropLeft;
+    int cropRight;
+    int stride; // width rounded up to 8, for line and sums
+
+    // contribution of one source pixel to one output pixel, in units of
+    // 1/(source size) of an output pixel
+    struct Tap
+    {
+        uint16_t index;
+        uint16_t weight;
+    };
+    // per output column columnTaps weights from source column columnFirst[x] on
+    int columnTaps; // a multiple of 8
+    std::vector<uint16_t> columnFirst;
+    std::vector<int16_t> columnWeights;
+    // per source row the output rows
+    std::vector<Tap> rows;
+    std::vector<int> rowStart;
+
+    // sized by configure so render allocates nothing
+    std::vector<uint8_t> luma; // one cropped line, zero past its end for the padded taps
+    std::vector<uint16_t> line; // the line averaged to width
+    std::vector<uint32_t> sums; // stride * height, every output adds up to sourceWidth * sourceHeight
+
+    Observation();
+
+    // false when the size or crop leave nothing to average
+    bool configure( int width, int height, int cropTop = 0, int cropBottom = 0, int cropLeft = 0, int cropRight = 0 );
+
+    // width * height bytes, one output row after the other. Waits for the
+    // lines the PPU still draws
+    void render( PPU &ppu, uint8_t *out );
+};
+
+#endif
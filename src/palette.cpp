@@ -0,0 +1,204 @@
+#include "palette.h"
+#include <string.h>
+#if defined( __x86_64__ ) || defined( __i386__ )
+#include <tmmintrin.h>
+#define PALETTE_SSSE3
+#endif
+
+// 2C02 colors without emphasis
+static const uint8_t basePalette[64][3] = {
+    {  84,  84,  84 }, {   0,  30, 116 }, {   8,  16, 144 }, {  48,   0, 136 },
+    {  68,   0, 100 }, {  92,   0,  48 }, {  84,   4,   0 }, {  60,  24,   0 },
+    {  32,  42,   0 }, {   8,  58,   0 }, {   0,  64,   0 }, {   0,  60,   0 },
+    {   0,  50,  60 }, {   0,   0,   0 }, {   0,   0,   0 }, {   0,   0,   0 },
+    { 152, 150, 152 }, {   8,  76, 196 }, {  48,  50, 236 }, {  92,  30, 228 },
+    { 136,  20, 176 }, { 160,  20, 100 }, { 152,  34,  32 }, { 120,  60,   0 },
+    {  84,  90,   0 }, {  40, 114,   0 }, {   8, 124,   0 }, {   0, 118,  40 },
+    {   0, 102, 120 }, {   0,   0,   0 }, {   0,   0,   0 }, {   0,   0,   0 },
+    { 236, 238, 236 }, {  76, 154, 236 }, { 120, 124, 236 }, { 176,  98, 236 },
+    { 228,  84, 236 }, { 236,  88, 180 }, { 236, 106, 100 }, { 212, 136,  32 },
+    { 160, 170,   0 }, { 116, 196,   0 }, {  76, 208,  32 }, {  56, 204, 108 },
+    {  56, 180, 204 }, {  60,  60,  60 }, {   0,   0,   0 }, {   0,   0,   0 },
+    { 236, 238, 236 }, { 168, 204, 236 }, { 188, 188, 236 }, { 212, 178, 236 },
+    { 236, 174, 236 }, { 236, 174, 212 }, { 236, 180, 176 }, { 228, 196, 144 },
+    { 204, 210, 120 }, { 180, 222, 120 }, { 168, 226, 144 }, { 152, 226, 180 },
+    { 160, 214, 228 }, { 160, 162, 160 }, {   0,   0,   0 }, {   0,   0,   0 },
+};
+
+// Lookup tables for all 8 emphasis settings. The planes keep one byte of the
+// output per table so the vector path can look them up 16 entries at a time.
+struct PaletteTables
+{
+    uint8_t rgb[8][64][3];
+    uint8_t rgbaPlanes[8][3][64]; // R, G, B
+    uint8_t rgb565Planes[8][2][64]; // low byte, high byte
+    uint8_t luma[8][64]; // BT.601 weights
+
+    PaletteTables()
+    {
+        for ( int e = 0; e < 8; e++ ) {
+            for ( int i = 0; i < 64; i++ ) {
+                for ( int c = 0; c < 3; c++ ) {
+                    int value = basePalette[i][c];
+                    // emphasis darkens the channels not emphasized, blacks stay black
+                    if ( e != 0 && ( e & (1 << c) ) == 0 && ( i & 0xE ) != 0xE ) {
+                        value = value * 209 / 256;
+                    }
+                    rgb[e][i][c] = value;
+                    rgbaPlanes[e][c][i] = value;
+                }
+                uint16_t rgb565 = ( (rgb[e][i][0] >> 3) << 11 ) | ( (rgb[e][i][1] >> 2) << 5 ) | ( rgb[e][i][2] >> 3 );
+                rgb565Planes[e][0][i] = rgb565 & 0xFF;
+                rgb565Planes[e][1][i] = rgb565 >> 8;
+                luma[e][i] = ( 77 * rgb[e][i][0] + 150 * rgb[e][i][1] + 29 * rgb[e][i][2] + 128 ) >> 8;
+            }
+        }
+    }
+};
+
+static const PaletteTables tables;
+
+int pixelSize( PixelFormat format )
+{
+    switch ( format ) {
+        case PIXEL_RGBA8888:
+            return 4;
+        case PIXEL_RGB565:
+            return 2;
+        case PIXEL_GRAY8:
+            return 1;
+        default:
+            return 1;
+    }
+}
+
+uint32_t paletteColor( uint8_t index, uint8_t emphasis )
+{
+    const uint8_t *rgb = tables.rgb[emphasis & 0x7][index & 0x3F];
+    return ( rgb[0] << 16 ) | ( rgb[1] << 8 ) | rgb[2];
+}
+
+void convertPixelsScalar( const uint8_t *indices, int count, uint8_t emphasis, PixelFormat format, void *out )
+{
+    emphasis &= 0x7;
+    switch ( format ) {
+        case PIXEL_RGBA8888:
+            {
+                uint8_t *dst = static_cast<uint8_t*>( out );
+                for ( int i = 0; i < count; i++ ) {
+                    memcpy( dst + i * 4, tables.rgb[emphasis][indices[i] & 0x3F], 3 );
+                    dst[i * 4 + 3] = 0xFF;
+                }
+            }
+            break;
+        case PIXEL_RGB565:
+            {
+                uint16_t *dst = static_cast<uint16_t*>( out );
+                const uint8_t (*planes)[64] = tables.rgb565Planes[emphasis];
+                for ( int i = 0; i < count; i++ ) {
+                    dst[i] = planes[0][indices[i] & 0x3F] | ( planes[1][indices[i] & 0x3F] << 8 );
+                }
+            }
+            break;
+        case PIXEL_GRAY8:
+            {
+                uint8_t *dst = static_cast<uint8_t*>( out );
+                for ( int i = 0; i < count; i++ ) {
+                    dst[i] = tables.luma[emphasis][indices[i] & 0x3F];
+                }
+            }
+            break;
+        default:
+            {
+                uint8_t *dst = static_cast<uint8_t*>( out );
+                for ( int i = 0; i < count; i++ ) {
+                    dst[i] = indices[i] & 0x3F;
+                }
+            }
+            break;
+    }
+}
+
+#ifdef PALETTE_SSSE3
+// One byte per pixel out of a 64 entry plane, pshufb looks up 16 entries at a
+// time. The control for quarter q is index - 16q pushed up by 0x70 with
+// saturation, indices outside the quarter end up with bit 7 set and read 0.
+__attribute__(( target( "ssse3" ) ))
+static inline __m128i lookupPlane( const __m128i *plane, const __m128i *control )
+{
+    __m128i out = _mm_shuffle_epi8( plane[0], control[0] );
+    out = _mm_or_si128( out, _mm_shuffle_epi8( plane[1], control[1] ) );
+    out = _mm_or_si128( out, _mm_shuffle_epi8( plane[2], control[2] ) );
+    return _mm_or_si128( out, _mm_shuffle_epi8( plane[3], control[3] ) );
+}
+
+__attribute__(( target( "ssse3" ) ))
+static int convertPixelsSSSE3( const uint8_t *indices, int count, uint8_t emphasis, PixelFormat format, void *out )
+{
+    const uint8_t *source[3] = {
+        format == PIXEL_RGBA8888 ? tables.rgbaPlanes[emphasis][0] : tables.rgb565Planes[emphasis][0],
+        format == PIXEL_RGBA8888 ? tables.rgbaPlanes[emphasis][1] : tables.rgb565Planes[emphasis][1],
+        tables.rgbaPlanes[emphasis][2],
+    };
+    if ( format == PIXEL_GRAY8 ) {
+        source[0] = tables.luma[emphasis];
+    }
+    __m128i plane[3][4];
+    for ( int p = 0; p < 3; p++ ) {
+        for ( int q = 0; q < 4; q++ ) {
+            plane[p][q] = _mm_loadu_si128( reinterpret_cast<const __m128i*>( source[p] + q * 16 ) );
+        }
+    }
+    const __m128i low6 = _mm_set1_epi8( 0x3F );
+    const __m128i bias = _mm_set1_epi8( 0x70 );
+    const __m128i alpha = _mm_set1_epi8( -1 );
+    int i = 0;
+    for ( ; i + 16 <= count; i += 16 ) {
+        __m128i index = _mm_and_si128( _mm_loadu_si128( reinterpret_cast<const __m128i*>( indices + i ) ), low6 );
+        __m128i control[4];
+        for ( int q = 0; q < 4; q++ ) {
+            control[q] = _mm_adds_epu8( _mm_sub_epi8( index, _mm_set1_epi8( q * 16 ) ), bias );
+        }
+        __m128i first = lookupPlane( plane[0], control );
+        if ( format == PIXEL_GRAY8 ) {
+            _mm_storeu_si128( reinterpret_cast<__m128i*>( static_cast<uint8_t*>( out ) + i ), first );
+            continue;
+        }
+        __m128i second = lookupPlane( plane[1], control );
+        if ( format == PIXEL_RGBA8888 ) {
+            __m128i blue = lookupPlane( plane[2], control );
+            __m128i rg = _mm_unpacklo_epi8( first, second );
+            __m128i ba = _mm_unpacklo_epi8( blue, alpha );
+            __m128i *dst = reinterpret_cast<__m128i*>( static_cast<uint8_t*>( out ) + i * 4 );
+            _mm_storeu_si128( dst, _mm_unpacklo_epi16( rg, ba ) );
+            _mm_storeu_si128( dst + 1, _mm_unpackhi_epi16( rg, ba ) );
+            rg = _mm_unpackhi_epi8( first, second );
+            ba = _mm_unpackhi_epi8( blue, alpha );
+            _mm_storeu_si128( dst + 2, _mm_unpacklo_epi16( rg, ba ) );
+            _mm_storeu_si128( dst + 3, _mm_unpackhi_epi16( rg, ba ) );
+        } else {
+            __m128i *dst = reinterpret_cast<__m128i*>( static_cast<uint16_t*>( out ) + i );
+            _mm_storeu_si128( dst, _mm_unpacklo_epi8( first, second ) );
+            _mm_storeu_si128( dst + 1, _mm_unpackhi_epi8( first, second ) );
+        }
+    }
+    return i;
+}
+#endif
+
+void convertPixels( const uint8_t *indices, int count, uint8_t emphasis, PixelFormat format, void *out )
+{
+    emphasis &= 0x7;
+    int done = 0;
+#ifdef PALETTE_SSSE3
+    static const bool ssse3 = __builtin_cpu_supports( "ssse3" );
+    if ( ssse3 && format != PIXEL_INDEXED ) {
+        done = convertPixelsSSSE3( indices, count, emphasis, format, out );
+    }
+#endif
+    // the rest, or everything without SSSE3
+    if ( done < count ) {
+        void *rest = static_cast<uint8_t*>( out ) + done * pixelSize( format );
+        convertPixelsScalar( indices + done, count - done, emphasis, format, rest );
+    }
+}
@@ -0,0 +1,27 @@
+#ifndef __PALETTE_H__
+#define __PALETTE_H__
+#include <stdint.h>
+
+// output formats for the PPU framebuffer
+enum PixelFormat
+{
+    PIXEL_INDEXED = 0, // 6 bit palette index, one byte
+    PIXEL_RGBA8888, // bytes R, G, B, A in memory
+    PIXEL_RGB565, // native endian uint16_t
+    PIXEL_GRAY8, // luminance, one byte
+};
+
+// bytes per pixel of format
+int pixelSize( PixelFormat format );
+
+// Convert count palette indices to format. emphasis is PPUMASK bits 5-7
+// shifted down, red, green and blue. Uses SSSE3 when the CPU has it.
+void convertPixels( const uint8_t *indices, int count, uint8_t emphasis, PixelFormat format, void *out );
+
+// table lookup per pixel, the reference for the vector path
+void convertPixelsScalar( const uint8_t *indices, int count, uint8_t emphasis, PixelFormat format, void *out );
+
+// RGB of palette index with emphasis, packed as 0xRRGGBB
+uint32_t paletteColor( uint8_t index, uint8_t emphasis );
+
+#endif
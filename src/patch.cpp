@@ -0,0 +1,209 @@
+#include "patch.h"
+#include "hash.h"
+#include "ines.h"
+#include <stdio.h>
+#include <string.h>
+#include <deque>
+#include <map>
+#include <mutex>
+
+#define PATCH_CACHE_SIZE 16
+// largest .nes image a header can describe with bank counts, bigger targets are corrupt
+#define PATCH_TARGET_MAX ( INES_HEADER_SIZE + INES_TRAINER_SIZE + 0xFFFull * ( INES_PRG_BANK_SIZE + INES_CHR_BANK_SIZE ) )
+
+bool applyIPS( const uint8_t *patch, size_t size, std::vector<uint8_t> &image )
+{
+    if ( size < 8 || memcmp( patch, "PATCH", 5 ) != 0 ) {
+        return false;
+    }
+    size_t pos = 5;
+    while ( pos + 3 <= size ) {
+        if ( memcmp( &patch[pos], "EOF", 3 ) == 0 ) {
+            pos += 3;
+            // optional truncation extension
+            if ( pos + 3 <= size ) {
+                image.resize( (patch[pos] << 16) | (patch[pos+1] << 8) | patch[pos+2] );
+            }
+            return true;
+        }
+        if ( pos + 5 > size ) {
+            return false;
+        }
+        uint32_t offset = (patch[pos] << 16) | (patch[pos+1] << 8) | patch[pos+2];
+        uint32_t length = (patch[pos+3] << 8) | patch[pos+4];
+        pos += 5;
+        if ( length == 0 ) { // run length encoded record
+            if ( pos + 3 > size ) {
+                return false;
+            }
+            length = (patch[pos] << 8) | patch[pos+1];
+            if ( offset + length > image.size() ) {
+                image.resize( offset + length );
+            }
+            memset( &image[offset], patch[pos+2], length );
+            pos += 3;
+        } else {
+            if ( pos + length > size ) {
+                return false;
+            }
+            if ( offset + length > image.size() ) {
+                image.resize( offset + length );
+            }
+            memcpy( &image[offset], &patch[pos], length );
+            pos += length;
+        }
+    }
+    return false;
+}
+
+static bool readBPSNumber( const uint8_t *patch, size_t end, size_t &pos, uint64_t &value )
+{
+    value = 0;
+    uint64_t shift = 1;
+    while ( pos < end ) {
+        uint8_t x = patch[pos++];
+        value += ( x & 0x7F ) * shift;
+        if ( x & 0x80 ) {
+            return true;
+        }
+        shift <<= 7;
+        value += shift;
+    }
+    return false;
+}
+
+static uint32_t readLE32( const uint8_t *p )
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+bool applyBPS( const uint8_t *patch, size_t size, const std::vector<uint8_t> &source, std::vector<uint8_t> &target )
+{
+    if ( size < 16 || memcmp( patch, "BPS1", 4 ) != 0 ) {
+        return false;
+    }
+    size_t end = size - 12;
+    if ( crc32( patch, size - 4 ) != readLE32( &patch[size-4] ) ||
+            crc32( source.data(), source.size() ) != readLE32( &patch[end] ) ) {
+        return false;
+    }
+    size_t pos = 4;
+    uint64_t sourceSize, targetSize, metadataSize;
+    if ( !readBPSNumber( patch, end, pos, sourceSize ) || !readBPSNumber( patch, end, pos, targetSize ) ||
+            !readBPSNumber( patch, end, pos, metadataSize ) || sourceSize != source.size() || metadataSize > end - pos ||
+            targetSize > PATCH_TARGET_MAX ) {
+        return false;
+    }
+    pos += metadataSize;
+    target.assign( targetSize, 0 );
+
+    uint64_t output = 0, sourceRelative = 0, targetRelative = 0;
+    while ( pos < end ) {
+        uint64_t data;
+        if ( !readBPSNumber( patch, end, pos, data ) ) {
+            return false;
+        }
+        uint64_t command = data & 3;
+        uint64_t length = ( data >> 2 ) + 1;
+        if ( output + length > targetSize ) {
+            return false;
+        }
+        if ( command == 0 ) { // SourceRead
+            if ( output + length > sourceSize ) {
+                return false;
+            }
+            memcpy( &target[output], &source[output], length );
+        } else if ( command == 1 ) { // TargetRead
+            if ( pos + length > end ) {
+                return false;
+            }
+            memcpy( &target[output], &patch[pos], length );
+            pos += length;
+        } else {
+            if ( !readBPSNumber( patch, end, pos, data ) ) {
+                return false;
+            }
+            uint64_t &relative = ( command == 2 ) ? sourceRelative : targetRelative;
+            uint64_t offset = data >> 1;
+            // an offset moving before the start or wrapping around is corrupt
+            if ( ( data & 1 ) ? offset > relative : relative + offset < relative ) {
+                return false;
+            }
+            relative = ( data & 1 ) ? relative - offset : relative + offset;
+            if ( command == 2 ) { // SourceCopy
+                if ( relative > sourceSize || length > sourceSize - relative ) {
+                    return false;
+                }
+                memcpy( &target[output], &source[relative], length );
+            } else { // TargetCopy, may overlap the output on purpose
+                if ( relative >= output ) {
+                    return false;
+                }
+                for ( uint64_t i = 0; i < length; i++ ) {
+                    target[output + i] = target[relative + i];
+                }
+            }
+            relative += length;
+        }
+        output += length;
+    }
+    return output == targetSize && crc32( target.data(), target.size() ) == readLE32( &patch[end+4] );
+}
+
+static std::mutex cacheLock;
+static std::map<uint64_t, PatchedImage> cache;
+static std::deque<uint64_t> cacheOrder;
+
+PatchedImage patchNESImage( const std::vector<uint8_t> &base, const std::vector<uint8_t> &patch )
+{
+    uint64_t key = ( (uint64_t)crc32( base.data(), base.size() ) << 32 ) | crc32( patch.data(), patch.size() );
+    {
+        std::lock_guard<std::mutex> lock( cacheLock );
+        std::map<uint64_t, PatchedImage>::iterator it = cache.find( key );
+        if ( it != cache.end() ) {
+            return it->second;
+        }
+    }
+
+    std::shared_ptr<std::vector<uint8_t>> image( new std::vector<uint8_t>() );
+    bool ok = false;
+    if ( patch.size() >= 5 && memcmp( patch.data(), "PATCH", 5 ) == 0 ) {
+        *image = base;
+        ok = applyIPS( patch.data(), patch.size(), *image );
+    } else if ( patch.size() >= 4 && memcmp( patch.data(), "BPS1", 4 ) == 0 ) {
+        ok = applyBPS( patch.data(), patch.size(), base, *image );
+        if ( ok == false && base.size() > INES_HEADER_SIZE ) {
+            // patch made against the headerless ROM, keep the original header in front
+            std::vector<uint8_t> headerless( base.begin() + INES_HEADER_SIZE, base.end() );
+            std::vector<uint8_t> target;
+            ok = applyBPS( patch.data(), patch.size(), headerless, target );
+            image->assign( base.begin(), base.begin() + INES_HEADER_SIZE );
+            image->insert( image->end(), target.begin(), target.end() );
+        }
+    } else {
+        fprintf(stderr,"Unknown patch format\n");
+        return PatchedImage();
+    }
+    if ( ok == false ) {
+        fprintf(stderr,"Error applying patch\n");
+        return PatchedImage();
+    }
+
+    std::lock_guard<std::mutex> lock( cacheLock );
+    if ( cache.find( key ) == cache.end() ) {
+        cache[key] = image;
+        cacheOrder.push_back( key );
+        if ( cacheOrder.size() > PATCH_CACHE_SIZE ) {
+            cache.erase( cacheOrder.front() );
+            cacheOrder.pop_front();
+        }
+    }
+    return cache[key];
+}
+
+void clearPatchCache()
+{
+    std::lock_guard<std::mutex> lock( cacheLock );
+    cache.clear();
+    cacheOrder.clear();
+}
@@ -0,0 +1,23 @@
+#ifndef __PATCH_H__
+#define __PATCH_H__
+#include <stdint.h>
+#include <stddef.h>
+#include <memory>
+#include <vector>
+
+typedef std::shared_ptr<const std::vector<uint8_t>> PatchedImage;
+
+// apply an IPS patch to image in place, records past the end grow the image
+bool applyIPS( const uint8_t *patch, size_t size, std::vector<uint8_t> &image );
+
+// apply a BPS patch to source into target, checksums in the patch are verified
+bool applyBPS( const uint8_t *patch, size_t size, const std::vector<uint8_t> &source, std::vector<uint8_t> &target );
+
+// patch a .nes image with an IPS or BPS patch, detected from the patch magic.
+// Results are cached by the CRC-32 of base and patch so loading the same hack again skips patching.
+// BPS patches made against a headerless ROM are applied behind the original header.
+PatchedImage patchNESImage( const std::vector<uint8_t> &base, const std::vector<uint8_t> &patch );
+
+void clearPatchCache();
+
+#endif
@@ -0,0 +1,922 @@
+#include "ppu.h"
+#include "6502.h"
+#include "mapper.h"
+#include "workers.h"
+
+PPU::PPU( CPU &cpu )
+    : cpu( cpu ),
+      linesPending( false )
+{
+    reset();
+}
+
+PPU::~PPU()
+{
+    finishFrame();
+}
+
+void PPU::reset()
+{
+    finishFrame();
+    memset( oam, 0, sizeof( oam ) );
+    oamaddr = 0;
+    ctrl = 0;
+    mask = 0;
+    status = 0;
+    v = 0;
+    t = 0;
+    x = 0;
+    w = false;
+    readbuffer = 0;
+    latch = 0;
+    memset( vram, 0, sizeof( vram ) );
+    memset( palette, 0, sizeof( palette ) );
+    memset( framebuffer, 0, sizeof( framebuffer ) );
+    memset( emphasis, 0, sizeof( emphasis ) );
+    // frames stay aligned to dot 0 at power on, the MMC3 A12 prediction relies on it
+    dot = cpu.clock() * PPU_DOTS_PER_CPU_CYCLE;
+    line = ( dot % PPU_DOTS_PER_FRAME ) / PPU_DOTS_PER_LINE;
+    lineDot = dot % PPU_DOTS_PER_LINE;
+    frame = 0;
+    lineX = 0;
+    renderSkip = false;
+    frameSkipped = false;
+    hashFrames = false;
+    reuseBackground = true;
+    memset( background, 0, sizeof( background ) );
+    memset( backgroundDrawn, 0, sizeof( backgroundDrawn ) );
+    chrWrites = 0;
+    memset( rowWrites, 0, sizeof( rowWrites ) );
+    backgroundPixels = 0;
+    backgroundReused = 0;
+    frameHash = 0;
+    frameHashed = 0;
+    memset( &scan, 0, sizeof( scan ) );
+    for ( auto &band : bands ) {
+        memset( &band, 0, sizeof( band ) );
+    }
+    spriteListStale = true;
+    statusPredicted = false;
+    sprite0Dot = EVENT_NEVER;
+    overflowDot = EVENT_NEVER;
+}
+
+void PPU::start()
+{
+    // the only scheduled stop is vblank, everything else waits for a register access.
+    // The event lands after dot 1 of line 241 so that dot is already run
+    uint64_t vblank = (uint64_t)PPU_VBLANK_LINE * PPU_DOTS_PER_LINE + 2;
+    uint64_t next = dot - dot % PPU_DOTS_PER_FRAME + vblank;
+    if ( next <= dot ) {
+        next += PPU_DOTS_PER_FRAME;
+    }
+    cpu.scheduler.schedule( EVENT_PPU, ( next + PPU_DOTS_PER_CPU_CYCLE - 1 ) / PPU_DOTS_PER_CPU_CYCLE );
+}
+
+void PPU::event( uint64_t time )
+{
+    catchUp( time * PPU_DOTS_PER_CPU_CYCLE );
+    start();
+}
+
+void PPU::skipRendering( bool skip )
+{
+    renderSkip = skip;
+}
+
+void PPU::renderThreads( int threads )
+{
+    finishFrame();
+    if ( threads <= 1 ) {
+        workers.reset();
+        bands.clear();
+        handoff.reset();
+        return;
+    }
+    workers.reset( new WorkerPool( threads - 1 ) );
+    Scanline blank;
+    memset( &blank, 0, sizeof( blank ) );
+    bands.assign( (PPU_HEIGHT + PPU_BAND_LINES - 1) / PPU_BAND_LINES, blank );
+    handoff.reset( new Handoff );
+    handoff->band = [this]( int b ) { renderBand( b ); };
+}
+
+void PPU::finishFrame()
+{
+    if ( linesPending == false ) {
+        return;
+    }
+    workers->wait();
+    int count = ( handoff->lines + PPU_BAND_LINES - 1 ) / PPU_BAND_LINES;
+    for ( int b = 0; b < count; b++ ) {
+        backgroundPixels += handoff->drawn[b];
+        backgroundReused += handoff->reused[b];
+    }
+    linesPending = false;
+}
+
+void PPU::sync()
+{
+    catchUp( cpu.clock() * PPU_DOTS_PER_CPU_CYCLE );
+    // whatever the caller changes next can move the hit
+    statusPredicted = false;
+}
+
+void PPU::catchUp( uint64_t target )
+{
+    if ( !cpu.mapper ) {
+        return;
+    }
+    while ( dot < target ) {
+        if ( statusPredicted == false ) {
+            predictStatus();
+        }
+        // nothing happens after dot 1 of line 241 until the pre-render line
+        bool idle = line == PPU_VBLANK_LINE ? lineDot > 1 : line > PPU_VBLANK_LINE && line < PPU_PRERENDER_LINE;
+        uint64_t prerender = dot + (uint64_t)( PPU_PRERENDER_LINE - line ) * PPU_DOTS_PER_LINE - lineDot;
+        if ( idle && target >= prerender ) {
+            dot = prerender;
+            line = PPU_PRERENDER_LINE;
+            lineDot = 0;
+            continue;
+        }
+        if ( workers && line < PPU_HEIGHT && lineDot == 0 && frameSkipped == false ) {
+            int lines = (int)( ( target - dot ) / PPU_DOTS_PER_LINE );
+            if ( lines > PPU_HEIGHT - line ) {
+                lines = PPU_HEIGHT - line;
+            }
+            if ( lines >= PPU_PARALLEL_LINES ) {
+                renderLines( lines );
+                continue;
+            }
+        }
+        int to = PPU_DOTS_PER_LINE;
+        if ( target - dot < (uint64_t)( PPU_DOTS_PER_LINE - lineDot ) ) {
+            to = lineDot + (int)( target - dot );
+        }
+        runLine( lineDot, to );
+        dot += to - lineDot;
+        lineDot = to;
+        if ( lineDot == PPU_DOTS_PER_LINE ) {
+            lineDot = 0;
+            lineX = 0;
+            if ( ++line == PPU_LINES_PER_FRAME ) {
+                line = 0;
+                frameSkipped = renderSkip;
+            }
+        }
+    }
+    updateStatus( dot );
+}
+
+void PPU::runLine( int from, int to )
+{
+    bool rendering = mask & PPUMASK_RENDERING;
+    if ( line < PPU_HEIGHT ) {
+        // the status flags are predicted, a skipped frame only keeps v moving
+        if ( frameSkipped == false ) {
+            DrawState d;
+            liveState( d );
+            scan.state = &d;
+            scan.line = line;
+            scan.v = v;
+            scan.lineX = lineX;
+            if ( from == 0 ) {
+                evaluateSprites( scan );
+            }
+            // pixel x is output on dot x + 1
+            int x0 = from > 1 ? from - 1 : 0;
+            int x1 = to - 1 < PPU_WIDTH ? to - 1 : PPU_WIDTH;
+            if ( x0 < x1 ) {
+                renderPixels( scan, x0, x1 );
+                backgroundPixels += scan.backgroundPixels;
+                backgroundReused += scan.backgroundReused;
+            }
+        }
+    } else if ( line == PPU_VBLANK_LINE ) {
+        if ( from <= 1 && to > 1 ) {
+            status |= PPUSTATUS_VBLANK;
+            frame++;
+            if ( hashFrames && frameSkipped == false ) {
+                finishFrame();
+                frameHash = hashFrame();
+                frameHashed = frame;
+            }
+            if ( ctrl & PPUCTRL_NMI ) {
+                raiseNMI();
+            }
+        }
+        return;
+    } else if ( line == PPU_PRERENDER_LINE ) {
+        // the next frame draws over the lines still out with the workers
+        finishFrame();
+        if ( from <= 1 && to > 1 ) {
+            status &= ~( PPUSTATUS_VBLANK | PPUSTATUS_SPRITE0 | PPUSTATUS_OVERFLOW );
+            // a hit not yet applied belongs to the frame that just ended
+            statusPredicted = false;
+            sprite0Dot = EVENT_NEVER;
+            overflowDot = EVENT_NEVER;
+        }
+    } else {
+        return;
+    }
+
+    if ( rendering ) {
+        if ( from <= 256 && to > 256 ) {
+            incrementY( v );
+        }
+        if ( from <= 257 && to > 257 ) {
+            v = ( v & 0x7BE0 ) | ( t & 0x041F );
+            lineX = 0;
+        }
+        // vertical scroll is reloaded from t over dots 280-304, after the increment at 256
+        if ( line == PPU_PRERENDER_LINE && from <= 304 && to > 280 ) {
+            v = ( v & 0x041F ) | ( t & 0x7BE0 );
+        }
+    }
+}
+
+void PPU::renderLines( int lines )
+{
+    finishFrame();
+    Handoff &h = *handoff;
+    // nothing changes on the way, so v of every line follows from the first one
+    for ( int l = 0; l < lines; l++ ) {
+        h.lineV[l] = v;
+        if ( mask & PPUMASK_RENDERING ) {
+            incrementY( v );
+            v = ( v & 0x7BE0 ) | ( t & 0x041F );
+        }
+    }
+    // the bands must not fill in the sprite lists or decode tiles themselves
+    if ( spriteListStale ) {
+        buildSpriteLists();
+    }
+    cpu.mapper->decodeDirtyTiles();
+
+    // the CPU goes on changing the live state while the bands draw from this copy
+    memcpy( h.palette, palette, sizeof( palette ) );
+    memcpy( h.vram, vram, sizeof( vram ) );
+    memcpy( h.oam, oam, sizeof( oam ) );
+    memcpy( h.spriteList, spriteList, sizeof( spriteList ) );
+    memcpy( h.spriteCount, spriteCount, sizeof( spriteCount ) );
+    memcpy( h.rowWrites, rowWrites, sizeof( rowWrites ) );
+    liveState( h.state );
+    h.state.palette = h.palette;
+    h.state.vram = h.vram;
+    h.state.oam = h.oam;
+    h.state.spriteList = h.spriteList;
+    h.state.spriteCount = h.spriteCount;
+    h.state.rowWrites = h.rowWrites;
+    h.first = line;
+    h.lines = lines;
+    workers->start( ( lines + PPU_BAND_LINES - 1 ) / PPU_BAND_LINES, h.band );
+    linesPending = true;
+
+    line += lines;
+    dot += (uint64_t)lines * PPU_DOTS_PER_LINE;
+    lineX = 0;
+}
+
+void PPU::renderBand( int b )
+{
+    Handoff &h = *handoff;
+    Scanline &s = bands[b];
+    s.state = &h.state;
+    s.lineX = 0;
+    h.drawn[b] = 0;
+    h.reused[b] = 0;
+    for ( int l = b * PPU_BAND_LINES; l < h.lines && l < (b + 1) * PPU_BAND_LINES; l++ ) {
+        s.line = h.first + l;
+        s.v = h.lineV[l];
+        evaluateSprites( s );
+        renderPixels( s, 0, PPU_WIDTH );
+        h.drawn[b] += s.backgroundPixels;
+        h.reused[b] += s.backgroundReused;
+    }
+}
+
+void PPU::liveState( DrawState &d )
+{
+    d.ctrl = ctrl;
+    d.mask = mask;
+    d.x = x;
+    d.mirroring = cpu.mapper->mirroring;
+    d.reuseBackground = reuseBackground;
+    d.palette = palette;
+    d.vram = vram;
+    d.oam = oam;
+    d.spriteList = spriteList;
+    d.spriteCount = spriteCount;
+    memcpy( d.chrMap, cpu.mapper->chrMap, sizeof( d.chrMap ) );
+    d.chrWrites = chrWrites;
+    d.rowWrites = rowWrites;
+}
+
+void PPU::incrementY( uint16_t &addr )
+{
+    if ( ( addr & 0x7000 ) != 0x7000 ) {
+        addr += 0x1000;
+        return;
+    }
+    addr &= ~0x7000;
+    int y = ( addr & 0x03E0 ) >> 5;
+    if ( y == 29 ) {
+        y = 0;
+        addr ^= 0x0800;
+    } else if ( y == 31 ) {
+        y = 0;
+    } else {
+        y++;
+    }
+    addr = ( addr & ~0x03E0 ) | ( y << 5 );
+}
+
+bool PPU::backgroundOpaque( uint16_t lineV, int lineStartX, int px )
+{
+    int offset = px - lineStartX + x;
+    int coarse = ( lineV & 0x1F ) + ( offset >> 3 );
+    uint16_t tv = ( lineV & ~0x001F ) | ( coarse & 0x1F );
+    if ( coarse & 0x20 ) {
+        tv ^= 0x0400;
+    }
+    uint8_t index = *nametable( 0x2000 | (tv & 0x0FFF) );
+    uint16_t table = ( ctrl & PPUCTRL_BG_TABLE ) << 8;
+    return cpu.mapper->tileRow( table | ( index << 4 ) | ( (tv >> 12) & 0x7 ), false )[offset & 7] != 0;
+}
+
+void PPU::renderBackground( const Scanline &s, uint8_t *bg, int x0, int x1 )
+{
+    const DrawState &d = *s.state;
+    const uint16_t table = ( d.ctrl & PPUCTRL_BG_TABLE ) << 8;
+    int px = x0;
+    while ( px < x1 ) {
+        int offset = px - s.lineX + d.x;
+        int tile = offset >> 3;
+        int fine = offset & 7;
+
+        // coarse X of this tile, every 32 tiles crosses into the next nametable
+        int coarse = ( s.v & 0x1F ) + tile;
+        uint16_t tv = ( s.v & ~0x001F ) | ( coarse & 0x1F );
+        if ( coarse & 0x20 ) {
+            tv ^= 0x0400;
+        }
+
+        uint8_t index = d.vram[nametableOffset( 0x2000 | (tv & 0x0FFF), d.mirroring )];
+        uint8_t attribute = d.vram[nametableOffset( 0x23C0 | (tv & 0x0C00) | ((tv >> 4) & 0x38) | ((tv >> 2) & 0x07), d.mirroring )];
+        uint8_t pal = ( attribute >> ( ((tv >> 4) & 0x4) | (tv & 0x2) ) ) & 0x3;
+        const uint8_t *bits = cpu.mapper->tileRow( d.chrMap, table | ( index << 4 ) | ( (tv >> 12) & 0x7 ), false );
+        if ( fine == 0 && x1 - px >= 8 ) {
+            // whole tile, straight into the line
+            applyTilePalette( bits, pal, bg + px );
+            px += 8;
+            continue;
+        }
+        uint8_t pixels[8];
+        applyTilePalette( bits, pal, pixels );
+
+        int count = 8 - fine;
+        if ( count > x1 - px ) {
+            count = x1 - px;
+        }
+        memcpy( bg + px, pixels + fine, count );
+        px += count;
+    }
+}
+
+int PPU::spriteHeight() const
+{
+    return ( ctrl & PPUCTRL_SPRITE_SIZE ) ? 16 : 8;
+}
+
+void PPU::buildSpriteLists()
+{
+    memset( spriteCount, 0, sizeof( spriteCount ) );
+    int height = spriteHeight();
+    for ( int i = 0; i < 64; i++ ) {
+        // sprite y covers lines y + 1 to y + height
+        int first = oam[i * 4] + 1;
+        for ( int l = first; l < first + height && l < PPU_HEIGHT; l++ ) {
+            if ( spriteCount[l] < 8 ) {
+                spriteList[l][spriteCount[l]] = i;
+            }
+            if ( spriteCount[l] <= 8 ) {
+                spriteCount[l]++;
+            }
+        }
+    }
+    spriteListStale = false;
+}
+
+void PPU::updateSpriteLines( int first, int last )
+{
+    int height = spriteHeight();
+    for ( int l = first; l <= last && l < PPU_HEIGHT; l++ ) {
+        spriteCount[l] = 0;
+        for ( int i = 0; i < 64 && spriteCount[l] <= 8; i++ ) {
+            int row = l - oam[i * 4] - 1;
+            if ( row >= 0 && row < height ) {
+                if ( spriteCount[l] < 8 ) {
+                    spriteList[l][spriteCount[l]] = i;
+                }
+                spriteCount[l]++;
+            }
+        }
+    }
+}
+
+void PPU::writeOam( uint8_t val )
+{
+    uint8_t old = oam[oamaddr];
+    oam[oamaddr] = val;
+    // only Y decides which lines a sprite is on
+    if ( ( oamaddr & 0x3 ) == 0 && old != val && spriteListStale == false ) {
+        int height = spriteHeight();
+        updateSpriteLines( old + 1, old + height );
+        updateSpriteLines( val + 1, val + height );
+    }
+    oamaddr++;
+}
+
+void PPU::evaluateSprites( Scanline &s )
+{
+    const DrawState &d = *s.state;
+    if ( s.sprites ) {
+        memset( s.spriteColor, 0, sizeof( s.spriteColor ) );
+        memset( s.spriteFlags, 0, sizeof( s.spriteFlags ) );
+        s.sprites = false;
+    }
+    // handed off lines come with their lists built
+    if ( spriteListStale && d.spriteList == spriteList ) {
+        buildSpriteLists();
+    }
+    int height = ( d.ctrl & PPUCTRL_SPRITE_SIZE ) ? 16 : 8;
+    int count = d.spriteCount[s.line] < 8 ? d.spriteCount[s.line] : 8;
+    for ( int n = 0; n < count; n++ ) {
+        int i = d.spriteList[s.line][n];
+        const uint8_t *sprite = &d.oam[i * 4];
+        int row = s.line - sprite[0] - 1;
+        uint8_t attr = sprite[2];
+        if ( attr & 0x80 ) {
+            row = height - 1 - row;
+        }
+        uint16_t addr;
+        if ( height == 16 ) {
+            addr = ( (sprite[1] & 0x1) << 12 ) | ( (sprite[1] & 0xFE) << 4 );
+            if ( row >= 8 ) {
+                addr += 16;
+                row -= 8;
+            }
+        } else {
+            addr = ( (d.ctrl & PPUCTRL_SPRITE_TABLE) << 9 ) | ( sprite[1] << 4 );
+        }
+        uint8_t pixels[8];
+        applyTilePalette( cpu.mapper->tileRow( d.chrMap, addr + row, attr & 0x40 ), 0x4 | (attr & 0x3), pixels );
+        uint8_t flags = ( attr & 0x20 ) ? SPRITE_BEHIND : 0;
+        for ( int j = 0; j < 8 && sprite[3] + j < PPU_WIDTH; j++ ) {
+            // lower OAM index wins, even when it is behind the background
+            if ( pixels[j] && s.spriteColor[sprite[3] + j] == 0 ) {
+                s.spriteColor[sprite[3] + j] = pixels[j];
+                s.spriteFlags[sprite[3] + j] = flags;
+                s.sprites = true;
+            }
+        }
+    }
+}
+
+void PPU::predictStatus()
+{
+    statusPredicted = true;
+    sprite0Dot = EVENT_NEVER;
+    overflowDot = EVENT_NEVER;
+    cpu.scheduler.cancel( EVENT_SPRITE0 );
+    // nothing to find before the pre-render line has cleared the flags
+    if ( ( mask & PPUMASK_RENDERING ) == 0 || ( line >= PPU_HEIGHT && line < PPU_PRERENDER_LINE ) ||
+            ( line == PPU_PRERENDER_LINE && lineDot <= 1 ) ) {
+        return;
+    }
+    if ( spriteListStale ) {
+        buildSpriteLists();
+    }
+    bool findHit = ( status & PPUSTATUS_SPRITE0 ) == 0 && ( mask & PPUMASK_RENDERING ) == PPUMASK_RENDERING;
+    bool findOverflow = ( status & PPUSTATUS_OVERFLOW ) == 0;
+    int height = spriteHeight();
+    int top = oam[0] + 1;
+
+    // walk the remaining lines with a copy of v, the same updates runLine makes
+    uint16_t lineV = v;
+    int startX = lineX;
+    int from = lineDot;
+    uint64_t start = dot - lineDot;
+    for ( int l = line; ; ) {
+        if ( l < PPU_HEIGHT ) {
+            if ( findOverflow && from == 0 && spriteCount[l] > 8 ) {
+                overflowDot = start;
+                findOverflow = false;
+            }
+            if ( findHit && l >= top && l < top + height ) {
+                // sprite 0 is first in the list and always wins its pixels
+                int row = l - top;
+                uint8_t attr = oam[2];
+                if ( attr & 0x80 ) {
+                    row = height - 1 - row;
+                }
+                uint16_t addr;
+                if ( height == 16 ) {
+                    addr = ( (oam[1] & 0x1) << 12 ) | ( (oam[1] & 0xFE) << 4 );
+                    if ( row >= 8 ) {
+                        addr += 16;
+                        row -= 8;
+                    }
+                } else {
+                    addr = ( (ctrl & PPUCTRL_SPRITE_TABLE) << 9 ) | ( oam[1] << 4 );
+                }
+                const uint8_t *bits = cpu.mapper->tileRow( addr + row, attr & 0x40 );
+                int left = ( mask & PPUMASK_BG_LEFT ) && ( mask & PPUMASK_SPRITE_LEFT ) ? 0 : 8;
+                for ( int j = 0; j < 8; j++ ) {
+                    int px = oam[3] + j;
+                    // no hit at x 255, nor on a pixel this line already drew
+                    if ( px >= 255 || px < left || px + 1 < from || bits[j] == 0 ) {
+                        continue;
+                    }
+                    if ( backgroundOpaque( lineV, startX, px ) ) {
+                        sprite0Dot = start + px + 1;
+                        findHit = false;
+                        break;
+                    }
+                }
+            }
+        }
+        if ( ( findHit == false && findOverflow == false ) || l == PPU_HEIGHT - 1 ) {
+            break;
+        }
+        if ( from <= 256 ) {
+            incrementY( lineV );
+        }
+        if ( from <= 257 ) {
+            lineV = ( lineV & 0x7BE0 ) | ( t & 0x041F );
+        }
+        // the same window as runLine, t written inside it still gets copied
+        if ( l == PPU_PRERENDER_LINE && from <= 304 ) {
+            lineV = ( lineV & 0x041F ) | ( t & 0x7BE0 );
+        }
+        l = l == PPU_PRERENDER_LINE ? 0 : l + 1;
+        from = 0;
+        startX = 0;
+        start += PPU_DOTS_PER_LINE;
+    }
+    if ( sprite0Dot != EVENT_NEVER ) {
+        cpu.scheduler.schedule( EVENT_SPRITE0, ( sprite0Dot + PPU_DOTS_PER_CPU_CYCLE ) / PPU_DOTS_PER_CPU_CYCLE );
+    }
+}
+
+void PPU::updateStatus( uint64_t now )
+{
+    if ( sprite0Dot < now ) {
+        status |= PPUSTATUS_SPRITE0;
+        sprite0Dot = EVENT_NEVER;
+    }
+    if ( overflowDot < now ) {
+        status |= PPUSTATUS_OVERFLOW;
+        overflowDot = EVENT_NEVER;
+    }
+}
+
+void PPU::statusEvent( uint64_t time )
+{
+    if ( statusPredicted == false ) {
+        predictStatus();
+    }
+    updateStatus( time * PPU_DOTS_PER_CPU_CYCLE );
+}
+
+uint8_t PPU::readStatus()
+{
+    uint64_t now = cpu.clock() * PPU_DOTS_PER_CPU_CYCLE;
+    // vblank is set on dot 1 of line 241 and the flags are cleared on dot 1 of the
+    // pre-render line, running up to either is cheap
+    int changeLine = PPU_VBLANK_LINE;
+    if ( line > PPU_VBLANK_LINE || ( line == PPU_VBLANK_LINE && lineDot > 1 ) ) {
+        changeLine = PPU_PRERENDER_LINE;
+    }
+    if ( line == PPU_PRERENDER_LINE && lineDot > 1 ) {
+        changeLine = PPU_LINES_PER_FRAME + PPU_VBLANK_LINE;
+    }
+    uint64_t change = dot - lineDot + (uint64_t)( changeLine - line ) * PPU_DOTS_PER_LINE + 1;
+    if ( now > change ) {
+        sync();
+    }
+    if ( statusPredicted == false ) {
+        predictStatus();
+    }
+    updateStatus( now );
+
+    uint8_t val = ( status & 0xE0 ) | ( latch & 0x1F );
+    status &= ~PPUSTATUS_VBLANK;
+    w = false;
+    return val;
+}
+
+void PPU::renderPixels( Scanline &s, int x0, int x1 )
+{
+    const DrawState &d = *s.state;
+    uint8_t *out = &framebuffer[s.line * PPU_WIDTH];
+    emphasis[s.line] = ( d.mask & PPUMASK_EMPHASIS ) >> 5;
+    uint8_t gray = ( d.mask & PPUMASK_GRAYSCALE ) ? 0x30 : 0x3F;
+    s.backgroundPixels = 0;
+    s.backgroundReused = 0;
+    if ( x0 == 0 ) {
+        s.reused = false;
+    }
+    if ( ( d.mask & PPUMASK_RENDERING ) == 0 ) {
+        backgroundDrawn[s.line].valid = false;
+        memset( out + x0, d.palette[0] & gray, x1 - x0 );
+        return;
+    }
+
+    static const uint8_t transparent[PPU_WIDTH] = { 0 };
+    if ( ( d.mask & PPUMASK_BG ) == 0 ) {
+        backgroundDrawn[s.line].valid = false;
+        composePixels( s, transparent, x0, x1 );
+        return;
+    }
+    const uint8_t *bg = lineBackground( s, x0, x1 );
+    if ( x0 < 8 && ( d.mask & PPUMASK_BG_LEFT ) == 0 ) {
+        int left = x1 < 8 ? x1 : 8;
+        composePixels( s, transparent, x0, left );
+        x0 = left;
+    }
+    composePixels( s, bg, x0, x1 );
+}
+
+static inline bool sameBackground( const PPU::BackgroundKey &a, const PPU::BackgroundKey &b )
+{
+    return memcmp( a.chr, b.chr, sizeof( a.chr ) ) == 0 && a.chrWrites == b.chrWrites && a.rowWrites == b.rowWrites &&
+        a.v == b.v && a.x == b.x && a.lineX == b.lineX && a.mirroring == b.mirroring;
+}
+
+PPU::BackgroundKey PPU::backgroundKey( const Scanline &s )
+{
+    const DrawState &d = *s.state;
+    BackgroundKey key;
+    int page = ( d.ctrl & PPUCTRL_BG_TABLE ) ? 4 : 0;
+    for ( int i = 0; i < 4; i++ ) {
+        key.chr[i] = d.chrMap[page + i];
+    }
+    key.chrWrites = d.chrWrites;
+    // the line reads the tile row in the nametable of v and the one to its right
+    int row = ( s.v >> 5 ) & 0x1F;
+    int left = nametableOffset( 0x2000 | (s.v & 0x0C00), d.mirroring ) >> 10;
+    int right = nametableOffset( 0x2000 | ((s.v ^ 0x0400) & 0x0C00), d.mirroring ) >> 10;
+    key.rowWrites = d.rowWrites[left][row] + d.rowWrites[right][row];
+    key.v = s.v;
+    key.x = d.x;
+    key.lineX = s.lineX;
+    key.mirroring = d.mirroring;
+    key.valid = true;
+    return key;
+}
+
+const uint8_t *PPU::lineBackground( Scanline &s, int x0, int x1 )
+{
+    uint8_t *bg = background[s.line];
+    BackgroundKey &drawn = backgroundDrawn[s.line];
+    if ( s.state->reuseBackground == false ) {
+        drawn.valid = false;
+        renderBackground( s, bg, x0, x1 );
+        s.backgroundPixels += x1 - x0;
+        return bg;
+    }
+    // a span keeps the line reused while nothing changed since the line started
+    BackgroundKey key = backgroundKey( s );
+    if ( x0 == 0 ) {
+        s.reused = drawn.valid && sameBackground( drawn, key );
+        drawn = key;
+    } else if ( drawn.valid == false || sameBackground( drawn, key ) == false ) {
+        s.reused = false;
+        drawn.valid = false;
+    }
+    if ( s.reused ) {
+        s.backgroundReused += x1 - x0;
+    } else {
+        renderBackground( s, bg, x0, x1 );
+        s.backgroundPixels += x1 - x0;
+    }
+    return bg;
+}
+
+void PPU::composePixels( const Scanline &s, const uint8_t *bg, int x0, int x1 )
+{
+    const DrawState &d = *s.state;
+    const uint8_t *palette = d.palette;
+    uint8_t *out = &framebuffer[s.line * PPU_WIDTH];
+    uint8_t gray = ( d.mask & PPUMASK_GRAYSCALE ) ? 0x30 : 0x3F;
+    if ( s.sprites == false || ( d.mask & PPUMASK_SPRITES ) == 0 ) {
+        for ( int px = x0; px < x1; px++ ) {
+            out[px] = palette[bg[px]] & gray;
+        }
+        return;
+    }
+    for ( int px = x0; px < x1; px++ ) {
+        uint8_t b = bg[px];
+        uint8_t c = s.spriteColor[px];
+        if ( px < 8 && ( d.mask & PPUMASK_SPRITE_LEFT ) == 0 ) {
+            c = 0;
+        }
+        uint8_t color;
+        if ( c && ( b == 0 || ( s.spriteFlags[px] & SPRITE_BEHIND ) == 0 ) ) {
+            color = palette[c];
+        } else {
+            color = palette[b];
+        }
+        out[px] = color & gray;
+    }
+}
+
+void PPU::raiseNMI()
+{
+    cpu.nmi = true;
+    cpu.scheduler.schedule( EVENT_INTERRUPT, cpu.clock() );
+}
+
+uint8_t *PPU::nametable( uint16_t addr )
+{
+    return &vram[nametableOffset( addr, cpu.mapper->mirroring )];
+}
+
+int PPU::nametableOffset( uint16_t addr, uint8_t mirroring )
+{
+    int table = ( addr >> 10 ) & 0x3;
+    switch ( mirroring ) {
+        case MIRROR_HORIZONTAL:
+            table >>= 1;
+            break;
+        case MIRROR_VERTICAL:
+            table &= 0x1;
+            break;
+        case MIRROR_SINGLE_LOW:
+            table = 0;
+            break;
+        case MIRROR_SINGLE_HIGH:
+            table = 1;
+            break;
+    }
+    return ( table << 10 ) | (addr & 0x3FF);
+}
+
+static inline int paletteIndex( uint16_t addr )
+{
+    // $3F10/$3F14/$3F18/$3F1C mirror the backdrop entries
+    int index = addr & 0x1F;
+    if ( ( index & 0x13 ) == 0x10 ) {
+        index &= ~0x10;
+    }
+    return index;
+}
+
+uint8_t PPU::read( uint16_t addr )
+{
+    addr &= 0x3FFF;
+    if ( addr < 0x2000 ) {
+        return cpu.mapper->chrMap[(addr >> CHR_PAGE_SHIFT) & (CHR_PAGES - 1)][addr & (CHR_PAGE_SIZE - 1)];
+    }
+    if ( addr < 0x3F00 ) {
+        return *nametable( addr );
+    }
+    return palette[paletteIndex( addr )];
+}
+
+void PPU::write( uint16_t addr, uint8_t val )
+{
+    addr &= 0x3FFF;
+    if ( addr < 0x2000 ) {
+        // the handed off lines read the decoded tiles
+        finishFrame();
+        if ( cpu.mapper->chrwritable && read( addr ) != val ) {
+            chrWrites++;
+        }
+        cpu.mapper->chrWrite( addr, val );
+    } else if ( addr < 0x3F00 ) {
+        uint8_t *p = nametable( addr );
+        if ( *p != val ) {
+            int table = ( p - vram ) >> 10;
+            int cell = ( p - vram ) & 0x3FF;
+            rowWrites[table][cell >> 5]++;
+            if ( cell >= 0x3C0 ) {
+                // an attribute byte colors four tile rows
+                int first = ( (cell - 0x3C0) >> 3 ) * 4;
+                for ( int row = first; row < first + 4; row++ ) {
+                    if ( row != cell >> 5 ) {
+                        rowWrites[table][row]++;
+                    }
+                }
+            }
+        }
+        *p = val;
+    } else {
+        palette[paletteIndex( addr )] = val & 0x3F;
+    }
+}
+
+uint8_t PPU::readRegister( uint16_t reg )
+{
+    if ( reg == 2 ) {
+        return readStatus();
+    }
+    sync();
+    switch ( reg ) {
+        case 4:
+            return oam[oamaddr];
+        case 7:
+            {
+                uint16_t addr = v & 0x3FFF;
+                uint8_t val = readbuffer;
+                if ( addr >= 0x3F00 ) {
+                    // palette reads are not buffered, the buffer gets the nametable below
+                    val = ( latch & 0xC0 ) | read( addr );
+                    readbuffer = read( addr - 0x1000 );
+                } else {
+                    readbuffer = read( addr );
+                }
+                v = ( v + ( ( ctrl & PPUCTRL_INCREMENT ) ? 32 : 1 ) ) & 0x7FFF;
+                return val;
+            }
+        default:
+            return latch;
+    }
+}
+
+void PPU::writeRegister( uint16_t reg, uint8_t val )
+{
+    sync();
+    latch = val;
+    switch ( reg ) {
+        case 0:
+            if ( ( ctrl & PPUCTRL_NMI ) == 0 && ( val & PPUCTRL_NMI ) && ( status & PPUSTATUS_VBLANK ) ) {
+                raiseNMI();
+            }
+            if ( ( ctrl ^ val ) & PPUCTRL_SPRITE_SIZE ) {
+                spriteListStale = true;
+            }
+            ctrl = val;
+            t = ( t & ~0x0C00 ) | ( (val & 0x3) << 10 );
+            break;
+        case 1:
+            mask = val;
+            break;
+        case 3:
+            oamaddr = val;
+            break;
+        case 4:
+            writeOam( val );
+            break;
+        case 5:
+            if ( w == false ) {
+                t = ( t & ~0x001F ) | ( val >> 3 );
+                x = val & 0x7;
+            } else {
+                t = ( t & ~0x73E0 ) | ( (val & 0x7) << 12 ) | ( (val & 0xF8) << 2 );
+            }
+            w = !w;
+            break;
+        case 6:
+            if ( w == false ) {
+                t = ( t & 0x00FF ) | ( (val & 0x3F) << 8 );
+            } else {
+                t = ( t & 0xFF00 ) | val;
+                v = t;
+                // the rest of the line is drawn from the new address
+                if ( line < PPU_HEIGHT && lineDot > 0 && lineDot <= PPU_WIDTH ) {
+                    lineX = lineDot - 1;
+                }
+            }
+            w = !w;
+            break;
+        case 7:
+            write( v, val );
+            v = ( v + ( ( ctrl & PPUCTRL_INCREMENT ) ? 32 : 1 ) ) & 0x7FFF;
+            break;
+    }
+}
+
+void PPU::oamDma( const uint8_t *page )
+{
+    sync();
+    // oamaddr is left unchanged after wrapping around once
+    memcpy( &oam[oamaddr], page, OAM_SIZE - oamaddr );
+    memcpy( &oam[0], page + OAM_SIZE - oamaddr, oamaddr );
+    spriteListStale = true;
+}
+
+uint64_t PPU::hashFrame() const
+{
+    return xxh64( framebuffer, sizeof( framebuffer ), xxh64( emphasis, sizeof( emphasis ) ) );
+}
+
+void PPU::convert( PixelFormat format, void *out, int pitch )
+{
+    finishFrame();
+    for ( int l = 0; l < PPU_HEIGHT; l++ ) {
+        convertPixels( &framebuffer[l * PPU_WIDTH], PPU_WIDTH, emphasis[l], format, static_cast<uint8_t*>( out ) + l * pitch );
+    }
+}
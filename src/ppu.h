@@ -0,0 +1,281 @@
+#ifndef __PPU_H__
+#define __PPU_H__
+#include <stdint.h>
+#include <functional>
+#include <memory>
+#include <vector>
+#include "tile.h"
+#include "palette.h"
+#include "hash.h"
+
+#define OAM_SIZE 0x100
+#define OAM_DMA_CYCLES 513 // one more when started on an odd CPU cycle
+#define DMC_DMA_CYCLES 4
+#define DMC_DMA_OAM_CYCLES 2 // DMC fetch landing inside an OAM DMA
+
+#define PPU_WIDTH 256
+#define PPU_HEIGHT 240
+#define PPU_VBLANK_LINE 241
+#define PPU_PRERENDER_LINE 261
+// CPU cycles to run between looks at frame, well inside vblank so the
+// framebuffer still holds the frame that just finished
+#define PPU_FRAME_STEP 1000
+#define PPU_BAND_LINES 16 // lines per job when drawing in parallel
+#define PPU_PARALLEL_LINES 64 // fewer whole lines at once are drawn on the calling thread
+
+// PPUCTRL
+#define PPUCTRL_INCREMENT 0x04
+#define PPUCTRL_SPRITE_TABLE 0x08
+#define PPUCTRL_BG_TABLE 0x10
+#define PPUCTRL_SPRITE_SIZE 0x20
+#define PPUCTRL_NMI 0x80
+
+// PPUMASK
+#define PPUMASK_GRAYSCALE 0x01
+#define PPUMASK_BG_LEFT 0x02
+#define PPUMASK_SPRITE_LEFT 0x04
+#define PPUMASK_BG 0x08
+#define PPUMASK_SPRITES 0x10
+#define PPUMASK_RENDERING (PPUMASK_BG | PPUMASK_SPRITES)
+#define PPUMASK_EMPHASIS 0xE0 // red, green, blue
+
+// PPUSTATUS
+#define PPUSTATUS_OVERFLOW 0x20
+#define PPUSTATUS_SPRITE0 0x40
+#define PPUSTATUS_VBLANK 0x80
+
+// spriteFlags
+#define SPRITE_BEHIND 0x01
+
+struct CPU;
+struct WorkerPool;
+
+// 2C02 picture processing unit. Renders a scanline at a time into an indexed
+// framebuffer. The PPU only runs when it has to: before a register access,
+// mapper write or OAM DMA it is caught up to the current dot, so a write in
+// the middle of a line splits the line at that pixel. Otherwise the vblank
+// event once a frame catches it up. Nothing changes between two accesses, so
+// whole lines caught up in one go do not depend on each other. With worker
+// threads they are handed off with a copy of what drawing reads and drawn in
+// bands while the CPU runs on, see finishFrame.
+struct PPU
+{
+    CPU &cpu;
+    uint8_t oam[OAM_SIZE]; // sprite attribute memory
+    uint8_t oamaddr;
+
+    uint8_t ctrl;
+    uint8_t mask;
+    uint8_t status;
+    uint16_t v; // current VRAM address, coarse X is kept at the first tile of the line
+    uint16_t t; // temporary VRAM address
+    uint8_t x; // fine X scroll
+    bool w; // first/second write toggle
+    uint8_t readbuffer; // $2007 read buffer
+    uint8_t latch; // last value written, returned by write only registers
+
+    uint8_t vram[0x1000]; // 2KB of CIRAM, four screen boards use all of it
+    uint8_t palette[0x20];
+    uint8_t framebuffer[PPU_HEIGHT * PPU_WIDTH]; // 6 bit palette indices
+    uint8_t emphasis[PPU_HEIGHT]; // PPUMASK bits 5-7 of each line, the last value drawn with
+
+    // position, dot counts PPU dots since power on
+    uint64_t dot;
+    int line;
+    int lineDot;
+    uint64_t frame; // frames completed, bumped at vblank
+    int lineX; // pixel v applies from, moved by a $2006 write during the line
+
+    // Frames without pixels. Registers, vblank, NMI, the predicted status flags
+    // and the MMC3 counter behave exactly as when drawing, the framebuffer keeps
+    // the last drawn frame.
+    bool renderSkip; // wanted from the next frame on
+    bool frameSkipped; // the current frame is not drawn
+
+    // hash of every drawn frame taken at vblank, for regression checks without images
+    bool hashFrames;
+    uint64_t frameHash; // of the last drawn frame, frameHashed is its frame number
+    uint64_t frameHashed;
+
+    // OAM indices of the first 8 sprites on each line. Rebuilt in full after a
+    // DMA or a sprite size change, a $2004 write to a Y byte only redoes the
+    // lines the sprite leaves and enters
+    uint8_t spriteList[PPU_HEIGHT][8];
+    uint8_t spriteCount[PPU_HEIGHT]; // sprites on the line, more than 8 is overflow
+    bool spriteListStale;
+
+    // Sprite 0 hit and overflow are not found while drawing, they are predicted
+    // from the state at dot for the rest of the frame. A write syncs first and
+    // drops the prediction, so it always holds for the current state and a
+    // $2002 read only has to compare dots.
+    bool statusPredicted;
+    uint64_t sprite0Dot; // flag is set once this dot has run, EVENT_NEVER if no hit
+    uint64_t overflowDot;
+
+    // Background reuse. Each line keeps its background pixels, palette entries
+    // before the palette is applied, along with what they were drawn from. A
+    // line whose key still matches copies nothing and draws nothing, only the
+    // palette and sprites go on top again. Nametable rows and CHR-RAM only
+    // count as written when a byte really changes.
+    struct BackgroundKey
+    {
+        const uint8_t *chr[4]; // pages of the background pattern table
+        uint32_t chrWrites;
+        uint32_t rowWrites; // both nametables of the row the line starts in
+        uint16_t v;
+        uint8_t x;
+        uint8_t lineX;
+        uint8_t mirroring;
+        bool valid; // the whole line was drawn with this key
+    };
+    bool reuseBackground;
+    uint8_t background[PPU_HEIGHT][PPU_WIDTH];
+    BackgroundKey backgroundDrawn[PPU_HEIGHT];
+    uint32_t chrWrites;
+    uint32_t rowWrites[4][32]; // per CIRAM nametable and tile row, attribute writes count for their rows
+    // pixels, since power on
+    uint64_t backgroundPixels;
+    uint64_t backgroundReused;
+
+    // What drawing reads besides the line itself. Lines drawn on the calling
+    // thread see the live registers and memory, lines handed off see a copy
+    struct DrawState
+    {
+        uint8_t ctrl;
+        uint8_t mask;
+        uint8_t x;
+        uint8_t mirroring;
+        bool reuseBackground;
+        const uint8_t *palette;
+        const uint8_t *vram;
+        const uint8_t *oam;
+        const uint8_t (*spriteList)[8];
+        const uint8_t *spriteCount;
+        const uint8_t *chrMap[8]; // Mapper::chrMap
+        uint32_t chrWrites;
+        const uint32_t (*rowWrites)[32];
+    };
+
+    // what drawing a line needs besides the shared state, one per band
+    struct Scanline
+    {
+        const DrawState *state;
+        int line;
+        uint16_t v; // as the line is drawn from
+        int lineX;
+        uint8_t spriteColor[PPU_WIDTH]; // palette entry 0x10-0x1f, 0 when transparent
+        uint8_t spriteFlags[PPU_WIDTH];
+        bool sprites; // spriteColor has something on this line
+        bool reused; // the background comes from the line cache
+        uint32_t backgroundPixels;
+        uint32_t backgroundReused;
+    };
+    Scanline scan; // the line drawn by runLine
+
+    // Lines handed off to the workers and the copy they draw from. Taken when
+    // a catch-up covers enough whole lines, the CPU only waits for them when
+    // it is about to change CHR-RAM, draw the next frame or look at this one
+    struct Handoff
+    {
+        DrawState state;
+        uint8_t palette[0x20];
+        uint8_t vram[0x1000];
+        uint8_t oam[OAM_SIZE];
+        uint8_t spriteList[PPU_HEIGHT][8];
+        uint8_t spriteCount[PPU_HEIGHT];
+        uint32_t rowWrites[4][32];
+        uint16_t lineV[PPU_HEIGHT];
+        int first;
+        int lines;
+        uint32_t drawn[PPU_HEIGHT / PPU_BAND_LINES];
+        uint32_t reused[PPU_HEIGHT / PPU_BAND_LINES];
+        std::function<void( int )> band;
+    };
+
+    std::unique_ptr<WorkerPool> workers; // NULL draws every line on the calling thread
+    std::vector<Scanline> bands;
+    std::unique_ptr<Handoff> handoff;
+    bool linesPending; // handoff is being drawn
+
+    PPU( CPU &cpu );
+    ~PPU();
+    void reset();
+
+    // schedule the next vblank event, only a cartridge has a PPU attached
+    void start();
+    // EVENT_PPU fired, time is the CPU clock
+    void event( uint64_t time );
+
+    // skip drawing from the next frame on, or draw again
+    void skipRendering( bool skip );
+    // draw with threads - 1 extra threads, 1 or less draws serially
+    void renderThreads( int threads );
+
+    // wait for the lines handed off to the workers. The framebuffer, emphasis
+    // and background counters are only complete after this
+    void finishFrame();
+
+    // run up to PPU dot target
+    void catchUp( uint64_t target );
+    // run up to the CPU clock
+    void sync();
+
+    // find sprite 0 hit and overflow for the rest of the frame, schedules EVENT_SPRITE0
+    void predictStatus();
+    // set the predicted flags reached before PPU dot now
+    void updateStatus( uint64_t now );
+    // EVENT_SPRITE0 fired, time is the CPU clock
+    void statusEvent( uint64_t time );
+    // $2002 without running the PPU unless vblank starts or ends on the way
+    uint8_t readStatus();
+
+    // XXH64 of the framebuffer and the emphasis of each line
+    uint64_t hashFrame() const;
+
+    // framebuffer as format into out, pitch is the bytes from one line to the next.
+    // Waits for the workers first
+    void convert( PixelFormat format, void *out, int pitch );
+
+    // CPU access to $2000-$3FFF, reg is 0-7
+    uint8_t readRegister( uint16_t reg );
+    void writeRegister( uint16_t reg, uint8_t val );
+
+    // 256 bytes from page into OAM starting at oamaddr, same as 256 $2004 writes
+    void oamDma( const uint8_t *page );
+
+    // PPU address space
+    uint8_t *nametable( uint16_t addr );
+    // offset into vram of nametable address addr
+    static int nametableOffset( uint16_t addr, uint8_t mirroring );
+    uint8_t read( uint16_t addr );
+    void write( uint16_t addr, uint8_t val );
+
+    // process dots [from, to) of the current line
+    void runLine( int from, int to );
+    // hand lines whole lines from the current one on to the workers
+    void renderLines( int lines );
+    // lines of band b of the handoff
+    void renderBand( int b );
+    // d pointed at the live registers and memory
+    void liveState( DrawState &d );
+    void renderPixels( Scanline &s, int x0, int x1 );
+    void renderBackground( const Scanline &s, uint8_t *bg, int x0, int x1 );
+    // background of pixels x0-x1 into the line cache, drawn or reused
+    const uint8_t *lineBackground( Scanline &s, int x0, int x1 );
+    BackgroundKey backgroundKey( const Scanline &s );
+    // background and sprite pixels through the palette
+    void composePixels( const Scanline &s, const uint8_t *bg, int x0, int x1 );
+    // whether background pixel px is opaque when the line is drawn from lineV
+    bool backgroundOpaque( uint16_t lineV, int lineStartX, int px );
+    void evaluateSprites( Scanline &s );
+    int spriteHeight() const;
+    void buildSpriteLists();
+    // scan OAM again for lines first to last
+    void updateSpriteLines( int first, int last );
+    // $2004 write
+    void writeOam( uint8_t val );
+    void incrementY( uint16_t &addr );
+    void raiseNMI();
+};
+
+#endif
@@ -0,0 +1,194 @@
+#include "romdb.h"
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <fstream>
+#include <vector>
+
+static bool entryLess( const RomDBEntry &a, const RomDBEntry &b )
+{
+    if ( a.crc32 != b.crc32 ) {
+        return a.crc32 < b.crc32;
+    }
+    return memcmp( a.sha1, b.sha1, SHA1_DIGEST_SIZE ) < 0;
+}
+
+RomDatabase::RomDatabase()
+    : base( NULL ), size( 0 ), entries( NULL ), count( 0 )
+{
+}
+
+RomDatabase::~RomDatabase()
+{
+    close();
+}
+
+bool RomDatabase::open( std::string file )
+{
+    close();
+    int fd = ::open( file.c_str(), O_RDONLY );
+    if ( fd < 0 ) {
+        fprintf(stderr,"%s: Unable to open ROM database\n",file.c_str());
+        return false;
+    }
+    struct stat st;
+    if ( fstat( fd, &st ) != 0 || (size_t)st.st_size < sizeof( RomDBHeader ) ) {
+        fprintf(stderr,"%s: Invalid ROM database\n",file.c_str());
+        ::close( fd );
+        return false;
+    }
+    void *map = mmap( NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0 );
+    ::close( fd );
+    if ( map == MAP_FAILED ) {
+        fprintf(stderr,"%s: Unable to map ROM database\n",file.c_str());
+        return false;
+    }
+    const RomDBHeader *header = reinterpret_cast<const RomDBHeader*>( map );
+    if ( memcmp( header->magic, ROMDB_MAGIC, 8 ) != 0 || header->version != ROMDB_VERSION ||
+            sizeof( RomDBHeader ) + (size_t)header->count * sizeof( RomDBEntry ) > (size_t)st.st_size ) {
+        fprintf(stderr,"%s: Invalid ROM database\n",file.c_str());
+        munmap( map, st.st_size );
+        return false;
+    }
+    base = reinterpret_cast<const uint8_t*>( map );
+    size = st.st_size;
+    entries = reinterpret_cast<const RomDBEntry*>( base + sizeof( RomDBHeader ) );
+    count = header->count;
+    return true;
+}
+
+void RomDatabase::close()
+{
+    if ( base != NULL ) {
+        munmap( const_cast<uint8_t*>( base ), size );
+    }
+    base = NULL;
+    size = 0;
+    entries = NULL;
+    count = 0;
+}
+
+const RomDBEntry *RomDatabase::lookup( uint32_t crc, const uint8_t sha1[SHA1_DIGEST_SIZE] ) const
+{
+    RomDBEntry key;
+    key.crc32 = crc;
+    memcpy( key.sha1, sha1, SHA1_DIGEST_SIZE );
+    const RomDBEntry *it = std::lower_bound( entries, entries + count, key, entryLess );
+    if ( it != entries + count && it->crc32 == crc && memcmp( it->sha1, sha1, SHA1_DIGEST_SIZE ) == 0 ) {
+        return it;
+    }
+    return NULL;
+}
+
+bool RomDatabase::correctHeader( uint32_t crc, const uint8_t sha1[SHA1_DIGEST_SIZE], INESHeader &header ) const
+{
+    const RomDBEntry *entry = lookup( crc, sha1 );
+    if ( entry == NULL ) {
+        return false;
+    }
+    header.mapper = entry->mapper;
+    header.mirroring = entry->mirroring;
+    header.region = entry->region;
+    header.fourscreen = entry->fourscreen;
+    header.battery = entry->battery;
+    return true;
+}
+
+// split one CSV line, handles quoted fields with "" escapes
+static void splitCSV( const std::string &line, std::vector<std::string> &fields )
+{
+    fields.clear();
+    std::string field;
+    bool quoted = false;
+    for ( size_t i = 0; i < line.size(); i++ ) {
+        char c = line[i];
+        if ( quoted ) {
+            if ( c == '"' && i + 1 < line.size() && line[i+1] == '"' ) {
+                field += '"';
+                i++;
+            } else if ( c == '"' ) {
+                quoted = false;
+            } else {
+                field += c;
+            }
+        } else if ( c == '"' ) {
+            quoted = true;
+        } else if ( c == ',' ) {
+            fields.push_back( field );
+            field.clear();
+        } else if ( c != '\r' ) {
+            field += c;
+        }
+    }
+    fields.push_back( field );
+}
+
+bool RomDatabase::build( std::string csvfile, std::string dbfile )
+{
+    std::ifstream ifs( csvfile );
+    if ( !ifs ) {
+        fprintf(stderr,"%s: Unable to open\n",csvfile.c_str());
+        return false;
+    }
+    std::string line;
+    std::vector<std::string> fields;
+    std::getline( ifs, line );
+    splitCSV( line, fields );
+    const char *names[] = { "rom_crc32", "rom_sha1", "mapper", "mirroring", "region", "fourscreen", "battery" };
+    int column[7];
+    for ( int i = 0; i < 7; i++ ) {
+        column[i] = std::find( fields.begin(), fields.end(), names[i] ) - fields.begin();
+        if ( column[i] == (int)fields.size() ) {
+            fprintf(stderr,"%s: Missing column %s\n",csvfile.c_str(),names[i]);
+            return false;
+        }
+    }
+
+    std::vector<RomDBEntry> list;
+    int lineno = 1;
+    while ( std::getline( ifs, line ) ) {
+        lineno++;
+        if ( line.empty() ) {
+            continue;
+        }
+        splitCSV( line, fields );
+        RomDBEntry entry;
+        memset( &entry, 0, sizeof( entry ) );
+        if ( *std::max_element( column, column + 7 ) >= (int)fields.size() ||
+                sha1FromString( fields[column[1]].c_str(), entry.sha1 ) == false ) {
+            fprintf(stderr,"%s:%d: Invalid record\n",csvfile.c_str(),lineno);
+            return false;
+        }
+        entry.crc32 = strtoul( fields[column[0]].c_str(), NULL, 16 );
+        entry.mapper = atoi( fields[column[2]].c_str() );
+        entry.mirroring = atoi( fields[column[3]].c_str() );
+        entry.region = atoi( fields[column[4]].c_str() );
+        entry.fourscreen = atoi( fields[column[5]].c_str() );
+        entry.battery = atoi( fields[column[6]].c_str() );
+        list.push_back( entry );
+    }
+    std::sort( list.begin(), list.end(), entryLess );
+    // the same dump found twice in a library only needs one entry
+    list.erase( std::unique( list.begin(), list.end(), []( const RomDBEntry &a, const RomDBEntry &b ) {
+                return a.crc32 == b.crc32 && memcmp( a.sha1, b.sha1, SHA1_DIGEST_SIZE ) == 0; } ), list.end() );
+
+    RomDBHeader header;
+    memcpy( header.magic, ROMDB_MAGIC, 8 );
+    header.version = ROMDB_VERSION;
+    header.count = list.size();
+    std::ofstream ofs( dbfile, std::ios_base::out | std::ios_base::binary | std::ios_base::trunc );
+    ofs.write( reinterpret_cast<const char*>( &header ), sizeof( header ) );
+    if ( !list.empty() ) {
+        ofs.write( reinterpret_cast<const char*>( &list[0] ), list.size() * sizeof( RomDBEntry ) );
+    }
+    if ( !ofs ) {
+        fprintf(stderr,"%s: Error writing ROM database\n",dbfile.c_str());
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,57 @@
+#ifndef __ROMDB_H__
+#define __ROMDB_H__
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+#include "ines.h"
+#include "hash.h"
+
+#define ROMDB_MAGIC "NESROMDB"
+#define ROMDB_VERSION 1
+
+// on disk layout, little endian: RomDBHeader followed by count RomDBEntry sorted by crc32 then sha1
+struct RomDBHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t count;
+};
+
+struct RomDBEntry
+{
+    uint32_t crc32; // of the headerless PRG+CHR data
+    uint8_t sha1[SHA1_DIGEST_SIZE];
+    uint16_t mapper;
+    uint8_t mirroring; // 0 horizontal, 1 vertical
+    uint8_t region; // 0 NTSC, 1 PAL, 2 dual
+    uint8_t fourscreen;
+    uint8_t battery;
+    uint8_t reserved[2];
+};
+
+// read-only database of known good ROMs, the file is memory mapped and searched in place
+struct RomDatabase
+{
+    const uint8_t *base;
+    size_t size;
+    const RomDBEntry *entries;
+    uint32_t count;
+
+    RomDatabase();
+    ~RomDatabase();
+
+    bool open( std::string file );
+    void close();
+
+    // find the entry matching both hashes, NULL if the ROM is unknown
+    const RomDBEntry *lookup( uint32_t crc, const uint8_t sha1[SHA1_DIGEST_SIZE] ) const;
+
+    // override the header fields the database knows better, returns true if an entry matched
+    bool correctHeader( uint32_t crc, const uint8_t sha1[SHA1_DIGEST_SIZE], INESHeader &header ) const;
+
+    // build a database from the CSV written by "nesparser -s", using the rom_crc32, rom_sha1,
+    // mapper, mirroring, region, fourscreen and battery columns
+    static bool build( std::string csvfile, std::string dbfile );
+};
+
+#endif
@@ -0,0 +1,169 @@
+#include "rompack.h"
+#include "ines.h"
+#include "hash.h"
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <fstream>
+#include <iterator>
+#include <set>
+
+static bool entryLess( const RomPackEntry &a, const RomPackEntry &b )
+{
+    return a.crc32 < b.crc32;
+}
+
+RomPack::RomPack()
+    : base( NULL ), size( 0 ), entries( NULL ), count( 0 )
+{
+}
+
+RomPack::~RomPack()
+{
+    close();
+}
+
+bool RomPack::open( std::string file )
+{
+    close();
+    int fd = ::open( file.c_str(), O_RDONLY );
+    if ( fd < 0 ) {
+        fprintf(stderr,"%s: Unable to open ROM pack\n",file.c_str());
+        return false;
+    }
+    struct stat st;
+    if ( fstat( fd, &st ) != 0 || (size_t)st.st_size < sizeof( RomPackHeader ) ) {
+        fprintf(stderr,"%s: Invalid ROM pack\n",file.c_str());
+        ::close( fd );
+        return false;
+    }
+    void *map = mmap( NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0 );
+    ::close( fd );
+    if ( map == MAP_FAILED ) {
+        fprintf(stderr,"%s: Unable to map ROM pack\n",file.c_str());
+        return false;
+    }
+    const RomPackHeader *header = reinterpret_cast<const RomPackHeader*>( map );
+    bool valid = memcmp( header->magic, ROMPACK_MAGIC, 8 ) == 0 && header->version == ROMPACK_VERSION &&
+        sizeof( RomPackHeader ) + (size_t)header->count * sizeof( RomPackEntry ) <= (size_t)st.st_size;
+    const RomPackEntry *list = reinterpret_cast<const RomPackEntry*>( header + 1 );
+    for ( uint32_t i = 0; valid && i < header->count; i++ ) {
+        valid = list[i].offset + list[i].size <= (uint64_t)st.st_size;
+    }
+    if ( valid == false ) {
+        fprintf(stderr,"%s: Invalid ROM pack\n",file.c_str());
+        munmap( map, st.st_size );
+        return false;
+    }
+    // only the index is needed up front, images are paged in when loaded
+    madvise( map, st.st_size, MADV_RANDOM );
+    base = reinterpret_cast<const uint8_t*>( map );
+    size = st.st_size;
+    entries = list;
+    count = header->count;
+    return true;
+}
+
+void RomPack::close()
+{
+    if ( base != NULL ) {
+        munmap( const_cast<uint8_t*>( base ), size );
+    }
+    base = NULL;
+    size = 0;
+    entries = NULL;
+    count = 0;
+}
+
+const RomPackEntry *RomPack::find( uint32_t crc ) const
+{
+    RomPackEntry key;
+    key.crc32 = crc;
+    const RomPackEntry *it = std::lower_bound( entries, entries + count, key, entryLess );
+    if ( it != entries + count && it->crc32 == crc ) {
+        return it;
+    }
+    return NULL;
+}
+
+const RomPackEntry *RomPack::find( std::string name ) const
+{
+    for ( uint32_t i = 0; i < count; i++ ) {
+        if ( strncmp( entries[i].name, name.c_str(), ROMPACK_NAME_SIZE ) == 0 ) {
+            return &entries[i];
+        }
+    }
+    return NULL;
+}
+
+const uint8_t *RomPack::image( const RomPackEntry *entry ) const
+{
+    const uint8_t *start = base + entry->offset;
+    madvise( const_cast<uint8_t*>( start ), entry->size, MADV_WILLNEED );
+    return start;
+}
+
+bool RomPack::build( const std::vector<std::string> &files, std::string packfile )
+{
+    std::ofstream ofs( packfile, std::ios_base::out | std::ios_base::binary | std::ios_base::trunc );
+    if ( !ofs ) {
+        fprintf(stderr,"%s: Unable to create ROM pack\n",packfile.c_str());
+        return false;
+    }
+
+    // images are appended in input order, the index in front is written last once it is sorted
+    std::vector<RomPackEntry> index;
+    std::set<std::string> names;
+    uint64_t offset = sizeof( RomPackHeader ) + files.size() * sizeof( RomPackEntry );
+    for ( size_t i = 0; i < files.size(); i++ ) {
+        std::ifstream ifs( files[i], std::ios_base::in | std::ios_base::binary );
+        std::vector<uint8_t> data( (std::istreambuf_iterator<char>( ifs )), std::istreambuf_iterator<char>() );
+        INESHeader header;
+        if ( !ifs || data.size() < INES_HEADER_SIZE || parseINESHeader( &data[0], header ) == false ||
+                header.chroffset + header.chrsize > data.size() ) {
+            fprintf(stderr,"%s: Not a NES file, skipped\n",files[i].c_str());
+            continue;
+        }
+        RomPackEntry entry;
+        memset( &entry, 0, sizeof( entry ) );
+        entry.crc32 = crc32( &data[header.prgoffset], header.prgsize + header.chrsize );
+        entry.size = data.size();
+        offset = ( offset + ROMPACK_ALIGN - 1 ) & ~uint64_t( ROMPACK_ALIGN - 1 );
+        entry.offset = offset;
+        offset += entry.size;
+        std::string name = files[i].substr( files[i].find_last_of( '/' ) + 1 );
+        // find( name ) compares the whole stored name, so a cut or repeated one could never be loaded
+        if ( name.size() >= ROMPACK_NAME_SIZE ) {
+            fprintf(stderr,"%s: Name longer than %d characters\n",files[i].c_str(),ROMPACK_NAME_SIZE-1);
+            return false;
+        }
+        if ( names.insert( name ).second == false ) {
+            fprintf(stderr,"%s: Name %s already in ROM pack\n",files[i].c_str(),name.c_str());
+            return false;
+        }
+        strncpy( entry.name, name.c_str(), ROMPACK_NAME_SIZE - 1 );
+        index.push_back( entry );
+        ofs.seekp( entry.offset );
+        ofs.write( reinterpret_cast<const char*>( &data[0] ), data.size() );
+    }
+    std::stable_sort( index.begin(), index.end(), entryLess );
+
+    RomPackHeader header;
+    memcpy( header.magic, ROMPACK_MAGIC, 8 );
+    header.version = ROMPACK_VERSION;
+    header.count = index.size();
+    ofs.seekp( 0 );
+    ofs.write( reinterpret_cast<const char*>( &header ), sizeof( header ) );
+    if ( !index.empty() ) {
+        ofs.write( reinterpret_cast<const char*>( &index[0] ), index.size() * sizeof( RomPackEntry ) );
+    }
+    if ( !ofs ) {
+        fprintf(stderr,"%s: Error writing ROM pack\n",packfile.c_str());
+        return false;
+    }
+    return true;
+}
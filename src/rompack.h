@@ -0,0 +1,54 @@
+#ifndef __ROMPACK_H__
+#define __ROMPACK_H__
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+#include <vector>
+
+#define ROMPACK_MAGIC "NESROMPK"
+#define ROMPACK_VERSION 1
+#define ROMPACK_ALIGN 4096
+#define ROMPACK_NAME_SIZE 48
+
+// on disk layout, little endian: RomPackHeader, count RomPackEntry sorted by crc32,
+// then the .nes images each starting on a ROMPACK_ALIGN boundary
+struct RomPackHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t count;
+};
+
+struct RomPackEntry
+{
+    uint32_t crc32; // of the headerless PRG+CHR data, same as CPU::romcrc
+    uint32_t size; // of the .nes image
+    uint64_t offset; // from start of file
+    char name[ROMPACK_NAME_SIZE]; // file name without directory, zero terminated
+};
+
+// container with many .nes images, the file is memory mapped and images are used in place
+struct RomPack
+{
+    const uint8_t *base;
+    size_t size;
+    const RomPackEntry *entries;
+    uint32_t count;
+
+    RomPack();
+    ~RomPack();
+
+    bool open( std::string file );
+    void close();
+
+    const RomPackEntry *find( uint32_t crc ) const;
+    const RomPackEntry *find( std::string name ) const;
+
+    // start of the .nes image of entry, asks the kernel to read it ahead
+    const uint8_t *image( const RomPackEntry *entry ) const;
+
+    // fails when two files share a name or a name does not fit in RomPackEntry::name
+    static bool build( const std::vector<std::string> &files, std::string packfile );
+};
+
+#endif
@@ -0,0 +1,73 @@
+#include "savefile.h"
+#include <stdio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+SaveFile::SaveFile()
+    : data( NULL ), size( 0 )
+{
+}
+
+SaveFile::~SaveFile()
+{
+    close();
+}
+
+bool SaveFile::open( std::string file, size_t size )
+{
+    close();
+    int fd = ::open( file.c_str(), O_RDWR | O_CREAT, 0644 );
+    if ( fd < 0 ) {
+        fprintf(stderr,"%s: Unable to open save file\n",file.c_str());
+        return false;
+    }
+    struct stat st;
+    if ( fstat( fd, &st ) != 0 || ( (size_t)st.st_size < size && ftruncate( fd, size ) != 0 ) ) {
+        fprintf(stderr,"%s: Unable to size save file\n",file.c_str());
+        ::close( fd );
+        return false;
+    }
+    void *map = mmap( NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0 );
+    ::close( fd );
+    if ( map == MAP_FAILED ) {
+        fprintf(stderr,"%s: Unable to map save file\n",file.c_str());
+        return false;
+    }
+    // start reading it in without waiting for it
+    madvise( map, size, MADV_WILLNEED );
+    data = reinterpret_cast<uint8_t*>( map );
+    this->size = size;
+    return true;
+}
+
+void SaveFile::flush()
+{
+    if ( data != NULL ) {
+        msync( data, size, MS_ASYNC );
+    }
+}
+
+void SaveFile::close()
+{
+    if ( data != NULL ) {
+        flush();
+        munmap( data, size );
+    }
+    data = NULL;
+    size = 0;
+}
+
+std::string SaveFile::path( std::string rom )
+{
+    if ( rom.size() > 3 && rom.compare( rom.size() - 3, 3, ".gz" ) == 0 ) {
+        rom.erase( rom.size() - 3 );
+    }
+    size_t dot = rom.find_last_of( '.' );
+    size_t slash = rom.find_last_of( '/' );
+    if ( dot != std::string::npos && ( slash == std::string::npos || dot > slash ) ) {
+        rom.erase( dot );
+    }
+    return rom + ".sav";
+}
@@ -0,0 +1,30 @@
+#ifndef __SAVEFILE_H__
+#define __SAVEFILE_H__
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+
+#define SAVE_PRG_RAM_SIZE 0x2000
+#define SAVE_FLUSH_CYCLES 1789773 // about one second of NTSC CPU time
+
+// Battery backed PRG-RAM mapped straight from a .sav file. Writes land in the
+// page cache, flush only asks the kernel to start writing them back.
+struct SaveFile
+{
+    uint8_t *data;
+    size_t size;
+
+    SaveFile();
+    ~SaveFile();
+
+    // create or grow file to size and map it, existing contents are kept
+    bool open( std::string file, size_t size = SAVE_PRG_RAM_SIZE );
+    void flush();
+    // flush and unmap
+    void close();
+
+    // ROM file name with the extension, and a .gz, replaced by .sav
+    static std::string path( std::string rom );
+};
+
+#endif
@@ -0,0 +1,88 @@
+#ifndef __SCHEDULER_H__
+#define __SCHEDULER_H__
+#include <stdint.h>
+
+// NTSC master timing, the PPU runs 3 dots per CPU cycle. Odd frames are
+// not shortened, frame n starts at dot n * PPU_DOTS_PER_FRAME counted from power on.
+#define PPU_DOTS_PER_CPU_CYCLE 3
+#define PPU_DOTS_PER_LINE 341
+#define PPU_LINES_PER_FRAME 262
+#define PPU_DOTS_PER_FRAME (PPU_DOTS_PER_LINE * PPU_LINES_PER_FRAME)
+
+#define EVENT_NEVER UINT64_MAX
+
+enum EventKind
+{
+    EVENT_INTERRUPT = 0, // poll IRQ/NMI at the next instruction
+    EVENT_PPU,
+    EVENT_SPRITE0, // predicted sprite 0 hit
+    EVENT_MAPPER,
+    EVENT_APU,
+    EVENT_SAVE_FLUSH,
+    EVENT_KINDS,
+};
+
+// One pending timestamp per event kind, in CPU cycles since power on.
+// The interpreter only compares the clock against next between instructions.
+struct Scheduler
+{
+    uint64_t when[EVENT_KINDS];
+    uint64_t next; // earliest of when
+
+    Scheduler()
+    {
+        clear();
+    }
+
+    void clear()
+    {
+        for ( int i = 0; i < EVENT_KINDS; i++ ) {
+            when[i] = EVENT_NEVER;
+        }
+        next = EVENT_NEVER;
+    }
+
+    void schedule( int kind, uint64_t time )
+    {
+        when[kind] = time;
+        if ( time < next ) {
+            next = time;
+        } else {
+            update();
+        }
+    }
+
+    void cancel( int kind )
+    {
+        when[kind] = EVENT_NEVER;
+        update();
+    }
+
+    // remove and return the earliest event due at time, -1 when nothing is due
+    int pop( uint64_t time )
+    {
+        if ( next > time ) {
+            return -1;
+        }
+        int kind = 0;
+        for ( int i = 1; i < EVENT_KINDS; i++ ) {
+            if ( when[i] < when[kind] ) {
+                kind = i;
+            }
+        }
+        cancel( kind );
+        return kind;
+    }
+
+    void update()
+    {
+        next = EVENT_NEVER;
+        for ( int i = 0; i < EVENT_KINDS; i++ ) {
+            if ( when[i] < next ) {
+                next = when[i];
+            }
+        }
+    }
+};
+
+#endif
@@ -0,0 +1,73 @@
+#ifndef __TILE_H__
+#define __TILE_H__
+#include <stdint.h>
+#include <string.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#ifdef __BMI2__
+#include <immintrin.h>
+#endif
+
+// Decoders for one 8 pixel row of a 2 bitplane tile. Pixel i takes bit 7 - i
+// of lo and hi and comes out as palette << 2 | pattern bits, or 0 when the
+// pattern bits are 0 (transparent). All variants give the same output.
+
+static inline void decodeTileRowScalar( uint8_t lo, uint8_t hi, uint8_t palette, uint8_t *out )
+{
+    for ( int i = 0; i < 8; i++ ) {
+        uint8_t bits = ( (lo >> (7 - i)) & 0x1 ) | ( ((hi >> (7 - i)) & 0x1) << 1 );
+        out[i] = bits ? ( palette << 2 ) | bits : 0;
+    }
+}
+
+#ifdef __BMI2__
+// pdep spreads the bits one per byte, bit 0 lands in byte 0 so the bytes are swapped after
+static inline void decodeTileRowBMI2( uint8_t lo, uint8_t hi, uint8_t palette, uint8_t *out )
+{
+    uint64_t bits = __builtin_bswap64( _pdep_u64( lo, 0x0101010101010101ULL ) | _pdep_u64( hi, 0x0202020202020202ULL ) );
+    uint64_t opaque = ( bits | (bits >> 1) ) & 0x0101010101010101ULL;
+    bits |= opaque * (uint8_t)( palette << 2 );
+    memcpy( out, &bits, 8 );
+}
+#endif
+
+#ifdef __SSE2__
+// each byte lane tests its own bit of the broadcast plane bytes
+static inline void decodeTileRowSSE2( uint8_t lo, uint8_t hi, uint8_t palette, uint8_t *out )
+{
+    const __m128i select = _mm_set_epi8( 1, 2, 4, 8, 16, 32, 64, -128, 1, 2, 4, 8, 16, 32, 64, -128 );
+    // lo in the low 8 lanes, hi in the high 8 lanes
+    __m128i planes = _mm_unpacklo_epi64( _mm_set1_epi8( lo ), _mm_set1_epi8( hi ) );
+    __m128i set = _mm_cmpeq_epi8( _mm_and_si128( planes, select ), select );
+    __m128i bit0 = _mm_and_si128( set, _mm_set1_epi8( 1 ) );
+    __m128i bit1 = _mm_and_si128( _mm_srli_si128( set, 8 ), _mm_set1_epi8( 2 ) );
+    __m128i opaque = _mm_or_si128( set, _mm_srli_si128( set, 8 ) );
+    __m128i pixels = _mm_or_si128( _mm_or_si128( bit0, bit1 ), _mm_and_si128( opaque, _mm_set1_epi8( palette << 2 ) ) );
+    _mm_storel_epi64( reinterpret_cast<__m128i*>( out ), pixels );
+}
+#endif
+
+// pixels of a decoded row of pattern bits with palette applied, 0 stays transparent
+static inline void applyTilePalette( const uint8_t *bits, uint8_t palette, uint8_t *out )
+{
+    uint64_t pixels;
+    memcpy( &pixels, bits, 8 );
+    uint64_t opaque = ( pixels | (pixels >> 1) ) & 0x0101010101010101ULL;
+    pixels |= opaque * (uint8_t)( palette << 2 );
+    memcpy( out, &pixels, 8 );
+}
+
+// the fastest variant the build targets, BMI2 needs -mbmi2 in CXXFLAGS
+static inline void decodeTileRow( uint8_t lo, uint8_t hi, uint8_t palette, uint8_t *out )
+{
+#if defined( __BMI2__ )
+    decodeTileRowBMI2( lo, hi, palette, out );
+#elif defined( __SSE2__ )
+    decodeTileRowSSE2( lo, hi, palette, out );
+#else
+    decodeTileRowScalar( lo, hi, palette, out );
+#endif
+}
+
+#endif
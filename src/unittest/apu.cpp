@@ -0,0 +1,208 @@
+#include "../6502.h"
+#include "gtest/gtest.h"
+#include <algorithm>
+
+extern struct CPU cpu;
+
+// NROM image spinning in JMP $c000, $c003 onwards is DMC sample data
+static std::vector<uint8_t> makeImage()
+{
+    std::vector<uint8_t> image( INES_HEADER_SIZE, 0 );
+    memcpy( &image[0], "NES\x1A", 4 );
+    image[4] = 1;
+    image[5] = 1;
+    image.resize( INES_HEADER_SIZE + INES_PRG_BANK_SIZE + INES_CHR_BANK_SIZE, 0 );
+    uint8_t *prg = &image[INES_HEADER_SIZE];
+    prg[0] = 0x4c;
+    prg[1] = 0x00;
+    prg[2] = 0xc0;
+    prg[0x3FFC] = 0x00;
+    prg[0x3FFD] = 0xC0;
+    return image;
+}
+
+// run until clock() is at least time
+static void runTo( uint64_t time )
+{
+    if ( time > cpu.clock() ) {
+        cpu.execute( time - cpu.clock() );
+    }
+}
+
+// Test the frame IRQ, its acknowledge and inhibit, and the length counter in 4 step mode
+TEST(APU, FRAME_COUNTER) {
+    std::vector<uint8_t> image = makeImage();
+    ASSERT_TRUE(cpu.loadNESImage( &image[0], image.size(), "apu" ));
+    cpu.powerOn();
+    runTo( 29800 );
+    EXPECT_EQ(cpu.irq & IRQ_FRAME, 0);
+    runTo( 29840 );
+    EXPECT_EQ(cpu.irq & IRQ_FRAME, IRQ_FRAME);
+    EXPECT_EQ(cpu.read( 0x4015 ) & APUSTATUS_FRAME_IRQ, APUSTATUS_FRAME_IRQ);
+    EXPECT_EQ(cpu.irq & IRQ_FRAME, 0);
+    EXPECT_EQ(cpu.read( 0x4015 ) & APUSTATUS_FRAME_IRQ, 0);
+
+    // inhibited, length 10 runs out on the 10th half frame
+    cpu.write( 0x4017, APUFRAME_IRQ_INHIBIT );
+    uint64_t start = cpu.apu.frameStart;
+    cpu.write( 0x4015, 0x01 );
+    cpu.write( 0x4000, 0x10 );
+    cpu.write( 0x4003, 0x00 );
+    EXPECT_EQ(cpu.read( 0x4015 ) & 0x01, 0x01);
+    runTo( start + 4 * 29830 + 29829 - 50 );
+    EXPECT_EQ(cpu.read( 0x4015 ) & 0x01, 0x01);
+    runTo( start + 4 * 29830 + 29829 + 50 );
+    EXPECT_EQ(cpu.read( 0x4015 ), 0x00);
+    EXPECT_EQ(cpu.irq, 0);
+
+    // halted lengths stay, a disabled channel loses its length
+    cpu.write( 0x4000, 0x30 );
+    cpu.write( 0x4003, 0x08 );
+    runTo( cpu.clock() + 100000 );
+    EXPECT_EQ(cpu.read( 0x4015 ) & 0x01, 0x01);
+    cpu.write( 0x4015, 0x00 );
+    EXPECT_EQ(cpu.read( 0x4015 ) & 0x01, 0);
+    cpu.powerOn( 0x1000 );
+}
+
+// Test DMC fetches steal cycles, the sample length and the DMC IRQ
+TEST(APU, DMC) {
+    std::vector<uint8_t> image = makeImage();
+    ASSERT_TRUE(cpu.loadNESImage( &image[0], image.size(), "apu" ));
+    cpu.powerOn();
+    cpu.write( 0x4017, APUFRAME_IRQ_INHIBIT );
+
+    // one byte sample, fetched right away and done
+    cpu.write( 0x4010, 0x80 );
+    cpu.write( 0x4012, 0x00 );
+    cpu.write( 0x4013, 0x00 );
+    uint64_t start = cpu.clock();
+    cpu.write( 0x4015, 0x10 );
+    EXPECT_EQ(cpu.clock() - start, (uint64_t)DMC_DMA_CYCLES);
+    EXPECT_EQ(cpu.apu.dmc.buffer, 0x4c);
+    EXPECT_EQ(cpu.irq & IRQ_DMC, IRQ_DMC);
+    EXPECT_EQ(cpu.read( 0x4015 ), APUSTATUS_DMC_IRQ);
+    cpu.write( 0x4015, 0x00 );
+    EXPECT_EQ(cpu.irq & IRQ_DMC, 0);
+
+    // 17 bytes at 428 cycles a bit, the first goes straight to the buffer
+    runTo( cpu.clock() + 8 * 428 );
+    cpu.write( 0x4013, 0x01 );
+    cpu.write( 0x4015, 0x10 );
+    start = cpu.clock();
+    runTo( start + 15 * 8 * 428 );
+    EXPECT_EQ(cpu.read( 0x4015 ), 0x10);
+    EXPECT_EQ(cpu.irq & IRQ_DMC, 0);
+    runTo( start + 17 * 8 * 428 );
+    EXPECT_EQ(cpu.read( 0x4015 ), APUSTATUS_DMC_IRQ);
+    EXPECT_EQ(cpu.apu.dmc.address, 0xC011);
+
+    // looped samples never finish
+    cpu.write( 0x4010, 0x4F );
+    cpu.write( 0x4015, 0x10 );
+    runTo( cpu.clock() + 100000 );
+    EXPECT_EQ(cpu.read( 0x4015 ), 0x10);
+    cpu.powerOn( 0x1000 );
+}
+
+// $4015 and the clock every 1000 cycles while all channels, the DMC and the
+// frame IRQ run
+static std::vector<uint64_t> timingTrace( bool skip )
+{
+    // the CPU keeps running from the image after this returns
+    static std::vector<uint8_t> image;
+    image = makeImage();
+    EXPECT_TRUE(cpu.loadNESImage( &image[0], image.size(), "apu" ));
+    cpu.powerOn();
+    cpu.apu.skipSynthesis( skip );
+    static const uint16_t writes[][2] = {
+        { 0x4015, 0x1F }, { 0x4000, 0x1F }, { 0x4003, 0x00 }, { 0x4004, 0x1F }, { 0x4007, 0x18 },
+        { 0x4008, 0x10 }, { 0x400B, 0x18 }, { 0x400C, 0x10 }, { 0x400F, 0x28 },
+        { 0x4010, 0x8E }, { 0x4012, 0x00 }, { 0x4013, 0x02 }, { 0x4015, 0x1F },
+    };
+    for ( size_t i = 0; i < sizeof( writes ) / sizeof( writes[0] ); i++ ) {
+        cpu.write( writes[i][0], writes[i][1] );
+    }
+    std::vector<uint64_t> trace;
+    for ( int i = 0; i < 300; i++ ) {
+        runTo( cpu.clock() + 1000 );
+        trace.push_back( ( cpu.clock() << 16 ) | ( cpu.irq << 8 ) | cpu.read( 0x4015 ) );
+        if ( i == 150 ) {
+            cpu.write( 0x4017, APUFRAME_FIVE_STEP );
+            cpu.write( 0x4015, 0x1F );
+        }
+    }
+    return trace;
+}
+
+// Test the timing only mode leaves everything the CPU sees as it was and makes no samples
+TEST(APU, TIMING_ONLY) {
+    std::vector<uint64_t> full = timingTrace( false );
+    EXPECT_GT(cpu.apu.samplesAvailable(), 0);
+    std::vector<uint64_t> timing = timingTrace( true );
+    EXPECT_EQ(cpu.apu.samplesAvailable(), 0);
+    ASSERT_EQ(full.size(), timing.size());
+    for ( size_t i = 0; i < full.size(); i++ ) {
+        ASSERT_EQ(full[i], timing[i]) << "at " << i;
+    }
+    // lengths ran out, the frame IRQ and the DMC were seen
+    uint8_t seen = 0;
+    for ( size_t i = 0; i < full.size(); i++ ) {
+        seen |= full[i];
+    }
+    EXPECT_EQ(seen, 0xDF);
+    EXPECT_EQ(full.back() & 0x0F, 0u);
+
+    // synthesis comes back from where the channels are
+    cpu.apu.skipSynthesis( false );
+    runTo( cpu.clock() + 10000 );
+    EXPECT_GT(cpu.apu.samplesAvailable(), 0);
+    cpu.powerOn( 0x1000 );
+}
+
+// Test a 440Hz square comes out at the sample rate with the right pitch and
+// that nothing playing gives silence
+TEST(APU, PULSE_SYNTHESIS) {
+    std::vector<uint8_t> image = makeImage();
+    ASSERT_TRUE(cpu.loadNESImage( &image[0], image.size(), "apu" ));
+    cpu.powerOn();
+    cpu.write( 0x4017, APUFRAME_IRQ_INHIBIT );
+    std::vector<int16_t> samples( APU_SAMPLE_BUFFER );
+    runTo( APU_CLOCK_RATE / 20 );
+    int count = cpu.apu.readSamples( &samples[0], samples.size() );
+    EXPECT_NEAR(count, APU_SAMPLE_RATE / 20, 2);
+    for ( int i = 0; i < count; i++ ) {
+        ASSERT_EQ(samples[i], 0);
+    }
+
+    // 50% duty, constant volume 15, period (253 + 1) * 16 cycles
+    cpu.write( 0x4015, 0x01 );
+    cpu.write( 0x4000, 0xBF );
+    cpu.write( 0x4001, 0x00 );
+    cpu.write( 0x4002, 0xFD );
+    cpu.write( 0x4003, 0x00 );
+    runTo( cpu.clock() + APU_CLOCK_RATE / 10 );
+    count = cpu.apu.readSamples( &samples[0], samples.size() );
+    EXPECT_NEAR(count, APU_SAMPLE_RATE / 10, 2);
+    // the first edge rings around 0 before the high-pass has centred the wave
+    int settle = APU_SAMPLE_RATE / 100;
+    int crossings = 0;
+    int peak = 0;
+    for ( int i = settle + 1; i < count; i++ ) {
+        if ( ( samples[i - 1] < 0 ) != ( samples[i] < 0 ) ) {
+            crossings++;
+        }
+        peak = std::max( peak, abs( samples[i] ) );
+    }
+    double hz = (double)APU_CLOCK_RATE / ( 254 * 16 );
+    EXPECT_NEAR(crossings, 2 * hz * ( count - settle ) / APU_SAMPLE_RATE, 2);
+    EXPECT_GT(peak, 15 * 246 / 3);
+    EXPECT_LT(peak, 15 * 246 * 5 / 4);
+    EXPECT_EQ(cpu.apu.dropped, 0u);
+
+    // unread samples are dropped instead of piling up
+    runTo( cpu.clock() + APU_CLOCK_RATE );
+    EXPECT_EQ(cpu.apu.samplesAvailable(), APU_SAMPLE_BUFFER);
+    EXPECT_GT(cpu.apu.dropped, 0u);
+    cpu.powerOn( 0x1000 );
+}
@@ -0,0 +1,195 @@
+#include "../6502.h"
+#include "gtest/gtest.h"
+#include <filesystem>
+
+extern struct CPU cpu;
+
+static uint32_t crc32Bitwise( const uint8_t *data, size_t length )
+{
+    uint32_t crc = 0xFFFFFFFF;
+    for ( size_t i = 0; i < length; i++ ) {
+        crc ^= data[i];
+        for ( int k = 0; k < 8; k++ ) {
+            crc = ( crc >> 1 ) ^ ( 0xEDB88320 & -(crc & 1) );
+        }
+    }
+    return ~crc;
+}
+
+static std::string sha1Hex( const uint8_t *data, size_t length )
+{
+    uint8_t digest[SHA1_DIGEST_SIZE];
+    char str[SHA1_DIGEST_SIZE*2+1];
+    SHA1 sha;
+    sha.update( data, length );
+    sha.final( digest );
+    sha1ToString( digest, str );
+    return str;
+}
+
+// Test CRC-32 check value
+TEST(HASH, CRC32_CHECK) {
+    EXPECT_EQ(crc32( reinterpret_cast<const uint8_t*>("123456789"), 9 ), 0xCBF43926u);
+    EXPECT_EQ(crc32( NULL, 0 ), 0x0u);
+}
+
+// Test CRC-32 of all lengths around the folding thresholds against a bitwise implementation
+TEST(HASH, CRC32_LENGTHS) {
+    std::vector<uint8_t> data( 4096 + 33 );
+    for ( size_t i = 0; i < data.size(); i++ ) {
+        data[i] = ( i * 131 + ( i >> 7 ) ) & 0xFF;
+    }
+    for ( size_t length = 0; length < 300; length++ ) {
+        EXPECT_EQ(crc32( &data[1], length ), crc32Bitwise( &data[1], length ));
+    }
+    EXPECT_EQ(crc32( &data[0], data.size() ), crc32Bitwise( &data[0], data.size() ));
+}
+
+// Test CRC-32 continuation over split buffers
+TEST(HASH, CRC32_CONTINUE) {
+    std::vector<uint8_t> data( 1000 );
+    for ( size_t i = 0; i < data.size(); i++ ) {
+        data[i] = i * 7;
+    }
+    uint32_t crc = crc32( &data[0], 333 );
+    crc = crc32( &data[333], data.size() - 333, crc );
+    EXPECT_EQ(crc, crc32( &data[0], data.size() ));
+}
+
+// Test SHA-1 with the FIPS 180 examples
+TEST(HASH, SHA1_VECTORS) {
+    EXPECT_EQ(sha1Hex( reinterpret_cast<const uint8_t*>("abc"), 3 ), "a9993e364706816aba3e25717850c26c9cd0d89d");
+    EXPECT_EQ(sha1Hex( NULL, 0 ), "da39a3ee5e6b4b0d3255bfef95601890afd80709");
+    const char *msg = "abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq";
+    EXPECT_EQ(sha1Hex( reinterpret_cast<const uint8_t*>(msg), strlen( msg ) ), "84983e441c3bd26ebaae4aa1f95129e5e54670f1");
+    std::vector<uint8_t> million( 1000000, 'a' );
+    EXPECT_EQ(sha1Hex( &million[0], million.size() ), "34aa973cd4c4daa4f61eeb2bdbad27316534016f");
+}
+
+// Test XXH64 against the reference implementation, short inputs and all stripe tails
+TEST(HASH, XXH64_VECTORS) {
+    EXPECT_EQ(xxh64( NULL, 0 ), 0xEF46DB3751D8E999ull);
+    EXPECT_EQ(xxh64( reinterpret_cast<const uint8_t*>("a"), 1 ), 0xD24EC4F1A98C6E5Bull);
+    EXPECT_EQ(xxh64( reinterpret_cast<const uint8_t*>("abc"), 3 ), 0x44BC2CF5AD770999ull);
+    std::vector<uint8_t> data( 1000 );
+    for ( size_t i = 0; i < data.size(); i++ ) {
+        data[i] = ( i * 131 + ( i >> 7 ) ) & 0xFF;
+    }
+    EXPECT_EQ(xxh64( &data[0], data.size() ), 0xDED84C6A6EED36C0ull);
+    EXPECT_EQ(xxh64( &data[0], 37, 0x1234 ), 0x41241BBEE0E4CE39ull);
+}
+
+// Test that a database entry overrides a wrong header on load
+TEST(HASH, ROMDB_CORRECTS_HEADER) {
+    cpu.loadNESFile( "test-roms/blargg/cpu/01-basics.nes" );
+    EXPECT_EQ(cpu.header.mirroring, 1);
+    char sha[SHA1_DIGEST_SIZE*2+1];
+    sha1ToString( cpu.romsha1, sha );
+
+    FILE *fp = fopen( "/tmp/nes6502_romdb.csv", "w" );
+    ASSERT_TRUE(fp != NULL);
+    fprintf( fp, "path,rom_crc32,rom_sha1,mapper,mirroring,region,fourscreen,battery\n" );
+    fprintf( fp, "\"other, rom\",12345678,%s,4,1,0,0,1\n", sha );
+    fprintf( fp, "01-basics.nes,%.8x,%s,0,0,1,0,0\n", cpu.romcrc, sha );
+    fclose( fp );
+    ASSERT_TRUE(RomDatabase::build( "/tmp/nes6502_romdb.csv", "/tmp/nes6502_romdb.db" ));
+
+    RomDatabase db;
+    ASSERT_TRUE(db.open( "/tmp/nes6502_romdb.db" ));
+    EXPECT_EQ(db.count, 2u);
+    EXPECT_TRUE(db.lookup( cpu.romcrc, cpu.romsha1 ) != NULL);
+    EXPECT_TRUE(db.lookup( cpu.romcrc ^ 1, cpu.romsha1 ) == NULL);
+
+    cpu.romdb = &db;
+    EXPECT_TRUE(cpu.loadNESFile( "test-roms/blargg/cpu/01-basics.nes" ));
+    cpu.romdb = NULL;
+    EXPECT_EQ(cpu.header.mirroring, 0);
+    EXPECT_EQ(cpu.header.region, 1);
+    EXPECT_EQ(cpu.header.mapper, 0);
+    unlink( "/tmp/nes6502_romdb.csv" );
+    unlink( "/tmp/nes6502_romdb.db" );
+}
+
+// Test building a ROM pack and loading from it by name and by hash
+TEST(HASH, ROMPACK_LOAD) {
+    std::vector<std::string> files;
+    files.push_back( "test-roms/blargg/cpu/01-basics.nes" );
+    files.push_back( "test-roms/nestest/nestest.nes" );
+    files.push_back( "test-roms/blargg/cpu/10-branches.nes" );
+    ASSERT_TRUE(RomPack::build( files, "/tmp/nes6502_test.pack" ));
+
+    RomPack pack;
+    ASSERT_TRUE(pack.open( "/tmp/nes6502_test.pack" ));
+    EXPECT_EQ(pack.count, 3u);
+    for ( uint32_t i = 0; i < pack.count; i++ ) {
+        EXPECT_EQ(pack.entries[i].offset % ROMPACK_ALIGN, 0u);
+        if ( i > 0 ) {
+            EXPECT_LE(pack.entries[i-1].crc32, pack.entries[i].crc32);
+        }
+    }
+
+    EXPECT_TRUE(cpu.loadNESFile( "test-roms/nestest/nestest.nes" ));
+    uint32_t crc = cpu.romcrc;
+    uint8_t reset[2] = { cpu.read( 0xFFFC ), cpu.read( 0xFFFD ) };
+    EXPECT_TRUE(cpu.loadFromPack( pack, "01-basics.nes" ));
+    EXPECT_NE(cpu.romcrc, crc);
+    EXPECT_TRUE(cpu.loadFromPack( pack, crc ));
+    EXPECT_EQ(cpu.romcrc, crc);
+    EXPECT_EQ(cpu.read( 0xFFFC ), reset[0]);
+    EXPECT_EQ(cpu.read( 0xFFFD ), reset[1]);
+    EXPECT_EQ(cpu.readMap[BUS_PAGES - 1], cpu.prgrom + cpu.header.prgsize - BUS_PAGE_SIZE);
+    EXPECT_TRUE(cpu.prgrom >= pack.base && cpu.prgrom < pack.base + pack.size);
+    EXPECT_FALSE(cpu.loadFromPack( pack, "missing.nes" ));
+
+    // names find could not match are refused instead of stored
+    files.push_back( "test-roms/blargg/cpu/01-basics.nes" );
+    EXPECT_FALSE(RomPack::build( files, "/tmp/nes6502_bad.pack" ));
+    std::string longName = "/tmp/" + std::string( ROMPACK_NAME_SIZE - 4, 'n' ) + ".nes";
+    std::filesystem::copy_file( "test-roms/nestest/nestest.nes", longName, std::filesystem::copy_options::overwrite_existing );
+    files.assign( 1, longName );
+    EXPECT_FALSE(RomPack::build( files, "/tmp/nes6502_bad.pack" ));
+    unlink( longName.c_str() );
+    unlink( "/tmp/nes6502_bad.pack" );
+    unlink( "/tmp/nes6502_test.pack" );
+}
+
+// Test loading a gzip compressed ROM gives the same image as the raw file
+TEST(HASH, GZIP_LOAD) {
+    EXPECT_TRUE(cpu.loadNESFile( "test-roms/blargg/cpu/01-basics.nes" ));
+    std::vector<uint8_t> raw( cpu.romdata );
+    uint32_t crc = cpu.romcrc;
+
+    gzFile gz = gzopen( "/tmp/nes6502_test.nes.gz", "wb9" );
+    ASSERT_TRUE(gz != NULL);
+    EXPECT_EQ(gzwrite( gz, &raw[0], raw.size() ), (int)raw.size());
+    gzclose( gz );
+
+    cpu.romdata.clear();
+    EXPECT_TRUE(cpu.loadNESFile( "/tmp/nes6502_test.nes.gz" ));
+    EXPECT_EQ(cpu.romcrc, crc);
+    EXPECT_TRUE(cpu.romdata == raw);
+    unlink( "/tmp/nes6502_test.nes.gz" );
+
+    // truncated stream
+    gz = gzopen( "/tmp/nes6502_test.nes.gz", "wb" );
+    gzwrite( gz, &raw[0], raw.size() / 2 );
+    gzclose( gz );
+    EXPECT_FALSE(cpu.loadNESFile( "/tmp/nes6502_test.nes.gz" ));
+    unlink( "/tmp/nes6502_test.nes.gz" );
+
+    // failed loads leave the running cartridge and its image alone
+    EXPECT_FALSE(cpu.loadNESFile( "/tmp/nes6502_test.nes.gz" ));
+    FILE *fp = fopen( "test-roms/nestest/nestest.nes", "rb" );
+    ASSERT_TRUE(fp != NULL);
+    std::vector<uint8_t> other( 0x4000 );
+    EXPECT_EQ(fread( &other[0], 1, other.size(), fp ), other.size());
+    fclose( fp );
+    gz = gzopen( "/tmp/nes6502_test.nes.gz", "wb" );
+    gzwrite( gz, &other[0], other.size() );
+    gzclose( gz );
+    EXPECT_FALSE(cpu.loadNESFile( "/tmp/nes6502_test.nes.gz" ));
+    unlink( "/tmp/nes6502_test.nes.gz" );
+    EXPECT_TRUE(cpu.romdata == raw);
+    EXPECT_EQ(cpu.prgrom, &cpu.romdata[cpu.header.prgoffset]);
+    EXPECT_EQ(cpu.romcrc, crc);
+}
@@ -0,0 +1,404 @@
+#include "../6502.h"
+#include "../mapper.h"
+#include "../bus.h"
+#include "gtest/gtest.h"
+
+extern struct CPU cpu;
+
+// iNES image where every 8KB of PRG is filled with its bank number and
+// every 1KB of CHR with its bank number
+static std::vector<uint8_t> makeImage( int mapper, int prgbanks, int chrbanks )
+{
+    std::vector<uint8_t> image( INES_HEADER_SIZE, 0 );
+    image[0] = 'N';
+    image[1] = 'E';
+    image[2] = 'S';
+    image[3] = 0x1A;
+    image[4] = prgbanks;
+    image[5] = chrbanks;
+    image[6] = (mapper & 0xF) << 4;
+    image[7] = mapper & 0xF0;
+    for ( int i = 0; i < prgbanks * 2; i++ ) {
+        image.insert( image.end(), 0x2000, i );
+    }
+    for ( int i = 0; i < chrbanks * 8; i++ ) {
+        image.insert( image.end(), 0x400, i );
+    }
+    return image;
+}
+
+static void mmc1Write( uint16_t addr, uint8_t val )
+{
+    for ( int i = 0; i < 5; i++ ) {
+        cpu.write( addr, val >> i );
+    }
+}
+
+// Test RAM mirrors, 16KB mirroring and that PRG writes do not change ROM
+TEST(MAPPER, NROM) {
+    std::vector<uint8_t> image = makeImage( 0, 1, 1 );
+    ASSERT_TRUE(cpu.loadNESImage( &image[0], image.size(), "nrom" ));
+    EXPECT_EQ(cpu.readMap[0x8000 >> BUS_PAGE_SHIFT], cpu.prgrom);
+    EXPECT_EQ(cpu.read( 0x8000 ), 0);
+    EXPECT_EQ(cpu.read( 0xA000 ), 1);
+    EXPECT_EQ(cpu.read( 0xC000 ), 0);
+    EXPECT_EQ(cpu.read( 0xE000 ), 1);
+    cpu.write( 0x8000, 0x55 );
+    EXPECT_EQ(cpu.read( 0x8000 ), 0);
+
+    cpu.write( 0x0012, 0x34 );
+    EXPECT_EQ(cpu.read( 0x0812 ), 0x34);
+    EXPECT_EQ(cpu.read( 0x1812 ), 0x34);
+    cpu.write( 0x1FFF, 0x56 );
+    EXPECT_EQ(cpu.mem[0x07FF], 0x56);
+
+    // unit tests go back to flat memory
+    cpu.powerOn( 0x1000 );
+    EXPECT_TRUE(cpu.mapper == NULL);
+    cpu.write( 0x8000, 0x55 );
+    EXPECT_EQ(cpu.mem[0x8000], 0x55);
+}
+
+// Test an image with an unsupported mapper leaves the running cartridge as it was
+TEST(MAPPER, UNSUPPORTED) {
+    std::vector<uint8_t> image = makeImage( 0, 1, 1 );
+    ASSERT_TRUE(cpu.loadNESImage( &image[0], image.size(), "nrom" ));
+    uint32_t crc = cpu.romcrc;
+    std::vector<uint8_t> other = makeImage( 5, 2, 1 );
+    EXPECT_FALSE(cpu.loadNESImage( &other[0], other.size(), "mmc5" ));
+    EXPECT_EQ(cpu.header.mapper, 0);
+    EXPECT_EQ(cpu.header.prgsize, (uint32_t)INES_PRG_BANK_SIZE);
+    EXPECT_EQ(cpu.prgrom, &image[INES_HEADER_SIZE]);
+    EXPECT_EQ(cpu.chrrom, &image[INES_HEADER_SIZE + INES_PRG_BANK_SIZE]);
+    EXPECT_EQ(cpu.romcrc, crc);
+    EXPECT_TRUE(cpu.executor == &CPU::run< CartBus<NROM> >);
+    EXPECT_EQ(cpu.read( 0xE000 ), 1);
+    cpu.exception = false;
+    cpu.powerOn( 0x1000 );
+}
+
+// Test MMC1 serial writes, PRG modes and CHR 4KB banks
+TEST(MAPPER, MMC1) {
+    std::vector<uint8_t> image = makeImage( 1, 8, 2 );
+    ASSERT_TRUE(cpu.loadNESImage( &image[0], image.size(), "mmc1" ));
+    Mapper *mapper = cpu.mapper.get();
+    EXPECT_EQ(cpu.read( 0x8000 ), 0);
+    EXPECT_EQ(cpu.read( 0xC000 ), 14);
+
+    mmc1Write( 0xE000, 3 );
+    EXPECT_EQ(cpu.read( 0x8000 ), 6);
+    EXPECT_EQ(cpu.read( 0xA000 ), 7);
+    EXPECT_EQ(cpu.read( 0xC000 ), 14);
+
+    // 32KB mode ignores the low bank bit
+    mmc1Write( 0x8000, 0x00 );
+    EXPECT_EQ(cpu.read( 0x8000 ), 4);
+    EXPECT_EQ(cpu.read( 0xE000 ), 7);
+    EXPECT_EQ(mapper->mirroring, MIRROR_SINGLE_LOW);
+
+    // reset bit restores fixed last bank
+    cpu.write( 0x8000, 0x80 );
+    EXPECT_EQ(cpu.read( 0xC000 ), 14);
+
+    mmc1Write( 0x8000, 0x12 );
+    mmc1Write( 0xA000, 1 );
+    mmc1Write( 0xC000, 3 );
+    EXPECT_EQ(mapper->mirroring, MIRROR_VERTICAL);
+    EXPECT_EQ(mapper->chrMap[0][0], 4);
+    EXPECT_EQ(mapper->chrMap[4][0], 12);
+}
+
+// Test UxROM and CNROM bank selects
+TEST(MAPPER, UXROM_CNROM) {
+    std::vector<uint8_t> image = makeImage( 2, 8, 0 );
+    ASSERT_TRUE(cpu.loadNESImage( &image[0], image.size(), "uxrom" ));
+    EXPECT_EQ(cpu.read( 0xC000 ), 14);
+    cpu.write( 0x8000, 5 );
+    EXPECT_EQ(cpu.read( 0x8000 ), 10);
+    EXPECT_EQ(cpu.read( 0xBFFF ), 11);
+    EXPECT_TRUE(cpu.mapper->chrwritable);
+
+    image = makeImage( 3, 2, 4 );
+    ASSERT_TRUE(cpu.loadNESImage( &image[0], image.size(), "cnrom" ));
+    cpu.write( 0xFFFF, 2 );
+    EXPECT_EQ(cpu.mapper->chrMap[0][0], 16);
+    EXPECT_EQ(cpu.mapper->chrMap[7][0], 23);
+}
+
+// Test MMC3 PRG and CHR inversion
+TEST(MAPPER, MMC3) {
+    std::vector<uint8_t> image = makeImage( 4, 8, 8 );
+    ASSERT_TRUE(cpu.loadNESImage( &image[0], image.size(), "mmc3" ));
+    Mapper *mapper = cpu.mapper.get();
+    EXPECT_EQ(cpu.read( 0xC000 ), 14);
+    EXPECT_EQ(cpu.read( 0xE000 ), 15);
+
+    cpu.write( 0x8000, 6 );
+    cpu.write( 0x8001, 3 );
+    cpu.write( 0x8000, 7 );
+    cpu.write( 0x8001, 9 );
+    EXPECT_EQ(cpu.read( 0x8000 ), 3);
+    EXPECT_EQ(cpu.read( 0xA000 ), 9);
+
+    cpu.write( 0x8000, 0x40 );
+    EXPECT_EQ(cpu.read( 0x8000 ), 14);
+    EXPECT_EQ(cpu.read( 0xC000 ), 3);
+
+    cpu.write( 0x8000, 0x80 );
+    cpu.write( 0x8001, 10 );
+    EXPECT_EQ(mapper->chrMap[4][0], 10);
+    EXPECT_EQ(mapper->chrMap[5][0], 11);
+
+    cpu.write( 0xA000, 1 );
+    EXPECT_EQ(mapper->mirroring, MIRROR_HORIZONTAL);
+}
+
+// Test AxROM 32KB banks and single screen select
+TEST(MAPPER, AXROM) {
+    std::vector<uint8_t> image = makeImage( 7, 8, 0 );
+    ASSERT_TRUE(cpu.loadNESImage( &image[0], image.size(), "axrom" ));
+    EXPECT_EQ(cpu.read( 0x8000 ), 0);
+    cpu.write( 0x8000, 0x13 );
+    EXPECT_EQ(cpu.read( 0x8000 ), 12);
+    EXPECT_EQ(cpu.read( 0xE000 ), 15);
+    EXPECT_EQ(cpu.mapper->mirroring, MIRROR_SINGLE_HIGH);
+
+    image = makeImage( 5, 2, 1 );
+    EXPECT_FALSE(cpu.loadNESImage( &image[0], image.size(), "mmc5" ));
+    cpu.exception = false;
+    cpu.powerOn( 0x1000 );
+}
+
+// Test every board's interpreter gives the same result as the page table path,
+// across a bank switch and for code running into the RAM mirrors
+TEST(MAPPER, EXECUTOR) {
+    // $c000    a2 00     LDX #$00
+    // $c002    bd 00 a0  LDA $a000,X
+    // $c005    7d 00 03  ADC $0300,X
+    // $c008    9d 00 0b  STA $0b00,X
+    // $c00b    e8        INX
+    // $c00c    d0 f4     BNE $c002
+    // $c00e    a9 02     LDA #$02
+    // $c010    8d 00 80  STA $8000
+    // $c013    ad 00 a0  LDA $a000
+    // $c016    85 11     STA $11
+    // $c018    20 fe 07  JSR $07fe
+    // $c01b    85 10     STA $10
+    // $c01d    4c 1d c0  JMP $c01d
+    static const uint8_t program[] = {
+        0xa2, 0x00, 0xbd, 0x00, 0xa0, 0x7d, 0x00, 0x03, 0x9d, 0x00, 0x0b,
+        0xe8, 0xd0, 0xf4, 0xa9, 0x02, 0x8d, 0x00, 0x80, 0xad, 0x00, 0xa0,
+        0x85, 0x11, 0x20, 0xfe, 0x07, 0x85, 0x10, 0x4c, 0x1d, 0xc0
+    };
+    // the last 16KB sits at $c000 on all of these
+    const int boards[][2] = { { 0, 2 }, { 1, 8 }, { 2, 8 }, { 3, 2 }, { 4, 8 } };
+    // later tests run into RAM through zeroed vectors
+    uint8_t saved[3] = { cpu.mem[0x000], cpu.mem[0x7FE], cpu.mem[0x7FF] };
+    void (CPU::*executors[])( int ) = {
+        &CPU::run< CartBus<NROM> >, &CPU::run< CartBus<MMC1> >, &CPU::run< CartBus<UxROM> >,
+        &CPU::run< CartBus<CNROM> >, &CPU::run< CartBus<MMC3> >
+    };
+    for ( int b = 0; b < 5; b++ ) {
+        std::vector<uint8_t> image = makeImage( boards[b][0], boards[b][1], 1 );
+        uint8_t *last = &image[INES_HEADER_SIZE + ( boards[b][1] - 1 ) * INES_PRG_BANK_SIZE];
+        memcpy( last, program, sizeof( program ) );
+        last[0x3FFC] = 0x00;
+        last[0x3FFD] = 0xC0;
+
+        uint8_t result[2][0x100];
+        uint8_t zp[2][2];
+        for ( int i = 0; i < 2; i++ ) {
+            ASSERT_TRUE(cpu.loadNESImage( &image[0], image.size(), "executor" ));
+            if ( i == 0 ) {
+                EXPECT_TRUE(cpu.executor == executors[b]) << "mapper " << boards[b][0];
+            } else {
+                cpu.executor = &CPU::run<PagedBus>;
+            }
+            cpu.powerOn();
+            for ( int j = 0; j < 0x100; j++ ) {
+                cpu.mem[0x300 + j] = j;
+            }
+            // LDA #$42 at $07fe, the RTS after it is read through the mirror at $0800
+            cpu.mem[0x7FE] = 0xA9;
+            cpu.mem[0x7FF] = 0x42;
+            cpu.mem[0x000] = 0x60;
+            cpu.mem[0x800] = 0x00;
+            cpu.execute( 20000 );
+            EXPECT_FALSE(cpu.exception);
+            memcpy( result[i], &cpu.mem[0x300], 0x100 );
+            zp[i][0] = cpu.mem[0x10];
+            zp[i][1] = cpu.mem[0x11];
+        }
+        EXPECT_EQ(memcmp( result[0], result[1], 0x100 ), 0) << "mapper " << boards[b][0];
+        EXPECT_EQ(zp[0][0], 0x42) << "mapper " << boards[b][0];
+        EXPECT_EQ(zp[1][0], 0x42);
+        EXPECT_EQ(zp[0][1], zp[1][1]) << "mapper " << boards[b][0];
+        if ( boards[b][0] == 2 ) {
+            // UxROM switched bank 2 in at $8000
+            EXPECT_EQ(zp[0][1], 5);
+        }
+    }
+    cpu.mem[0x000] = saved[0];
+    cpu.mem[0x7FE] = saved[1];
+    cpu.mem[0x7FF] = saved[2];
+    cpu.powerOn( 0x1000 );
+}
+
+// Test A12 rise counting against walking every PPU dot
+TEST(MAPPER, MMC3_A12_RISES) {
+    std::vector<uint8_t> image = makeImage( 4, 8, 8 );
+    ASSERT_TRUE(cpu.loadNESImage( &image[0], image.size(), "mmc3" ));
+    MMC3 *mmc3 = static_cast<MMC3*>( cpu.mapper.get() );
+    mmc3->ppumask = 0x18;
+    const uint8_t ctrl[] = { 0x08, 0x10, 0x20 };
+    for ( int i = 0; i < 3; i++ ) {
+        mmc3->ppuctrl = ctrl[i];
+        int a12 = mmc3->a12Dot();
+        ASSERT_GE(a12, 0);
+        uint64_t rises = 0;
+        for ( uint64_t dot = 0; dot < 2 * PPU_DOTS_PER_FRAME + 1000; dot++ ) {
+            ASSERT_EQ(mmc3->risesBefore( dot ), rises);
+            int line = ( dot / PPU_DOTS_PER_LINE ) % PPU_LINES_PER_FRAME;
+            if ( ( line < 240 || line == PPU_LINES_PER_FRAME - 1 ) && (int)( dot % PPU_DOTS_PER_LINE ) == a12 ) {
+                EXPECT_EQ(mmc3->riseDot( rises ), dot);
+                rises++;
+            }
+        }
+    }
+    mmc3->ppumask = 0;
+    EXPECT_EQ(mmc3->a12Dot(), -1);
+}
+
+// Test the scanline IRQ fires at the predicted cycle and can be acknowledged
+TEST(MAPPER, MMC3_IRQ) {
+    // $e000    a9 08     LDA #$08
+    // $e002    8d 00 20  STA $2000
+    // $e005    a9 18     LDA #$18
+    // $e007    8d 01 20  STA $2001
+    // $e00a    a9 0a     LDA #$0a
+    // $e00c    8d 00 c0  STA $c000
+    // $e00f    8d 01 c0  STA $c001
+    // $e012    8d 01 e0  STA $e001
+    // $e015    58        CLI
+    // $e016    4c 16 e0  JMP $e016
+    // irq:
+    // $e020    ee 00 03  INC $0300
+    // $e023    8d 00 e0  STA $e000
+    // $e026    8d 01 e0  STA $e001
+    // $e029    40        RTI
+    static const uint8_t program[] = {
+        0xa9, 0x08, 0x8d, 0x00, 0x20, 0xa9, 0x18, 0x8d, 0x01, 0x20, 0xa9, 0x0a,
+        0x8d, 0x00, 0xc0, 0x8d, 0x01, 0xc0, 0x8d, 0x01, 0xe0, 0x58, 0x4c, 0x16,
+        0xe0
+    };
+    static const uint8_t handler[] = {
+        0xee, 0x00, 0x03, 0x8d, 0x00, 0xe0, 0x8d, 0x01, 0xe0, 0x40
+    };
+    std::vector<uint8_t> image = makeImage( 4, 8, 8 );
+    uint8_t *last = &image[INES_HEADER_SIZE + 7 * INES_PRG_BANK_SIZE + 0x2000];
+    memcpy( last, program, sizeof( program ) );
+    memcpy( last + 0x20, handler, sizeof( handler ) );
+    last[0x1FFC] = 0x00;
+    last[0x1FFD] = 0xE0;
+    last[0x1FFE] = 0x20;
+    last[0x1FFF] = 0xE0;
+    ASSERT_TRUE(cpu.loadNESImage( &image[0], image.size(), "mmc3" ));
+    cpu.powerOn();
+    cpu.mem[0x300] = 0;
+
+    // reload then 10 more edges, line 10 dot 260
+    cpu.execute( 100 );
+    EXPECT_EQ(cpu.scheduler.when[EVENT_MAPPER], ( 10 * PPU_DOTS_PER_LINE + 260 + 2 ) / 3u);
+    EXPECT_EQ(cpu.mem[0x300], 0);
+
+    cpu.execute( 2000 - 100 );
+    EXPECT_EQ(cpu.mem[0x300], 1);
+    EXPECT_EQ(cpu.scheduler.when[EVENT_MAPPER], ( 21 * PPU_DOTS_PER_LINE + 260 + 2 ) / 3u);
+    EXPECT_EQ(cpu.irq, 0);
+
+    // every 11th line up to line 230
+    cpu.execute( 29000 - 2000 );
+    EXPECT_EQ(cpu.mem[0x300], 21);
+    EXPECT_FALSE(cpu.exception);
+    cpu.powerOn( 0x1000 );
+}
+
+// Test battery PRG-RAM is mapped from the .sav file and survives a reload
+TEST(MAPPER, BATTERY_SAVE) {
+    EXPECT_EQ(SaveFile::path( "roms/game.nes.gz" ), "roms/game.sav");
+    EXPECT_EQ(SaveFile::path( "roms.d/game" ), "roms.d/game.sav");
+
+    std::vector<uint8_t> image = makeImage( 1, 2, 1 );
+    image[6] |= 0x02;
+    FILE *fp = fopen( "/tmp/nes6502_battery.nes", "wb" );
+    ASSERT_TRUE(fp != NULL);
+    fwrite( &image[0], 1, image.size(), fp );
+    fclose( fp );
+    unlink( "/tmp/nes6502_battery.sav" );
+
+    ASSERT_TRUE(cpu.loadNESFile( "/tmp/nes6502_battery.nes" ));
+    ASSERT_TRUE(cpu.save.data != NULL);
+    EXPECT_EQ(cpu.scheduler.when[EVENT_SAVE_FLUSH], cpu.clock() + SAVE_FLUSH_CYCLES);
+    EXPECT_EQ(cpu.read( 0x6000 ), 0);
+    cpu.write( 0x6000, 0x42 );
+    cpu.write( 0x7FFF, 0x24 );
+    EXPECT_EQ(cpu.save.data[0], 0x42);
+
+    // unloading the cartridge unmaps it, the data is in the file
+    cpu.powerOn( 0x1000 );
+    EXPECT_TRUE(cpu.save.data == NULL);
+    fp = fopen( "/tmp/nes6502_battery.sav", "rb" );
+    ASSERT_TRUE(fp != NULL);
+    uint8_t sav[SAVE_PRG_RAM_SIZE];
+    EXPECT_EQ(fread( sav, 1, sizeof( sav ), fp ), sizeof( sav ));
+    fclose( fp );
+    EXPECT_EQ(sav[0], 0x42);
+    EXPECT_EQ(sav[SAVE_PRG_RAM_SIZE - 1], 0x24);
+
+    ASSERT_TRUE(cpu.loadNESFile( "/tmp/nes6502_battery.nes" ));
+    EXPECT_EQ(cpu.read( 0x6000 ), 0x42);
+    cpu.powerOn( 0x1000 );
+    unlink( "/tmp/nes6502_battery.nes" );
+    unlink( "/tmp/nes6502_battery.sav" );
+}
+
+// Test CHR-ROM is decoded once with flipped copies and CHR-RAM tiles are decoded again after a write
+TEST(MAPPER, CHR_CACHE) {
+    std::vector<uint8_t> image = makeImage( 3, 1, 2 );
+    ASSERT_TRUE(cpu.loadNESImage( &image[0], image.size(), "cnrom" ));
+    Mapper *mapper = cpu.mapper.get();
+    EXPECT_EQ(mapper->chrDecoded.size(), 2u * INES_CHR_BANK_SIZE / CHR_TILE_SIZE * CHR_DECODED_SIZE);
+    // 1KB bank 3 has both planes 0x03, the two rightmost pixels are color 3
+    const uint8_t *row = mapper->tileRow( 0x0C25, false );
+    EXPECT_EQ(row[0], 0);
+    EXPECT_EQ(row[5], 0);
+    EXPECT_EQ(row[6], 3);
+    EXPECT_EQ(row[7], 3);
+    row = mapper->tileRow( 0x0C25, true );
+    EXPECT_EQ(row[0], 3);
+    EXPECT_EQ(row[1], 3);
+    EXPECT_EQ(row[2], 0);
+    // lookups follow the banks
+    mapper->mapChr( 0, 1, 0x2000 );
+    EXPECT_EQ(mapper->tileRow( 0x0000, false )[4], 3);
+    // CHR-ROM writes are ignored
+    cpu.ppu.write( 0x0000, 0xFF );
+    EXPECT_EQ(mapper->tileRow( 0x0000, false )[0], 0);
+
+    image = makeImage( 2, 2, 0 );
+    ASSERT_TRUE(cpu.loadNESImage( &image[0], image.size(), "uxrom" ));
+    mapper = cpu.mapper.get();
+    EXPECT_EQ(mapper->tileRow( 0x1013, false )[0], 0);
+    cpu.ppu.write( 0x1013, 0xF0 );
+    cpu.ppu.write( 0x101B, 0xFF );
+    uint32_t tile = 0x1010 / CHR_TILE_SIZE;
+    EXPECT_NE(mapper->chrDirty[tile >> 6] & ( 1ULL << (tile & 63) ), 0u);
+    row = mapper->tileRow( 0x1013, false );
+    EXPECT_EQ(mapper->chrDirty[tile >> 6], 0u);
+    EXPECT_EQ(row[0], 3);
+    EXPECT_EQ(row[3], 3);
+    EXPECT_EQ(row[4], 2);
+    EXPECT_EQ(mapper->tileRow( 0x1013, true )[0], 2);
+    EXPECT_EQ(mapper->tileRow( 0x1012, false )[0], 0);
+    cpu.powerOn( 0x1000 );
+}
@@ -0,0 +1,160 @@
+#include "../6502.h"
+#include "gtest/gtest.h"
+
+extern struct CPU cpu;
+
+static void writeFile( const char *file, const std::vector<uint8_t> &data )
+{
+    FILE *fp = fopen( file, "wb" );
+    ASSERT_TRUE(fp != NULL);
+    fwrite( data.data(), 1, data.size(), fp );
+    fclose( fp );
+}
+
+static void bpsNumber( std::vector<uint8_t> &out, uint64_t data )
+{
+    while ( true ) {
+        uint8_t x = data & 0x7F;
+        data >>= 7;
+        if ( data == 0 ) {
+            out.push_back( 0x80 | x );
+            break;
+        }
+        out.push_back( x );
+        data--;
+    }
+}
+
+static void bpsLE32( std::vector<uint8_t> &out, uint32_t value )
+{
+    for ( int i = 0; i < 4; i++ ) {
+        out.push_back( value >> (i*8) );
+    }
+}
+
+// Test IPS records, RLE records and growing the image
+TEST(PATCH, IPS_APPLY) {
+    std::vector<uint8_t> image( 16, 0x11 );
+    uint8_t patch[] = { 'P','A','T','C','H',
+        0x00,0x00,0x02, 0x00,0x02, 0xAA,0xBB, // 2 bytes at 2
+        0x00,0x00,0x08, 0x00,0x00, 0x00,0x04, 0xCC, // 4 times 0xCC at 8
+        0x00,0x00,0x12, 0x00,0x01, 0xDD, // past the end
+        'E','O','F' };
+    ASSERT_TRUE(applyIPS( patch, sizeof( patch ), image ));
+    EXPECT_EQ(image.size(), 0x13u);
+    EXPECT_EQ(image[1], 0x11);
+    EXPECT_EQ(image[2], 0xAA);
+    EXPECT_EQ(image[3], 0xBB);
+    EXPECT_EQ(image[8], 0xCC);
+    EXPECT_EQ(image[11], 0xCC);
+    EXPECT_EQ(image[12], 0x11);
+    EXPECT_EQ(image[0x12], 0xDD);
+    uint8_t broken[] = { 'P','A','T','C','H', 0x00,0x00,0x02, 0x00,0x08, 0xAA };
+    EXPECT_FALSE(applyIPS( broken, sizeof( broken ), image ));
+}
+
+// Test BPS with all four actions and checksum verification
+TEST(PATCH, BPS_APPLY) {
+    std::vector<uint8_t> source;
+    for ( int i = 0; i < 64; i++ ) {
+        source.push_back( i );
+    }
+    std::vector<uint8_t> patch = { 'B','P','S','1' };
+    bpsNumber( patch, source.size() );
+    bpsNumber( patch, 40 );
+    bpsNumber( patch, 0 );
+    bpsNumber( patch, ((10 - 1) << 2) | 0 ); // SourceRead 0-9
+    bpsNumber( patch, ((2 - 1) << 2) | 1 ); // TargetRead
+    patch.push_back( 0xE0 );
+    patch.push_back( 0xE1 );
+    bpsNumber( patch, ((8 - 1) << 2) | 2 ); // SourceCopy from 50
+    bpsNumber( patch, 50 << 1 );
+    bpsNumber( patch, ((20 - 1) << 2) | 3 ); // TargetCopy from 10, overlapping
+    bpsNumber( patch, 10 << 1 );
+
+    std::vector<uint8_t> expected( source.begin(), source.begin() + 10 );
+    expected.push_back( 0xE0 );
+    expected.push_back( 0xE1 );
+    expected.insert( expected.end(), source.begin() + 50, source.begin() + 58 );
+    for ( int i = 0; i < 20; i++ ) {
+        expected.push_back( expected[10 + i] );
+    }
+    bpsLE32( patch, crc32( source.data(), source.size() ) );
+    bpsLE32( patch, crc32( expected.data(), expected.size() ) );
+    bpsLE32( patch, crc32( patch.data(), patch.size() ) );
+
+    std::vector<uint8_t> target;
+    ASSERT_TRUE(applyBPS( patch.data(), patch.size(), source, target ));
+    EXPECT_TRUE(target == expected);
+
+    source[0] ^= 1;
+    EXPECT_FALSE(applyBPS( patch.data(), patch.size(), source, target ));
+}
+
+// Test a SourceCopy offset moving before the start of the source is rejected
+// instead of wrapping around past the bounds check
+TEST(PATCH, BPS_NEGATIVE_OFFSET) {
+    std::vector<uint8_t> source( 64, 0x11 );
+    std::vector<uint8_t> patch = { 'B','P','S','1' };
+    bpsNumber( patch, source.size() );
+    bpsNumber( patch, 1 );
+    bpsNumber( patch, 0 );
+    bpsNumber( patch, ((1 - 1) << 2) | 2 ); // SourceCopy from -1
+    bpsNumber( patch, (1 << 1) | 1 );
+    std::vector<uint8_t> expected( 1, 0x11 );
+    bpsLE32( patch, crc32( source.data(), source.size() ) );
+    bpsLE32( patch, crc32( expected.data(), expected.size() ) );
+    bpsLE32( patch, crc32( patch.data(), patch.size() ) );
+
+    std::vector<uint8_t> target;
+    EXPECT_FALSE(applyBPS( patch.data(), patch.size(), source, target ));
+}
+
+// Test a target size no .nes image can have is rejected before it is allocated
+TEST(PATCH, BPS_TARGET_SIZE) {
+    std::vector<uint8_t> source( 64, 0x11 );
+    std::vector<uint8_t> patch = { 'B','P','S','1' };
+    bpsNumber( patch, source.size() );
+    bpsNumber( patch, 1ull << 60 );
+    bpsNumber( patch, 0 );
+    bpsNumber( patch, ((1 - 1) << 2) | 0 ); // SourceRead
+    bpsLE32( patch, crc32( source.data(), source.size() ) );
+    bpsLE32( patch, crc32( source.data(), 1 ) );
+    bpsLE32( patch, crc32( patch.data(), patch.size() ) );
+
+    std::vector<uint8_t> target;
+    EXPECT_FALSE(applyBPS( patch.data(), patch.size(), source, target ));
+    EXPECT_TRUE(target.empty());
+}
+
+// Test a patched load that changes the header and PRG, and that the result is cached
+TEST(PATCH, LOAD_PATCHED_NES) {
+    clearPatchCache();
+    EXPECT_TRUE(cpu.loadNESFile( "test-roms/blargg/cpu/01-basics.nes" ));
+    EXPECT_EQ(cpu.header.mirroring, 1);
+    uint8_t first = cpu.prgrom[0];
+
+    // clear the mirroring bit and change the first PRG byte
+    std::vector<uint8_t> ips = { 'P','A','T','C','H',
+        0x00,0x00,0x06, 0x00,0x01, uint8_t(cpu.romdata[6] & ~1),
+        0x00,0x00,0x10, 0x00,0x01, uint8_t(first ^ 0xFF),
+        'E','O','F' };
+    writeFile( "/tmp/nes6502_test.ips", ips );
+    EXPECT_TRUE(cpu.loadNESFile( "test-roms/blargg/cpu/01-basics.nes", "/tmp/nes6502_test.ips" ));
+    EXPECT_EQ(cpu.header.mirroring, 0);
+    EXPECT_EQ(cpu.prgrom[0], first ^ 0xFF);
+    const uint8_t *image = cpu.patched->data();
+
+    EXPECT_TRUE(cpu.loadNESFile( "test-roms/blargg/cpu/01-basics.nes", "/tmp/nes6502_test.ips" ));
+    EXPECT_EQ(cpu.patched->data(), image);
+
+    // a patch that fails leaves the running image alive, even once it left the cache
+    clearPatchCache();
+    std::vector<uint8_t> broken = { 'P','A','T','C','H', 0x00,0x00,0x02, 0x00,0x08, 0xAA };
+    writeFile( "/tmp/nes6502_test.ips", broken );
+    EXPECT_FALSE(cpu.loadNESFile( "test-roms/blargg/cpu/01-basics.nes", "/tmp/nes6502_test.ips" ));
+    ASSERT_TRUE(cpu.patched != NULL);
+    EXPECT_EQ(cpu.patched->data(), image);
+    EXPECT_EQ(cpu.prgrom, image + INES_HEADER_SIZE);
+    unlink( "/tmp/nes6502_test.ips" );
+}
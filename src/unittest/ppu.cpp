@@ -0,0 +1,856 @@
+#include "../6502.h"
+#include "../observation.h"
+#include "../framecheck.h"
+#include "../video.h"
+#include "gtest/gtest.h"
+#include <unistd.h>
+
+extern struct CPU cpu;
+
+// NROM image with program at $c000 and the reset vector pointing at it.
+// CHR tile 1 is solid color 1 and tile 2 solid color 2 in both pattern tables
+static std::vector<uint8_t> makeImage( const uint8_t *program, size_t size )
+{
+    std::vector<uint8_t> image( INES_HEADER_SIZE, 0 );
+    memcpy( &image[0], "NES\x1A", 4 );
+    image[4] = 1;
+    image[5] = 1;
+    image[6] = 0x01; // vertical mirroring
+    image.resize( INES_HEADER_SIZE + INES_PRG_BANK_SIZE + INES_CHR_BANK_SIZE, 0 );
+    uint8_t *prg = &image[INES_HEADER_SIZE];
+    memcpy( prg, program, size );
+    prg[0x3FFC] = 0x00;
+    prg[0x3FFD] = 0xC0;
+    uint8_t *chr = prg + INES_PRG_BANK_SIZE;
+    for ( int table = 0; table < 0x2000; table += 0x1000 ) {
+        memset( chr + table + 0x10, 0xFF, 8 );
+        memset( chr + table + 0x28, 0xFF, 8 );
+    }
+    return image;
+}
+
+static void loadScene()
+{
+    static const uint8_t loop[] = { 0x4c, 0x00, 0xc0 };
+    // the CPU keeps running from the image after this returns
+    static std::vector<uint8_t> image;
+    image = makeImage( loop, sizeof( loop ) );
+    ASSERT_TRUE(cpu.loadNESImage( &image[0], image.size(), "ppu" ));
+    cpu.powerOn();
+}
+
+static void ppuAddress( uint16_t addr )
+{
+    cpu.write( 0x2006, addr >> 8 );
+    cpu.write( 0x2006, addr & 0xFF );
+}
+
+static uint8_t pixel( int x, int y )
+{
+    return cpu.ppu.framebuffer[y * PPU_WIDTH + x];
+}
+
+// Test $4014 copies a page into OAM from oamaddr and halts the CPU 513/514 cycles
+TEST(PPU, OAM_DMA) {
+    // $c000    a9 05     LDA #$05
+    // $c002    8d 03 20  STA $2003
+    // $c005    a9 02     LDA #$02
+    // $c007    8d 14 40  STA $4014
+    // $c00a    ea        NOP
+    static const uint8_t program[] = {
+        0xa9, 0x05, 0x8d, 0x03, 0x20, 0xa9, 0x02, 0x8d, 0x14, 0x40, 0xea
+    };
+    std::vector<uint8_t> image = makeImage( program, sizeof( program ) );
+    ASSERT_TRUE(cpu.loadNESImage( &image[0], image.size(), "oamdma" ));
+    cpu.powerOn();
+    for ( int i = 0; i < 0x100; i++ ) {
+        cpu.mem[0x200 + i] = i;
+    }
+    cpu.execute( 12 );
+    EXPECT_EQ(cpu.PC, 0xC00A);
+    EXPECT_EQ(cpu.ppu.oam[5], 0);
+    EXPECT_EQ(cpu.ppu.oam[0xFF], 0xFA);
+    EXPECT_EQ(cpu.ppu.oam[4], 0xFF);
+    EXPECT_EQ(cpu.ppu.oamaddr, 5);
+    EXPECT_EQ(cpu.oamDmaEnd - cpu.oamDmaStart, OAM_DMA_CYCLES + ( cpu.oamDmaStart & 1 ));
+    EXPECT_EQ(cpu.clock(), cpu.oamDmaEnd);
+    EXPECT_EQ(cpu.cycles, -(int)( cpu.oamDmaEnd - cpu.oamDmaStart ));
+
+    // odd start takes the extra alignment cycle
+    uint64_t start = cpu.clock();
+    cpu.write( 0x4014, 0x02 );
+    EXPECT_EQ(cpu.clock() - start, OAM_DMA_CYCLES + ( start & 1 ));
+    start = cpu.clock();
+    cpu.write( 0x4014, 0x02 );
+    EXPECT_EQ(cpu.clock() - start, OAM_DMA_CYCLES + ( start & 1 ));
+
+    // a DMC fetch inside the transfer only costs 2 cycles
+    start = cpu.clock();
+    uint64_t end = cpu.oamDmaEnd;
+    EXPECT_EQ(cpu.dmcRead( 0xC000, cpu.oamDmaStart + 100 ), 0xA9);
+    EXPECT_EQ(cpu.clock() - start, (uint64_t)DMC_DMA_OAM_CYCLES);
+    EXPECT_EQ(cpu.oamDmaEnd, end + DMC_DMA_OAM_CYCLES);
+    start = cpu.clock();
+    cpu.dmcRead( 0xC000, start );
+    EXPECT_EQ(cpu.clock() - start, (uint64_t)DMC_DMA_CYCLES);
+
+    // $2004 reads at oamaddr, writes increment it
+    cpu.write( 0x2003, 0xFF );
+    cpu.write( 0x2004, 0x77 );
+    EXPECT_EQ(cpu.ppu.oamaddr, 0);
+    cpu.write( 0x2003, 0xFF );
+    EXPECT_EQ(cpu.read( 0x200C ), 0x77);
+    cpu.powerOn( 0x1000 );
+}
+
+// Test VRAM access through $2006/$2007, buffered reads and palette mirrors
+TEST(PPU, VRAM_ACCESS) {
+    loadScene();
+    ppuAddress( 0x2001 );
+    cpu.write( 0x2007, 0x11 );
+    cpu.write( 0x2007, 0x22 );
+    // vertical mirroring, $2800 is $2000
+    ppuAddress( 0x2801 );
+    cpu.read( 0x2007 );
+    EXPECT_EQ(cpu.read( 0x2007 ), 0x11);
+    EXPECT_EQ(cpu.read( 0x2007 ), 0x22);
+
+    ppuAddress( 0x3F10 );
+    cpu.write( 0x2007, 0x2A );
+    ppuAddress( 0x3F00 );
+    EXPECT_EQ(cpu.read( 0x2007 ), 0x2A);
+    EXPECT_EQ(cpu.ppu.palette[0], 0x2A);
+
+    // +32 increment
+    cpu.write( 0x2000, PPUCTRL_INCREMENT );
+    ppuAddress( 0x2000 );
+    cpu.write( 0x2007, 0x33 );
+    EXPECT_EQ(cpu.ppu.v, 0x2020);
+    // v is 15 bits and wraps there
+    ppuAddress( 0x3FE0 );
+    for ( int i = 0; i < 0x400; i++ ) {
+        cpu.read( 0x2007 );
+    }
+    EXPECT_EQ(cpu.ppu.v, 0x3FE0);
+    cpu.write( 0x2000, 0 );
+
+    // CHR-ROM is read only
+    ppuAddress( 0x0010 );
+    cpu.write( 0x2007, 0x00 );
+    EXPECT_EQ(cpu.ppu.read( 0x0010 ), 0xFF);
+    cpu.powerOn( 0x1000 );
+}
+
+// Test vblank starts on dot 1 of line 241, raises NMI and is cleared by reading $2002
+TEST(PPU, VBLANK_NMI) {
+    loadScene();
+    cpu.write( 0x2000, PPUCTRL_NMI );
+    uint64_t vblank = (uint64_t)PPU_VBLANK_LINE * PPU_DOTS_PER_LINE + 1;
+    cpu.ppu.catchUp( vblank );
+    EXPECT_EQ(cpu.ppu.status & PPUSTATUS_VBLANK, 0);
+    EXPECT_FALSE(cpu.nmi);
+    cpu.ppu.catchUp( vblank + 1 );
+    EXPECT_EQ(cpu.ppu.status & PPUSTATUS_VBLANK, PPUSTATUS_VBLANK);
+    EXPECT_EQ(cpu.ppu.frame, 1u);
+    EXPECT_TRUE(cpu.nmi);
+    EXPECT_EQ(cpu.ppu.readRegister( 2 ) & PPUSTATUS_VBLANK, PPUSTATUS_VBLANK);
+    EXPECT_EQ(cpu.ppu.readRegister( 2 ) & PPUSTATUS_VBLANK, 0);
+
+    // the CPU takes the NMI through $fffa
+    cpu.nmi = false;
+    cpu.execute( 3 * 29781 );
+    EXPECT_EQ(cpu.ppu.frame, 3u);
+    EXPECT_FALSE(cpu.exception);
+    cpu.powerOn( 0x1000 );
+}
+
+// Test the PPU only runs at vblank or when a register is accessed
+TEST(PPU, LAZY_SYNC) {
+    loadScene();
+    uint64_t vblank = ( (uint64_t)PPU_VBLANK_LINE * PPU_DOTS_PER_LINE + 2 + 2 ) / 3;
+    EXPECT_EQ(cpu.scheduler.when[EVENT_PPU], vblank);
+    uint64_t dot = cpu.ppu.dot;
+    cpu.execute( 10000 );
+    EXPECT_EQ(cpu.ppu.dot, dot);
+    cpu.read( 0x2002 );
+    EXPECT_EQ(cpu.ppu.dot, dot);
+    cpu.read( 0x2004 );
+    EXPECT_EQ(cpu.ppu.dot, cpu.clock() * PPU_DOTS_PER_CPU_CYCLE);
+
+    // the vblank event runs it to the end of the frame and schedules the next one
+    cpu.execute( vblank - cpu.clock() + 10 );
+    EXPECT_EQ(cpu.ppu.frame, 1u);
+    EXPECT_EQ(cpu.ppu.status & PPUSTATUS_VBLANK, PPUSTATUS_VBLANK);
+    EXPECT_EQ(cpu.scheduler.when[EVENT_PPU], ( (uint64_t)PPU_VBLANK_LINE * PPU_DOTS_PER_LINE + 2 + PPU_DOTS_PER_FRAME + 2 ) / 3);
+    EXPECT_LT(cpu.ppu.dot, cpu.clock() * PPU_DOTS_PER_CPU_CYCLE);
+
+    // idle vblank lines are skipped in one step
+    cpu.ppu.catchUp( (uint64_t)PPU_PRERENDER_LINE * PPU_DOTS_PER_LINE + 5 );
+    EXPECT_EQ(cpu.ppu.line, PPU_PRERENDER_LINE);
+    EXPECT_EQ(cpu.ppu.lineDot, 5);
+
+    // the pre-render line ends with the vertical scroll of t, run in one go or split inside the reload
+    cpu.write( 0x2001, PPUMASK_RENDERING );
+    cpu.write( 0x2005, 0 );
+    cpu.write( 0x2005, 16 );
+    for ( int frame = 2; frame <= 3; frame++ ) {
+        uint64_t prerender = frame * PPU_DOTS_PER_FRAME - PPU_DOTS_PER_LINE;
+        cpu.ppu.catchUp( frame == 2 ? prerender : prerender + 290 );
+        cpu.ppu.catchUp( frame * PPU_DOTS_PER_FRAME );
+        EXPECT_EQ(cpu.ppu.v & 0x7BE0, cpu.ppu.t & 0x7BE0) << "frame " << frame;
+    }
+    cpu.powerOn( 0x1000 );
+}
+
+// Test OAM is bucketed by line, a Y write only redoes the lines involved
+TEST(PPU, SPRITE_LISTS) {
+    loadScene();
+    memset( &cpu.mem[0x200], 0xFF, OAM_SIZE );
+    for ( int i = 0; i < 10; i++ ) {
+        cpu.mem[0x200 + i * 4] = 50;
+    }
+    cpu.mem[0x200 + 12 * 4] = 100;
+    cpu.write( 0x4014, 0x02 );
+    EXPECT_TRUE(cpu.ppu.spriteListStale);
+    cpu.ppu.buildSpriteLists();
+    EXPECT_EQ(cpu.ppu.spriteCount[50], 0);
+    EXPECT_EQ(cpu.ppu.spriteCount[51], 9);
+    EXPECT_EQ(cpu.ppu.spriteCount[58], 9);
+    EXPECT_EQ(cpu.ppu.spriteCount[59], 0);
+    EXPECT_EQ(cpu.ppu.spriteList[51][7], 7);
+    EXPECT_EQ(cpu.ppu.spriteCount[101], 1);
+    EXPECT_EQ(cpu.ppu.spriteList[101][0], 12);
+
+    // move sprite 3 down, sprite 8 moves up into the first 8
+    cpu.write( 0x2003, 3 * 4 );
+    cpu.write( 0x2004, 200 );
+    EXPECT_FALSE(cpu.ppu.spriteListStale);
+    EXPECT_EQ(cpu.ppu.spriteCount[51], 9);
+    EXPECT_EQ(cpu.ppu.spriteList[51][3], 4);
+    EXPECT_EQ(cpu.ppu.spriteList[51][7], 8);
+    EXPECT_EQ(cpu.ppu.spriteCount[201], 1);
+    EXPECT_EQ(cpu.ppu.spriteList[201][0], 3);
+    cpu.write( 0x2004, 0x55 );
+    EXPECT_EQ(cpu.ppu.spriteCount[201], 1);
+
+    // 8x16 sprites cover twice the lines
+    cpu.write( 0x2000, PPUCTRL_SPRITE_SIZE );
+    EXPECT_TRUE(cpu.ppu.spriteListStale);
+    cpu.ppu.buildSpriteLists();
+    EXPECT_EQ(cpu.ppu.spriteCount[66], 9);
+    EXPECT_EQ(cpu.ppu.spriteCount[67], 0);
+    EXPECT_EQ(cpu.ppu.spriteCount[216], 1);
+
+    // overflow is flagged while rendering a line with more than 8
+    cpu.write( 0x2001, PPUMASK_SPRITES );
+    cpu.ppu.catchUp( cpu.ppu.dot - cpu.ppu.dot % PPU_DOTS_PER_FRAME + PPU_DOTS_PER_FRAME + 100 * PPU_DOTS_PER_LINE );
+    EXPECT_EQ(cpu.ppu.status & PPUSTATUS_OVERFLOW, PPUSTATUS_OVERFLOW);
+    cpu.write( 0x2003, 9 * 4 );
+    cpu.write( 0x2004, 150 );
+    EXPECT_EQ(cpu.ppu.spriteCount[51], 8);
+    cpu.ppu.catchUp( cpu.ppu.dot + PPU_DOTS_PER_FRAME );
+    EXPECT_EQ(cpu.ppu.status & PPUSTATUS_OVERFLOW, 0);
+    cpu.powerOn( 0x1000 );
+}
+
+// Test the sprite 0 hit is predicted and set from an event without drawing
+TEST(PPU, SPRITE0_PREDICT) {
+    loadScene();
+    ppuAddress( 0x3F00 );
+    cpu.write( 0x2007, 0x0F );
+    cpu.write( 0x2007, 0x21 );
+    // tile 1 at row 12 column 10, x 80-87 on lines 96-103
+    ppuAddress( 0x218A );
+    cpu.write( 0x2007, 1 );
+    ppuAddress( 0x0000 );
+    cpu.write( 0x2005, 0 );
+    cpu.write( 0x2005, 0 );
+    // sprite 0 at x 84 on lines 100-107, first overlap is line 100 pixel 84
+    cpu.write( 0x2003, 0 );
+    cpu.write( 0x2004, 99 );
+    cpu.write( 0x2004, 1 );
+    cpu.write( 0x2004, 0 );
+    cpu.write( 0x2004, 84 );
+    cpu.write( 0x2000, 0 );
+    cpu.write( 0x2001, PPUMASK_RENDERING | PPUMASK_BG_LEFT | PPUMASK_SPRITE_LEFT );
+
+    uint64_t hit = PPU_DOTS_PER_FRAME + 100 * PPU_DOTS_PER_LINE + 85;
+    cpu.ppu.catchUp( PPU_DOTS_PER_FRAME + 2 * PPU_DOTS_PER_LINE );
+    EXPECT_EQ(cpu.ppu.sprite0Dot, hit);
+    EXPECT_EQ(cpu.scheduler.when[EVENT_SPRITE0], ( hit + 3 ) / 3);
+
+    // polling $2002 before the hit does not run the PPU
+    uint64_t dot = cpu.ppu.dot;
+    cpu.execute( hit / 3 - cpu.clock() - 10 );
+    EXPECT_EQ(cpu.read( 0x2002 ) & PPUSTATUS_SPRITE0, 0);
+    EXPECT_EQ(cpu.ppu.dot, dot);
+    cpu.execute( 20 );
+    EXPECT_EQ(cpu.ppu.status & PPUSTATUS_SPRITE0, PPUSTATUS_SPRITE0);
+    EXPECT_EQ(cpu.read( 0x2002 ) & PPUSTATUS_SPRITE0, PPUSTATUS_SPRITE0);
+    EXPECT_EQ(cpu.ppu.dot, dot);
+
+    // scrolled 8 pixels the tile is at x 72-79 and misses the sprite
+    cpu.ppu.catchUp( 2 * PPU_DOTS_PER_FRAME );
+    cpu.write( 0x2005, 8 );
+    cpu.write( 0x2005, 0 );
+    uint64_t line = 3 * PPU_DOTS_PER_FRAME + 101 * PPU_DOTS_PER_LINE;
+    cpu.ppu.catchUp( line );
+    EXPECT_EQ(cpu.ppu.status & PPUSTATUS_SPRITE0, 0);
+    EXPECT_EQ(cpu.ppu.sprite0Dot, EVENT_NEVER);
+    // moving the sprite to x 76 mid frame hits on the next line
+    cpu.write( 0x2003, 3 );
+    cpu.write( 0x2004, 76 );
+    cpu.ppu.catchUp( line + 77 );
+    EXPECT_EQ(cpu.ppu.status & PPUSTATUS_SPRITE0, 0);
+    cpu.ppu.catchUp( line + 78 );
+    EXPECT_EQ(cpu.ppu.status & PPUSTATUS_SPRITE0, PPUSTATUS_SPRITE0);
+
+    // scrolled 16 down at pre-render dot 290 the reload still picks it up, the
+    // tile is on lines 80-87 and the sprite misses it
+    cpu.ppu.catchUp( 4 * PPU_DOTS_PER_FRAME - PPU_DOTS_PER_LINE + 290 );
+    cpu.write( 0x2005, 8 );
+    cpu.write( 0x2005, 16 );
+    cpu.ppu.catchUp( 4 * PPU_DOTS_PER_FRAME + 108 * PPU_DOTS_PER_LINE );
+    EXPECT_EQ(cpu.ppu.sprite0Dot, EVENT_NEVER);
+    EXPECT_EQ(cpu.ppu.status & PPUSTATUS_SPRITE0, 0);
+    cpu.powerOn( 0x1000 );
+}
+
+// Test skipped frames leave the framebuffer alone but keep vblank, NMI and sprite 0 hit
+TEST(PPU, RENDER_SKIP) {
+    loadScene();
+    ppuAddress( 0x3F00 );
+    cpu.write( 0x2007, 0x0F );
+    cpu.write( 0x2007, 0x21 );
+    ppuAddress( 0x2000 );
+    cpu.write( 0x2007, 1 );
+    ppuAddress( 0x0000 );
+    // sprite 0 over tile 1 at x 0 on line 1
+    cpu.write( 0x2003, 0 );
+    cpu.write( 0x2004, 0 );
+    cpu.write( 0x2004, 1 );
+    cpu.write( 0x2004, 0 );
+    cpu.write( 0x2004, 0 );
+    cpu.write( 0x2000, PPUCTRL_NMI );
+    cpu.write( 0x2001, PPUMASK_RENDERING | PPUMASK_BG_LEFT | PPUMASK_SPRITE_LEFT );
+
+    // the frame already running is still drawn
+    cpu.ppu.skipRendering( true );
+    cpu.ppu.catchUp( PPU_DOTS_PER_FRAME );
+    EXPECT_EQ(pixel( 0, 0 ), 0x21);
+    EXPECT_TRUE(cpu.ppu.frameSkipped);
+    memset( cpu.ppu.framebuffer, 0xEE, sizeof( cpu.ppu.framebuffer ) );
+    cpu.nmi = false;
+    cpu.ppu.catchUp( PPU_DOTS_PER_FRAME + 2 * PPU_DOTS_PER_LINE );
+    EXPECT_EQ(cpu.ppu.status & PPUSTATUS_SPRITE0, PPUSTATUS_SPRITE0);
+    cpu.ppu.catchUp( PPU_DOTS_PER_FRAME + PPU_VBLANK_LINE * PPU_DOTS_PER_LINE + 2 );
+    EXPECT_EQ(cpu.ppu.frame, 2u);
+    EXPECT_TRUE(cpu.nmi);
+    EXPECT_EQ(cpu.ppu.status & PPUSTATUS_VBLANK, PPUSTATUS_VBLANK);
+    EXPECT_EQ(pixel( 0, 0 ), 0xEE);
+    EXPECT_EQ(pixel( 255, 239 ), 0xEE);
+
+    cpu.ppu.skipRendering( false );
+    cpu.ppu.catchUp( 3 * PPU_DOTS_PER_FRAME );
+    EXPECT_FALSE(cpu.ppu.frameSkipped);
+    EXPECT_EQ(pixel( 0, 0 ), 0x21);
+    EXPECT_EQ(pixel( 8, 0 ), 0x0F);
+    cpu.nmi = false;
+    cpu.powerOn( 0x1000 );
+}
+
+// Test background and sprite pixels, fine scroll, sprite 0 hit and a mid line split
+TEST(PPU, RENDER_LINE) {
+    loadScene();
+    ppuAddress( 0x3F00 );
+    cpu.write( 0x2007, 0x0F );
+    cpu.write( 0x2007, 0x21 );
+    cpu.write( 0x2007, 0x22 );
+    ppuAddress( 0x3F11 );
+    cpu.write( 0x2007, 0x16 );
+    // row 0 column 0, row 1 columns 2-3, row 2 column 4 with tile 2
+    ppuAddress( 0x2000 );
+    cpu.write( 0x2007, 1 );
+    ppuAddress( 0x2022 );
+    cpu.write( 0x2007, 1 );
+    cpu.write( 0x2007, 1 );
+    ppuAddress( 0x2044 );
+    cpu.write( 0x2007, 2 );
+    // second nametable starts with tile 2
+    ppuAddress( 0x2400 );
+    cpu.write( 0x2007, 2 );
+    // sprite 0 at x 20 on lines 10-17
+    cpu.write( 0x2003, 0 );
+    cpu.write( 0x2004, 9 );
+    cpu.write( 0x2004, 1 );
+    cpu.write( 0x2004, 0 );
+    cpu.write( 0x2004, 20 );
+    for ( int i = 4; i < OAM_SIZE; i++ ) {
+        cpu.write( 0x2004, 0xFF );
+    }
+    cpu.write( 0x2005, 4 );
+    cpu.write( 0x2005, 0 );
+    cpu.write( 0x2000, PPUCTRL_SPRITE_TABLE );
+    cpu.write( 0x2001, PPUMASK_RENDERING | PPUMASK_BG_LEFT | PPUMASK_SPRITE_LEFT );
+
+    // first frame after enabling has v from the $2006 writes, start on the next
+    cpu.ppu.catchUp( PPU_DOTS_PER_FRAME );
+    uint64_t frame = PPU_DOTS_PER_FRAME;
+    cpu.ppu.catchUp( frame + 10 * PPU_DOTS_PER_LINE + 21 );
+    EXPECT_EQ(cpu.ppu.status & PPUSTATUS_SPRITE0, 0);
+    cpu.ppu.catchUp( frame + 10 * PPU_DOTS_PER_LINE + 22 );
+    EXPECT_EQ(cpu.ppu.status & PPUSTATUS_SPRITE0, PPUSTATUS_SPRITE0);
+
+    // scrolled 4 pixels left
+    EXPECT_EQ(pixel( 0, 0 ), 0x21);
+    EXPECT_EQ(pixel( 3, 0 ), 0x21);
+    EXPECT_EQ(pixel( 4, 0 ), 0x0F);
+    EXPECT_EQ(pixel( 11, 8 ), 0x0F);
+    EXPECT_EQ(pixel( 12, 8 ), 0x21);
+    EXPECT_EQ(pixel( 27, 8 ), 0x21);
+    EXPECT_EQ(pixel( 28, 8 ), 0x0F);
+    EXPECT_EQ(pixel( 20, 10 ), 0x16);
+    EXPECT_EQ(pixel( 27, 10 ), 0x16);
+    EXPECT_EQ(pixel( 28, 10 ), 0x0F);
+    EXPECT_EQ(pixel( 28, 16 ), 0x22);
+    // column 32 comes from the next nametable
+    EXPECT_EQ(pixel( 252, 0 ), 0x22);
+
+    // point v at row 2 column 4 on the middle of line 20, fine X still applies
+    cpu.ppu.catchUp( frame + 20 * PPU_DOTS_PER_LINE + 101 );
+    cpu.ppu.writeRegister( 6, 0x00 );
+    cpu.ppu.writeRegister( 6, 0x44 );
+    cpu.ppu.catchUp( frame + 21 * PPU_DOTS_PER_LINE );
+    EXPECT_EQ(pixel( 99, 20 ), 0x0F);
+    EXPECT_EQ(pixel( 100, 20 ), 0x22);
+    EXPECT_EQ(pixel( 103, 20 ), 0x22);
+    EXPECT_EQ(pixel( 104, 20 ), 0x0F);
+    EXPECT_EQ(pixel( 100, 21 ), 0x0F);
+    cpu.powerOn( 0x1000 );
+}
+
+// Test every decoder built in matches the scalar one for all plane bytes and palettes
+TEST(PPU, TILE_DECODE) {
+    uint8_t expected[8];
+    uint8_t decoded[8];
+    decodeTileRowScalar( 0x55, 0x33, 0x2, expected );
+    EXPECT_EQ(expected[0], 0);
+    EXPECT_EQ(expected[1], 0x09);
+    EXPECT_EQ(expected[2], 0x0A);
+    EXPECT_EQ(expected[3], 0x0B);
+    EXPECT_EQ(memcmp( expected + 4, expected, 4 ), 0);
+    for ( int plane = 0; plane < 0x10000; plane++ ) {
+        for ( int palette = 0; palette < 4; palette++ ) {
+            decodeTileRowScalar( plane & 0xFF, plane >> 8, palette, expected );
+            decodeTileRow( plane & 0xFF, plane >> 8, palette, decoded );
+            ASSERT_EQ(memcmp( expected, decoded, 8 ), 0);
+#ifdef __SSE2__
+            decodeTileRowSSE2( plane & 0xFF, plane >> 8, palette, decoded );
+            ASSERT_EQ(memcmp( expected, decoded, 8 ), 0);
+#endif
+#ifdef __BMI2__
+            decodeTileRowBMI2( plane & 0xFF, plane >> 8, palette, decoded );
+            ASSERT_EQ(memcmp( expected, decoded, 8 ), 0);
+#endif
+        }
+    }
+}
+
+// Test palette conversion formats, emphasis and that the vector path matches the table lookup
+TEST(PPU, PALETTE_CONVERT) {
+    EXPECT_EQ(pixelSize( PIXEL_INDEXED ), 1);
+    EXPECT_EQ(pixelSize( PIXEL_RGBA8888 ), 4);
+    EXPECT_EQ(pixelSize( PIXEL_RGB565 ), 2);
+    EXPECT_EQ(paletteColor( 0x30, 0 ), 0xECEEECu);
+    EXPECT_EQ(paletteColor( 0x30, 0x1 ), 0xECC2C0u);
+    EXPECT_EQ(paletteColor( 0x0F, 0x7 ), 0u);
+
+    uint8_t indices[263];
+    uint32_t seed = 0x2C02;
+    for ( size_t i = 0; i < sizeof( indices ); i++ ) {
+        seed = seed * 1103515245 + 12345;
+        indices[i] = seed >> 24;
+    }
+    PixelFormat formats[] = { PIXEL_INDEXED, PIXEL_RGBA8888, PIXEL_RGB565, PIXEL_GRAY8 };
+    for ( int f = 0; f < 4; f++ ) {
+        for ( int e = 0; e < 8; e++ ) {
+            uint8_t expected[sizeof( indices ) * 4];
+            uint8_t converted[sizeof( indices ) * 4];
+            convertPixelsScalar( indices, sizeof( indices ), e, formats[f], expected );
+            convertPixels( indices, sizeof( indices ), e, formats[f], converted );
+            EXPECT_EQ(memcmp( expected, converted, sizeof( indices ) * pixelSize( formats[f] ) ), 0);
+        }
+    }
+
+    uint8_t colors[] = { 0x16, 0x30 };
+    uint8_t rgba[8];
+    convertPixels( colors, 2, 0, PIXEL_RGBA8888, rgba );
+    EXPECT_EQ(rgba[0], 152);
+    EXPECT_EQ(rgba[1], 34);
+    EXPECT_EQ(rgba[2], 32);
+    EXPECT_EQ(rgba[3], 255);
+    uint16_t rgb565[2];
+    convertPixels( colors, 2, 0, PIXEL_RGB565, rgb565 );
+    EXPECT_EQ(rgb565[1], 61309);
+
+    // the framebuffer goes line by line into a buffer with padding
+    loadScene();
+    cpu.ppu.framebuffer[PPU_WIDTH] = 0x30;
+    cpu.ppu.emphasis[1] = 0x1;
+    int pitch = PPU_WIDTH * 4 + 16;
+    std::vector<uint8_t> frame( PPU_HEIGHT * pitch, 0xAA );
+    cpu.ppu.convert( PIXEL_RGBA8888, &frame[0], pitch );
+    EXPECT_EQ(frame[PPU_WIDTH * 4], 0xAA);
+    EXPECT_EQ(frame[pitch], 0xEC);
+    EXPECT_EQ(frame[pitch + 1], 0xC2);
+    EXPECT_EQ(frame[pitch + 3], 0xFF);
+    cpu.powerOn( 0x1000 );
+}
+
+static uint8_t convertLuma( uint8_t index )
+{
+    uint8_t luma;
+    convertPixelsScalar( &index, 1, 0, PIXEL_GRAY8, &luma );
+    return luma;
+}
+
+// Test the grayscale observation averages areas, splits straddling pixels and honours the crop
+TEST(PPU, OBSERVATION) {
+    loadScene();
+    Observation observation;
+    EXPECT_EQ(observation.width, OBSERVATION_SIZE);
+    EXPECT_EQ(observation.height, OBSERVATION_SIZE);
+    EXPECT_FALSE(observation.configure( 0, 84 ));
+    EXPECT_FALSE(observation.configure( 84, 84, 120, 120 ));
+    uint8_t white = convertLuma( 0x30 );
+    uint8_t black = convertLuma( 0x0F );
+    EXPECT_EQ(black, 0);
+
+    // uniform frame stays uniform at any size
+    memset( cpu.ppu.framebuffer, 0x30, sizeof( cpu.ppu.framebuffer ) );
+    std::vector<uint8_t> out( OBSERVATION_SIZE * OBSERVATION_SIZE );
+    observation.render( cpu.ppu, &out[0] );
+    EXPECT_EQ(out[0], white);
+    EXPECT_EQ(out[OBSERVATION_SIZE * OBSERVATION_SIZE - 1], white);
+
+    // halving averages 2x2 blocks, left half white and the rest black
+    ASSERT_TRUE(observation.configure( 128, 120 ));
+    for ( int i = 0; i < PPU_HEIGHT * PPU_WIDTH; i++ ) {
+        cpu.ppu.framebuffer[i] = ( i % PPU_WIDTH ) < 129 ? 0x30 : 0x0F;
+    }
+    out.resize( 128 * 120 );
+    observation.render( cpu.ppu, &out[0] );
+    EXPECT_EQ(out[63], white);
+    EXPECT_EQ(out[64], ( white + 1 ) / 2);
+    EXPECT_EQ(out[65], 0);
+
+    // 3 columns onto 2, the middle one is split between both outputs
+    ASSERT_TRUE(observation.configure( 2, 1, 0, 0, 127, 126 ));
+    observation.render( cpu.ppu, &out[0] );
+    EXPECT_EQ(out[0], white);
+    EXPECT_EQ(out[1], ( 2 * white + 3 ) / 6);
+
+    // cropping the top 8 lines drops a black band
+    memset( cpu.ppu.framebuffer, 0x30, sizeof( cpu.ppu.framebuffer ) );
+    memset( cpu.ppu.framebuffer, 0x0F, 8 * PPU_WIDTH );
+    ASSERT_TRUE(observation.configure( 84, 84, 8, 0 ));
+    out.resize( 84 * 84 );
+    observation.render( cpu.ppu, &out[0] );
+    EXPECT_EQ(out[0], white);
+    ASSERT_TRUE(observation.configure( 84, 84 ));
+    observation.render( cpu.ppu, &out[0] );
+    EXPECT_LT(out[0], white);
+
+    // any size and crop matches summing every overlap of a noisy frame
+    uint32_t seed = 1;
+    for ( int i = 0; i < PPU_HEIGHT * PPU_WIDTH; i++ ) {
+        seed = seed * 1103515245 + 12345;
+        cpu.ppu.framebuffer[i] = seed >> 16;
+    }
+    for ( int l = 0; l < PPU_HEIGHT; l++ ) {
+        cpu.ppu.emphasis[l] = l & 0x7;
+    }
+    static const int sizes[][6] = {
+        { 84, 84, 0, 0, 0, 0 }, { 84, 84, 3, 5, 7, 11 }, { 1, 1, 0, 0, 0, 0 }, { 7, 300, 10, 0, 0, 9 }, { 300, 13, 0, 1, 2, 0 },
+    };
+    for ( auto &size : sizes ) {
+        int width = size[0], height = size[1];
+        ASSERT_TRUE(observation.configure( width, height, size[2], size[3], size[4], size[5] ));
+        int sourceWidth = PPU_WIDTH - size[4] - size[5];
+        int sourceHeight = PPU_HEIGHT - size[2] - size[3];
+        std::vector<uint8_t> luma( PPU_HEIGHT * PPU_WIDTH );
+        for ( int l = 0; l < PPU_HEIGHT; l++ ) {
+            convertPixelsScalar( &cpu.ppu.framebuffer[l * PPU_WIDTH], PPU_WIDTH, cpu.ppu.emphasis[l], PIXEL_GRAY8, &luma[l * PPU_WIDTH] );
+        }
+        out.resize( width * height );
+        observation.render( cpu.ppu, &out[0] );
+        uint32_t total = sourceWidth * sourceHeight;
+        for ( int oy = 0; oy < height; oy++ ) {
+            for ( int ox = 0; ox < width; ox++ ) {
+                uint32_t sum = 0;
+                for ( int sy = 0; sy < sourceHeight; sy++ ) {
+                    int wy = std::min( (sy + 1) * height, (oy + 1) * sourceHeight ) - std::max( sy * height, oy * sourceHeight );
+                    for ( int sx = 0; sx < sourceWidth && wy > 0; sx++ ) {
+                        int wx = std::min( (sx + 1) * width, (ox + 1) * sourceWidth ) - std::max( sx * width, ox * sourceWidth );
+                        if ( wx > 0 ) {
+                            sum += luma[(sy + size[2]) * PPU_WIDTH + sx + size[4]] * wx * wy;
+                        }
+                    }
+                }
+                ASSERT_EQ(out[oy * width + ox], ( sum + total / 2 ) / total) << width << "x" << height << " at " << ox << "," << oy;
+            }
+        }
+    }
+    cpu.powerOn( 0x1000 );
+}
+
+// blue backdrop with tile 1 in the top left corner
+static void hashScene()
+{
+    loadScene();
+    ppuAddress( 0x3F00 );
+    cpu.write( 0x2007, 0x21 );
+    cpu.write( 0x2007, 0x16 );
+    ppuAddress( 0x2000 );
+    cpu.write( 0x2007, 1 );
+    ppuAddress( 0x0000 );
+    cpu.write( 0x2001, PPUMASK_BG | PPUMASK_BG_LEFT );
+}
+
+// Test frame hashes are taken at vblank, checked against a golden list and only a mismatch is dumped
+TEST(PPU, FRAME_HASH) {
+    const char *list = "/tmp/nes6502_frames.txt";
+    const char *image = "/tmp/nes6502_frame3.ppm";
+    remove( image );
+
+    // record a list
+    hashScene();
+    FrameCheck record;
+    EXPECT_TRUE(record.run( cpu, 3 ));
+    EXPECT_EQ(record.checked, 0);
+    ASSERT_EQ(record.seen.size(), 3u);
+    EXPECT_EQ(cpu.ppu.frameHashed, 3u);
+    EXPECT_EQ(record.seen[3], cpu.ppu.frameHash);
+    EXPECT_EQ(cpu.ppu.frameHash, cpu.ppu.hashFrame());
+    // nothing changes, the frame is the same every time
+    EXPECT_EQ(record.seen[1], record.seen[2]);
+    EXPECT_EQ(record.seen[2], record.seen[3]);
+    ASSERT_TRUE(record.save( list ));
+
+    // same frames pass
+    FrameCheck check;
+    check.dumpPrefix = "/tmp/nes6502_frame";
+    ASSERT_TRUE(check.load( list ));
+    hashScene();
+    EXPECT_TRUE(check.run( cpu, 3 ));
+    EXPECT_EQ(check.checked, 3);
+    EXPECT_EQ(check.mismatches, 0);
+    EXPECT_NE(access( image, F_OK ), 0);
+
+    // emphasis alone changes the hash
+    cpu.ppu.emphasis[100] ^= 1;
+    EXPECT_NE(cpu.ppu.hashFrame(), cpu.ppu.frameHash);
+
+    // a different frame 3 is written out
+    FrameCheck changed;
+    changed.dumpPrefix = "/tmp/nes6502_frame";
+    ASSERT_TRUE(changed.load( list ));
+    hashScene();
+    cpu.ppu.catchUp( 2 * PPU_DOTS_PER_FRAME );
+    cpu.write( 0x2001, 0 );
+    EXPECT_FALSE(changed.run( cpu, 3 ));
+    EXPECT_EQ(changed.mismatches, 1);
+    FILE *fp = fopen( image, "rb" );
+    ASSERT_TRUE(fp != NULL);
+    char magic[3] = { 0 };
+    EXPECT_EQ(fread( magic, 1, 2, fp ), 2u);
+    EXPECT_STREQ(magic, "P6");
+    fseek( fp, 0, SEEK_END );
+    EXPECT_EQ(ftell( fp ), 15 + PPU_WIDTH * PPU_HEIGHT * 3);
+    fclose( fp );
+    unlink( list );
+    unlink( image );
+    cpu.powerOn( 0x1000 );
+}
+
+// Test background lines are reused until their nametable row, attributes or scroll change, palette changes are not
+TEST(PPU, BACKGROUND_REUSE) {
+    const uint64_t frame = PPU_DOTS_PER_FRAME;
+    const uint64_t vblank = 250 * PPU_DOTS_PER_LINE;
+    hashScene();
+    uint64_t start = ( cpu.ppu.dot / frame + 2 ) * frame;
+    cpu.ppu.catchUp( start + vblank );
+    uint64_t drawn = cpu.ppu.backgroundPixels;
+    uint64_t reused = cpu.ppu.backgroundReused;
+    cpu.ppu.catchUp( start + frame + vblank );
+    EXPECT_EQ(cpu.ppu.backgroundPixels - drawn, 0u);
+    EXPECT_EQ(cpu.ppu.backgroundReused - reused, (uint64_t)PPU_WIDTH * PPU_HEIGHT);
+    EXPECT_EQ(pixel( 0, 0 ), 0x16);
+
+    // palette goes on top of the reused pixels
+    ppuAddress( 0x3F01 );
+    cpu.write( 0x2007, 0x27 );
+    cpu.write( 0x2007, 0x2A );
+    // tile row 1 gets a tile, the attribute byte recolors rows 0-3
+    ppuAddress( 0x2021 );
+    cpu.write( 0x2007, 2 );
+    ppuAddress( 0x23C0 );
+    cpu.write( 0x2007, 0x00 ); // unchanged
+    ppuAddress( 0x0000 );
+    drawn = cpu.ppu.backgroundPixels;
+    cpu.ppu.catchUp( start + 2 * frame + vblank );
+    EXPECT_EQ(cpu.ppu.backgroundPixels - drawn, 8u * PPU_WIDTH);
+    EXPECT_EQ(pixel( 0, 0 ), 0x27);
+    EXPECT_EQ(pixel( 8, 8 ), 0x2A);
+    ppuAddress( 0x23C0 );
+    cpu.write( 0x2007, 0x01 );
+    ppuAddress( 0x0000 );
+    drawn = cpu.ppu.backgroundPixels;
+    cpu.ppu.catchUp( start + 3 * frame + vblank );
+    EXPECT_EQ(cpu.ppu.backgroundPixels - drawn, 32u * PPU_WIDTH);
+    uint64_t hash = cpu.ppu.hashFrame();
+    uint8_t shifted = pixel( 8, 8 );
+
+    // a scroll change redraws everything, the same frame drawn without reuse is identical
+    cpu.write( 0x2005, 8 );
+    cpu.write( 0x2005, 0 );
+    drawn = cpu.ppu.backgroundPixels;
+    cpu.ppu.catchUp( start + 4 * frame + vblank );
+    EXPECT_EQ(cpu.ppu.backgroundPixels - drawn, (uint64_t)PPU_WIDTH * PPU_HEIGHT);
+    EXPECT_EQ(pixel( 0, 8 ), shifted);
+    cpu.write( 0x2005, 0 );
+    cpu.write( 0x2005, 0 );
+    cpu.ppu.reuseBackground = false;
+    reused = cpu.ppu.backgroundReused;
+    cpu.ppu.catchUp( start + 5 * frame + vblank );
+    EXPECT_EQ(cpu.ppu.backgroundReused, reused);
+    EXPECT_EQ(cpu.ppu.hashFrame(), hash);
+    cpu.powerOn( 0x1000 );
+}
+
+// hashes of three frames of a scene with sprites, the palette, OAM and scroll change in vblank
+// after the first and the last one changes scroll and emphasis on line 100. The second
+// also goes through Observation::render and the last through convert
+static std::vector<uint64_t> drawFrames( int threads )
+{
+    const uint64_t frame = PPU_DOTS_PER_FRAME;
+    const uint64_t vblank = 250 * PPU_DOTS_PER_LINE;
+    hashScene();
+    cpu.ppu.renderThreads( threads );
+    ppuAddress( 0x2000 );
+    for ( int i = 0; i < 0x400; i++ ) {
+        cpu.write( 0x2007, ( i * 7 + ( i >> 5 ) ) % 3 );
+    }
+    ppuAddress( 0x0000 );
+    cpu.write( 0x2003, 0 );
+    for ( int i = 0; i < 10; i++ ) {
+        cpu.write( 0x2004, 20 + i * 2 );
+        cpu.write( 0x2004, 2 - ( i & 1 ) );
+        cpu.write( 0x2004, i & 0x23 );
+        cpu.write( 0x2004, i * 20 );
+    }
+    cpu.write( 0x2001, PPUMASK_RENDERING | PPUMASK_BG_LEFT | PPUMASK_SPRITE_LEFT );
+    std::vector<uint64_t> hashes;
+    uint64_t start = ( cpu.ppu.dot / frame + 1 ) * frame;
+    cpu.ppu.catchUp( start + vblank );
+    // the CPU runs on and changes what the frame is drawn from while the bands draw it
+    EXPECT_EQ(cpu.ppu.linesPending, threads > 1);
+    ppuAddress( 0x3F01 );
+    cpu.write( 0x2007, 0x21 );
+    cpu.write( 0x2003, 0 );
+    cpu.write( 0x2004, 90 );
+    cpu.write( 0x2005, 13 );
+    cpu.write( 0x2005, 21 );
+    cpu.ppu.finishFrame();
+    hashes.push_back( cpu.ppu.hashFrame() );
+    // render and convert wait for the bands themselves
+    cpu.ppu.catchUp( start + frame + vblank );
+    Observation observation;
+    uint8_t out[OBSERVATION_SIZE * OBSERVATION_SIZE];
+    observation.render( cpu.ppu, out );
+    EXPECT_FALSE(cpu.ppu.linesPending);
+    hashes.push_back( cpu.ppu.hashFrame() );
+    hashes.push_back( xxh64( out, sizeof( out ) ) );
+    cpu.ppu.catchUp( start + 2 * frame + 100 * PPU_DOTS_PER_LINE + 50 );
+    cpu.write( 0x2001, PPUMASK_RENDERING | PPUMASK_BG_LEFT | 0x20 );
+    cpu.write( 0x2005, 3 );
+    cpu.ppu.catchUp( start + 2 * frame + vblank );
+    std::vector<uint8_t> rgba( PPU_WIDTH * PPU_HEIGHT * 4 );
+    cpu.ppu.convert( PIXEL_RGBA8888, &rgba[0], PPU_WIDTH * 4 );
+    EXPECT_FALSE(cpu.ppu.linesPending);
+    hashes.push_back( cpu.ppu.hashFrame() );
+    hashes.push_back( xxh64( &rgba[0], rgba.size() ) );
+    hashes.push_back( cpu.ppu.backgroundPixels );
+    hashes.push_back( cpu.ppu.backgroundReused );
+    cpu.ppu.renderThreads( 1 );
+    return hashes;
+}
+
+// Test lines drawn in bands on worker threads come out the same as drawn one at a time
+TEST(PPU, PARALLEL_RENDER) {
+    std::vector<uint64_t> serial = drawFrames( 1 );
+    EXPECT_NE(serial[0], serial[1]);
+    EXPECT_NE(serial[1], serial[3]);
+    EXPECT_EQ(drawFrames( 4 ), serial);
+    EXPECT_EQ(drawFrames( 3 ), serial);
+    cpu.powerOn( 0x1000 );
+}
+
+static std::vector<uint8_t> readFile( const char *name )
+{
+    std::vector<uint8_t> data;
+    FILE *fp = fopen( name, "rb" );
+    if ( fp != NULL ) {
+        uint8_t chunk[4096];
+        size_t n;
+        while ( ( n = fread( chunk, 1, sizeof( chunk ), fp ) ) > 0 ) {
+            data.insert( data.end(), chunk, chunk + n );
+        }
+        fclose( fp );
+    }
+    return data;
+}
+
+// Test frames go out as raw RGB24 and Y4M through the writer thread
+TEST(PPU, VIDEO_PIPE) {
+    const char *name = "/tmp/nes6502_video";
+    hashScene();
+    VideoWriter video;
+    ASSERT_TRUE(video.open( name, VIDEO_RGB24 ));
+    EXPECT_TRUE(video.record( cpu, 5 ));
+    EXPECT_TRUE(video.close());
+    EXPECT_EQ(video.frames, 5u);
+    std::vector<uint8_t> rgb = readFile( name );
+    ASSERT_EQ(rgb.size(), 5u * PPU_WIDTH * PPU_HEIGHT * 3);
+    // the last frame is still in the framebuffer, tile 1 color 1 on a 0x21 backdrop
+    const uint8_t *last = &rgb[4 * PPU_WIDTH * PPU_HEIGHT * 3];
+    EXPECT_EQ(( last[0] << 16 ) | ( last[1] << 8 ) | last[2], (int)paletteColor( 0x16, 0 ));
+    const uint8_t *backdrop = last + ( 8 * PPU_WIDTH + 8 ) * 3;
+    EXPECT_EQ(( backdrop[0] << 16 ) | ( backdrop[1] << 8 ) | backdrop[2], (int)paletteColor( 0x21, 0 ));
+
+    ASSERT_TRUE(video.open( name, VIDEO_Y4M ));
+    EXPECT_TRUE(video.write( cpu.ppu ));
+    EXPECT_TRUE(video.write( cpu.ppu ));
+    EXPECT_TRUE(video.write( cpu.ppu ));
+    EXPECT_TRUE(video.close());
+    std::vector<uint8_t> y4m = readFile( name );
+    const char *header = "YUV4MPEG2 W256 H240 F39375000:655171 Ip A8:7 C420jpeg\n";
+    size_t frameSize = 6 + PPU_WIDTH * PPU_HEIGHT * 3 / 2;
+    ASSERT_EQ(y4m.size(), strlen( header ) + 3 * frameSize);
+    EXPECT_EQ(memcmp( &y4m[0], header, strlen( header ) ), 0);
+    const uint8_t *frame = &y4m[strlen( header ) + 2 * frameSize];
+    EXPECT_EQ(memcmp( frame, "FRAME\n", 6 ), 0);
+    // limited range luma, black has neutral chroma
+    memset( cpu.ppu.framebuffer, 0x30, PPU_WIDTH * 2 );
+    memset( cpu.ppu.framebuffer + PPU_WIDTH * 2, 0x0F, PPU_WIDTH * 2 );
+    std::vector<uint8_t> out( frameSize );
+    video.format = VIDEO_Y4M;
+    video.encode( cpu.ppu, &out[0] );
+    const uint8_t *cb = &out[6 + PPU_WIDTH * PPU_HEIGHT];
+    const uint8_t *cr = cb + PPU_WIDTH * PPU_HEIGHT / 4;
+    EXPECT_EQ(out[6 + PPU_WIDTH * 2], 16);
+    EXPECT_EQ(out[6], 220); // 0x30 is 236, 238, 236
+    EXPECT_EQ(cb[PPU_WIDTH / 2], 128);
+    EXPECT_EQ(cr[PPU_WIDTH / 2], 128);
+    cpu.powerOn( 0x1000 );
+}
@@ -0,0 +1,135 @@
+#include "../nesparser/scanner.h"
+#include "../ines.h"
+#include "../hash.h"
+#include "gtest/gtest.h"
+#include <algorithm>
+#include <filesystem>
+
+#define SCAN_DIR "/tmp/nes6502_scan"
+
+// iNES image with flags as header byte 6, PRG and CHR filled from seed
+static std::vector<uint8_t> makeImage( int prgbanks, int chrbanks, uint8_t flags, int seed )
+{
+    std::vector<uint8_t> image( INES_HEADER_SIZE, 0 );
+    memcpy( &image[0], "NES\x1A", 4 );
+    image[4] = prgbanks;
+    image[5] = chrbanks;
+    image[6] = flags;
+    size_t size = INES_HEADER_SIZE + prgbanks * INES_PRG_BANK_SIZE + chrbanks * INES_CHR_BANK_SIZE;
+    for ( size_t i = INES_HEADER_SIZE; i < size; i++ ) {
+        image.push_back( i * seed + ( i >> 9 ) );
+    }
+    return image;
+}
+
+static void writeFile( const std::string &file, const std::vector<uint8_t> &data )
+{
+    FILE *fp = fopen( file.c_str(), "wb" );
+    ASSERT_TRUE(fp != NULL);
+    fwrite( data.data(), 1, data.size(), fp );
+    fclose( fp );
+}
+
+static std::string sha1Hex( const uint8_t *data, size_t length )
+{
+    uint8_t digest[SHA1_DIGEST_SIZE];
+    char str[SHA1_DIGEST_SIZE*2+1];
+    SHA1 sha;
+    sha.update( data, length );
+    sha.final( digest );
+    sha1ToString( digest, str );
+    return str;
+}
+
+// CSV record of image, prglen and chrlen are the bytes present
+static std::string csvRecord( const std::string &path, const std::vector<uint8_t> &image, int prgbanks,
+        int chrbanks, int mapper, int mirroring, int battery, size_t prglen, size_t chrlen, bool valid )
+{
+    const uint8_t *prg = &image[INES_HEADER_SIZE];
+    const uint8_t *chr = prg + prglen;
+    std::string sha = sha1Hex( prg, prglen + chrlen );
+    char buf[256];
+    snprintf( buf, sizeof( buf ), ",%zu,%d,%d,%d,%d,%d,0,0,%d,0,0,%.8x,%.8x,%.8x,%s",
+            image.size(), valid, prgbanks, chrbanks, mapper, mirroring, battery,
+            crc32( prg, prglen ), crc32( chr, chrlen ), crc32( prg, prglen + chrlen ), sha.c_str() );
+    return path + buf;
+}
+
+static std::vector<std::string> scanLines( ScanFormat format )
+{
+    std::vector<std::string> lines;
+    FILE *fp = tmpfile();
+    EXPECT_TRUE(fp != NULL);
+    if ( fp == NULL ) {
+        return lines;
+    }
+    EXPECT_EQ(scanDirectory( SCAN_DIR, format, 2, fp ), 0);
+    rewind( fp );
+    char buf[1024];
+    while ( fgets( buf, sizeof( buf ), fp ) != NULL ) {
+        std::string line( buf );
+        EXPECT_EQ(line.back(), '\n');
+        line.pop_back();
+        lines.push_back( line );
+    }
+    fclose( fp );
+    return lines;
+}
+
+// Test the records of a tree with a good, a banked, a truncated and a headerless
+// dump, that other files are left out and that paths are escaped for CSV and JSON
+TEST(SCANNER, SCAN_TREE) {
+    std::filesystem::remove_all( SCAN_DIR );
+    ASSERT_TRUE(std::filesystem::create_directories( SCAN_DIR "/sub" ));
+    std::string good = SCAN_DIR "/good.nes";
+    std::string quoted = SCAN_DIR "/sub/b,\"q\".NES";
+    std::string truncated = SCAN_DIR "/sub/truncated.nes";
+    std::string headerless = SCAN_DIR "/headerless.nes";
+    std::vector<uint8_t> goodImage = makeImage( 1, 1, 0x00, 3 );
+    std::vector<uint8_t> quotedImage = makeImage( 2, 0, 0x13, 5 ); // MMC1, battery, vertical
+    std::vector<uint8_t> truncatedImage = makeImage( 1, 1, 0x01, 7 );
+    truncatedImage.resize( INES_HEADER_SIZE + 100 );
+    std::vector<uint8_t> headerlessImage( 5, 0xAA );
+    writeFile( good, goodImage );
+    writeFile( quoted, quotedImage );
+    writeFile( truncated, truncatedImage );
+    writeFile( headerless, headerlessImage );
+    writeFile( SCAN_DIR "/sub/notes.txt", goodImage );
+
+    std::vector<std::string> expected;
+    expected.push_back( csvRecord( good, goodImage, 1, 1, 0, 0, 0,
+            INES_PRG_BANK_SIZE, INES_CHR_BANK_SIZE, true ) );
+    expected.push_back( csvRecord( "\"" SCAN_DIR "/sub/b,\"\"q\"\".NES\"", quotedImage, 2, 0, 1, 1, 1,
+            2 * INES_PRG_BANK_SIZE, 0, true ) );
+    expected.push_back( csvRecord( truncated, truncatedImage, 1, 1, 0, 1, 0, 100, 0, false ) );
+    expected.push_back( headerless + ",5,0,0,0,0,0,0,0,0,0,0,00000000,00000000,00000000,"
+            + std::string( SHA1_DIGEST_SIZE * 2, '0' ) );
+    std::sort( expected.begin(), expected.end() );
+
+    // records come in completion order
+    std::vector<std::string> lines = scanLines( SCAN_CSV );
+    ASSERT_EQ(lines.size(), expected.size() + 1);
+    EXPECT_EQ(lines[0], "path,size,valid,prgbanks,chrbanks,mapper,mirroring,region,fourscreen,battery,trainer,nes2,prg_crc32,chr_crc32,rom_crc32,rom_sha1");
+    lines.erase( lines.begin() );
+    std::sort( lines.begin(), lines.end() );
+    for ( size_t i = 0; i < expected.size(); i++ ) {
+        EXPECT_EQ(lines[i], expected[i]);
+    }
+
+    lines = scanLines( SCAN_JSONL );
+    ASSERT_EQ(lines.size(), expected.size());
+    const uint8_t *prg = &quotedImage[INES_HEADER_SIZE];
+    char record[512];
+    snprintf( record, sizeof( record ),
+            "{\"path\":\"" SCAN_DIR "/sub/b,\\\"q\\\".NES\",\"size\":%zu,\"valid\":true,\"prgbanks\":2,\"chrbanks\":0,"
+            "\"mapper\":1,\"mirroring\":1,\"region\":0,\"fourscreen\":false,\"battery\":true,\"trainer\":false,\"nes2\":false,"
+            "\"prg_crc32\":\"%.8x\",\"chr_crc32\":\"00000000\",\"rom_crc32\":\"%.8x\",\"rom_sha1\":\"%s\"}",
+            quotedImage.size(), crc32( prg, 2 * INES_PRG_BANK_SIZE ), crc32( prg, 2 * INES_PRG_BANK_SIZE ),
+            sha1Hex( prg, 2 * INES_PRG_BANK_SIZE ).c_str() );
+    EXPECT_TRUE(std::find( lines.begin(), lines.end(), std::string( record ) ) != lines.end()) << record;
+
+    std::vector<std::string> files;
+    EXPECT_FALSE(collectNESFiles( SCAN_DIR "/missing", files ));
+    EXPECT_TRUE(files.empty());
+    std::filesystem::remove_all( SCAN_DIR );
+}
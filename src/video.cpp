@@ -0,0 +1,173 @@
+#include "video.h"
+#include "6502.h"
+
+VideoWriter::VideoWriter()
+    : file( NULL ),
+      format( VIDEO_RGB24 ),
+      head( 0 ),
+      queued( 0 ),
+      closing( false ),
+      failed( false ),
+      frames( 0 ),
+      stalls( 0 )
+{
+}
+
+VideoWriter::~VideoWriter()
+{
+    close();
+}
+
+bool VideoWriter::open( std::string name, VideoFormat format )
+{
+    close();
+    file = name == "-" ? stdout : fopen( name.c_str(), "wb" );
+    if ( file == NULL ) {
+        fprintf(stderr,"%s: Unable to open\n",name.c_str());
+        return false;
+    }
+    this->format = format;
+    if ( format == VIDEO_Y4M ) {
+        // NES pixels are 8:7, chroma is averaged over 2x2 so it sits in the middle
+        fprintf( file, "YUV4MPEG2 W%d H%d F%d:%d Ip A8:7 C420jpeg\n", PPU_WIDTH, PPU_HEIGHT, VIDEO_RATE_NUM, VIDEO_RATE_DEN );
+    }
+    for ( int i = 0; i < VIDEO_BUFFERS; i++ ) {
+        buffers[i].resize( frameSize() );
+    }
+    head = 0;
+    queued = 0;
+    closing = false;
+    failed = false;
+    frames = 0;
+    stalls = 0;
+    thread = std::thread( &VideoWriter::loop, this );
+    return true;
+}
+
+size_t VideoWriter::frameSize() const
+{
+    if ( format == VIDEO_Y4M ) {
+        return 6 + PPU_WIDTH * PPU_HEIGHT * 3 / 2;
+    }
+    return PPU_WIDTH * PPU_HEIGHT * 3;
+}
+
+void VideoWriter::encode( PPU &ppu, uint8_t *out ) const
+{
+    uint8_t rgba[PPU_HEIGHT][PPU_WIDTH][4];
+    ppu.convert( PIXEL_RGBA8888, rgba, PPU_WIDTH * 4 );
+    if ( format == VIDEO_RGB24 ) {
+        for ( int y = 0; y < PPU_HEIGHT; y++ ) {
+            for ( int x = 0; x < PPU_WIDTH; x++ ) {
+                memcpy( out, rgba[y][x], 3 );
+                out += 3;
+            }
+        }
+        return;
+    }
+    memcpy( out, "FRAME\n", 6 );
+    uint8_t *luma = out + 6;
+    uint8_t *cb = luma + PPU_WIDTH * PPU_HEIGHT;
+    uint8_t *cr = cb + PPU_WIDTH * PPU_HEIGHT / 4;
+    for ( int y = 0; y < PPU_HEIGHT; y++ ) {
+        for ( int x = 0; x < PPU_WIDTH; x++ ) {
+            const uint8_t *p = rgba[y][x];
+            *luma++ = 16 + ( ( 66 * p[0] + 129 * p[1] + 25 * p[2] + 128 ) >> 8 );
+        }
+    }
+    for ( int y = 0; y < PPU_HEIGHT; y += 2 ) {
+        for ( int x = 0; x < PPU_WIDTH; x += 2 ) {
+            int r = 0, g = 0, b = 0;
+            for ( int i = 0; i < 4; i++ ) {
+                const uint8_t *p = rgba[y + (i >> 1)][x + (i & 1)];
+                r += p[0];
+                g += p[1];
+                b += p[2];
+            }
+            // sums of four pixels, shift two more
+            *cb++ = 128 + ( ( -38 * r - 74 * g + 112 * b + 512 ) >> 10 );
+            *cr++ = 128 + ( ( 112 * r - 94 * g - 18 * b + 512 ) >> 10 );
+        }
+    }
+}
+
+bool VideoWriter::write( PPU &ppu )
+{
+    std::unique_lock<std::mutex> guard( lock );
+    if ( file == NULL || failed ) {
+        return false;
+    }
+    if ( queued == VIDEO_BUFFERS ) {
+        stalls++;
+        freed.wait( guard, [&] { return queued < VIDEO_BUFFERS || failed; } );
+        if ( failed ) {
+            return false;
+        }
+    }
+    // the writer only touches queued buffers, this one is free without the lock
+    int slot = ( head + queued ) % VIDEO_BUFFERS;
+    guard.unlock();
+    encode( ppu, &buffers[slot][0] );
+    guard.lock();
+    queued++;
+    frames++;
+    ready.notify_one();
+    return true;
+}
+
+void VideoWriter::loop()
+{
+    std::unique_lock<std::mutex> guard( lock );
+    while ( true ) {
+        ready.wait( guard, [&] { return queued > 0 || closing; } );
+        if ( queued == 0 ) {
+            return;
+        }
+        const std::vector<uint8_t> &buffer = buffers[head];
+        guard.unlock();
+        bool ok = fwrite( &buffer[0], 1, buffer.size(), file ) == buffer.size();
+        guard.lock();
+        failed |= !ok;
+        head = ( head + 1 ) % VIDEO_BUFFERS;
+        queued--;
+        freed.notify_one();
+    }
+}
+
+bool VideoWriter::close()
+{
+    if ( file == NULL ) {
+        return true;
+    }
+    {
+        std::lock_guard<std::mutex> guard( lock );
+        closing = true;
+    }
+    ready.notify_one();
+    thread.join();
+    bool ok = failed == false && fflush( file ) == 0;
+    if ( file != stdout ) {
+        ok &= fclose( file ) == 0;
+    }
+    file = NULL;
+    if ( ok == false ) {
+        fprintf(stderr,"Error writing video\n");
+    }
+    return ok;
+}
+
+bool VideoWriter::record( CPU &cpu, uint64_t frames )
+{
+    uint64_t last = cpu.ppu.frame + frames;
+    uint64_t written = cpu.ppu.frame;
+    while ( written < last && cpu.exception == false ) {
+        cpu.execute( PPU_FRAME_STEP );
+        if ( cpu.ppu.frame != written ) {
+            written = cpu.ppu.frame;
+            if ( write( cpu.ppu ) == false ) {
+                return false;
+            }
+        }
+    }
+    return cpu.exception == false;
+}
@@ -0,0 +1,62 @@
+#ifndef __VIDEO_H__
+#define __VIDEO_H__
+#include <stdint.h>
+#include <stdio.h>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+struct CPU;
+struct PPU;
+
+#define VIDEO_BUFFERS 2
+// NTSC frame rate, 39375000 / 22 Hz CPU clock over 29780.5 cycles a frame
+#define VIDEO_RATE_NUM 39375000
+#define VIDEO_RATE_DEN 655171
+
+enum VideoFormat
+{
+    VIDEO_RGB24 = 0, // headerless 256x240 frames, bytes R, G, B
+    VIDEO_Y4M, // YUV4MPEG2, 4:2:0 BT.601 limited range
+};
+
+// Frames out to a file or pipe for an external encoder. write() converts the
+// frame into a free buffer and returns, a thread does the writing. The
+// emulation only waits when every buffer is still queued.
+struct VideoWriter
+{
+    FILE *file;
+    VideoFormat format;
+    std::vector<uint8_t> buffers[VIDEO_BUFFERS];
+    int head; // next buffer to write out
+    int queued;
+    bool closing;
+    bool failed;
+    std::thread thread;
+    std::mutex lock;
+    std::condition_variable ready; // a buffer was queued or closing was set
+    std::condition_variable freed;
+    uint64_t frames; // queued since open
+    uint64_t stalls; // times write() waited for a buffer
+
+    VideoWriter();
+    ~VideoWriter();
+
+    // "-" is stdout
+    bool open( std::string name, VideoFormat format );
+    // queue the finished frame, false once writing failed
+    bool write( PPU &ppu );
+    // write out what is queued and close the file
+    bool close();
+
+    // run frames frames and write each one
+    bool record( CPU &cpu, uint64_t frames );
+
+    size_t frameSize() const;
+    void encode( PPU &ppu, uint8_t *out ) const;
+    void loop();
+};
+
+#endif
@@ -0,0 +1,94 @@
+#include "workers.h"
+
+WorkerPool::WorkerPool( int count )
+    : job( NULL ),
+      jobs( 0 ),
+      next( 0 ),
+      finished( 0 ),
+      busy( 0 ),
+      batch( 0 ),
+      quit( false )
+{
+    for ( int i = 0; i < count; i++ ) {
+        threads.push_back( std::thread( &WorkerPool::loop, this ) );
+    }
+}
+
+WorkerPool::~WorkerPool()
+{
+    {
+        std::lock_guard<std::mutex> guard( lock );
+        quit = true;
+    }
+    wake.notify_all();
+    for ( auto &thread : threads ) {
+        thread.join();
+    }
+}
+
+int WorkerPool::work()
+{
+    int done = 0;
+    for ( int i = next++; i < jobs; i = next++ ) {
+        (*job)( i );
+        done++;
+    }
+    return done;
+}
+
+void WorkerPool::loop()
+{
+    uint64_t seen = 0;
+    std::unique_lock<std::mutex> guard( lock );
+    while ( true ) {
+        wake.wait( guard, [&] { return quit || batch != seen; } );
+        if ( quit ) {
+            return;
+        }
+        seen = batch;
+        busy++;
+        guard.unlock();
+        int done = work();
+        guard.lock();
+        finished += done;
+        busy--;
+        if ( busy == 0 ) {
+            idle.notify_all();
+        }
+    }
+}
+
+void WorkerPool::run( int count, const std::function<void( int )> &job )
+{
+    if ( threads.empty() || count <= 1 ) {
+        for ( int i = 0; i < count; i++ ) {
+            job( i );
+        }
+        return;
+    }
+    start( count, job );
+    wait();
+}
+
+void WorkerPool::start( int count, const std::function<void( int )> &job )
+{
+    std::unique_lock<std::mutex> guard( lock );
+    // a thread that woke up late for the last batch reads job and jobs unlocked
+    idle.wait( guard, [&] { return busy == 0; } );
+    this->job = &job;
+    jobs = count;
+    next = 0;
+    finished = 0;
+    batch++;
+    guard.unlock();
+    wake.notify_all();
+}
+
+void WorkerPool::wait()
+{
+    // whatever the threads have not taken yet is run here
+    int done = work();
+    std::unique_lock<std::mutex> guard( lock );
+    finished += done;
+    idle.wait( guard, [&] { return finished == jobs && busy == 0; } );
+}
@@ -0,0 +1,44 @@
+#ifndef __WORKERS_H__
+#define __WORKERS_H__
+#include <stdint.h>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed set of threads that run the numbered jobs of one batch at a time.
+// run blocks: the caller works on the batch too and gets control back once
+// every job is done and every thread is idle again. start returns right away
+// and wait finishes the batch the same way.
+struct WorkerPool
+{
+    std::vector<std::thread> threads;
+    std::mutex lock;
+    std::condition_variable wake;
+    std::condition_variable idle;
+    const std::function<void( int )> *job;
+    int jobs;
+    std::atomic<int> next;
+    int finished;
+    int busy; // threads inside a batch
+    uint64_t batch;
+    bool quit;
+
+    // threads besides the caller
+    WorkerPool( int count );
+    ~WorkerPool();
+
+    // job( 0 ) to job( count - 1 ) in any order and on any thread
+    void run( int count, const std::function<void( int )> &job );
+    // the same split in two, job must stay alive until wait returns
+    void start( int count, const std::function<void( int )> &job );
+    void wait();
+
+    // take jobs until there are none left, returns how many were run
+    int work();
+    void loop();
+};
+
+#endif